@@ -0,0 +1,232 @@
+#include "executor.h"
+#include "memory_manager.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace sonic_field
+{
+    namespace
+    {
+        struct task_group
+        {
+            std::atomic<uint64_t> m_pending{ 0 };
+            std::mutex m_mutex{};
+            std::exception_ptr m_error{};
+        };
+
+        struct task
+        {
+            std::function<void()>* m_work;
+            task_group* m_group;
+        };
+
+        struct task_queue
+        {
+            std::mutex m_mutex{};
+            std::deque<task> m_tasks{};
+        };
+
+        // The queue owned by this thread; threads calling in from outside the pool own none.
+        thread_local int64_t SF_WORKER_INDEX = -1;
+
+        // Each worker pushes and pops at the back of its own queue so nested work stays hot in
+        // its cache; idle threads steal the oldest (largest) work from the front of the others.
+        class work_stealing_pool
+        {
+            std::vector<std::unique_ptr<task_queue>> m_queues;
+            std::vector<std::thread> m_threads;
+            std::mutex m_idle_mutex;
+            std::condition_variable m_idle;
+            std::atomic<uint64_t> m_queued;
+            std::atomic<uint64_t> m_next;
+            bool m_stop;
+
+            bool take(task& into)
+            {
+                auto count = int64_t(m_queues.size());
+                auto self = SF_WORKER_INDEX;
+                if (self >= 0)
+                {
+                    auto& own = *m_queues[self];
+                    std::lock_guard<std::mutex> lock{ own.m_mutex };
+                    if (!own.m_tasks.empty())
+                    {
+                        into = own.m_tasks.back();
+                        own.m_tasks.pop_back();
+                        m_queued.fetch_sub(1);
+                        return true;
+                    }
+                }
+                for (int64_t idx{ 1 }; idx <= count; ++idx)
+                {
+                    auto& other = *m_queues[(self + idx + count) % count];
+                    std::lock_guard<std::mutex> lock{ other.m_mutex };
+                    if (!other.m_tasks.empty())
+                    {
+                        into = other.m_tasks.front();
+                        other.m_tasks.pop_front();
+                        m_queued.fetch_sub(1);
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void work(int64_t index)
+            {
+                SF_WORKER_INDEX = index;
+                while (true)
+                {
+                    task next{};
+                    if (take(next))
+                    {
+                        execute(next);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock{ m_idle_mutex };
+                    m_idle.wait(lock, [&] { return m_stop || m_queued.load() > 0; });
+                    if (m_stop) return;
+                }
+            }
+
+        public:
+            explicit work_stealing_pool(uint64_t workers) :
+                m_queues{},
+                m_threads{},
+                m_idle_mutex{},
+                m_idle{},
+                m_queued{ 0 },
+                m_next{ 0 },
+                m_stop{ false }
+            {
+                for (uint64_t idx{ 0 }; idx < workers; ++idx)
+                    m_queues.emplace_back(new task_queue{});
+                for (uint64_t idx{ 0 }; idx < workers; ++idx)
+                    m_threads.emplace_back([this, idx] { work(int64_t(idx)); });
+            }
+
+            ~work_stealing_pool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ m_idle_mutex };
+                    m_stop = true;
+                }
+                m_idle.notify_all();
+                for (auto& thread : m_threads)
+                    thread.join();
+            }
+
+            void execute(task& what)
+            {
+                try
+                {
+                    (*what.m_work)();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock{ what.m_group->m_mutex };
+                    if (!what.m_group->m_error)
+                        what.m_group->m_error = std::current_exception();
+                }
+                // The group may be gone as soon as this reaches zero, so its waiter is woken
+                // through the pool.
+                if (what.m_group->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    wake();
+            }
+
+            void push(const task& what)
+            {
+                uint64_t idx = SF_WORKER_INDEX >= 0 ?
+                    uint64_t(SF_WORKER_INDEX) :
+                    m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+                {
+                    std::lock_guard<std::mutex> lock{ m_queues[idx]->m_mutex };
+                    m_queues[idx]->m_tasks.push_back(what);
+                }
+                m_queued.fetch_add(1);
+            }
+
+            void wake()
+            {
+                std::lock_guard<std::mutex> lock{ m_idle_mutex };
+                m_idle.notify_all();
+            }
+
+            // Help with whatever is queued until the group is done, sleeping as idle workers do
+            // while the last of its tasks run elsewhere.
+            void wait_for(task_group& group)
+            {
+                while (group.m_pending.load(std::memory_order_acquire))
+                {
+                    task next{};
+                    if (take(next))
+                    {
+                        execute(next);
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> lock{ m_idle_mutex };
+                    m_idle.wait(lock, [&] {
+                        return !group.m_pending.load(std::memory_order_acquire) || m_queued.load() > 0;
+                        });
+                }
+            }
+        };
+
+        uint64_t SF_RENDER_THREADS = 1;
+        std::unique_ptr<work_stealing_pool> SF_POOL{};
+    }
+
+    void set_render_threads(uint64_t count)
+    {
+        SF_MARK_STACK;
+        if (!count)
+            SF_THROW(std::invalid_argument{ "Render threads must be at least 1" });
+        SF_POOL.reset();
+        SF_RENDER_THREADS = count;
+        if (count > 1)
+            SF_POOL.reset(new work_stealing_pool{ count - 1 });
+    }
+
+    uint64_t render_threads()
+    {
+        return SF_RENDER_THREADS;
+    }
+
+    void run_parallel(std::vector<std::function<void()>>& tasks)
+    {
+        SF_MARK_STACK;
+        if (!SF_POOL || tasks.size() < 2)
+        {
+            for (auto& work : tasks)
+                work();
+            return;
+        }
+        // Tasks which end up on a worker carry this thread's stack, so errors in them show the
+        // whole way down.
+        auto frames = SF_STACK_FRAMES();
+        std::vector<std::function<void()>> carried{};
+        carried.reserve(tasks.size());
+        for (uint64_t idx{ 1 }; idx < tasks.size(); ++idx)
+        {
+            carried.emplace_back([&frames, work = &tasks[idx]] {
+                SF_STACK_ADOPT stack{ frames };
+                (*work)();
+                });
+        }
+        task_group group{};
+        group.m_pending.store(tasks.size());
+        for (auto& work : carried)
+            SF_POOL->push({ &work, &group });
+        SF_POOL->wake();
+        task first{ &tasks[0], &group };
+        SF_POOL->execute(first);
+        SF_POOL->wait_for(group);
+        if (group.m_error)
+            std::rethrow_exception(group.m_error);
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Work stealing thread pool used to render independent branches of the signal graph at the same
+// time. With one render thread (the default) everything runs serially on the calling thread.
+namespace sonic_field
+{
+    // Blocks pulled from each independent branch per trip to the pool.
+    constexpr uint64_t SF_PULL_AHEAD_BLOCKS = 32;
+
+    // Total threads used to render, including the one calling into the graph. Must not be changed
+    // while a render is in progress.
+    void set_render_threads(uint64_t count);
+    uint64_t render_threads();
+
+    // Run every task to completion with the calling thread taking part. Tasks may call this
+    // themselves. The first exception thrown by a task is rethrown once all of them have finished.
+    // A task run by a worker sees the caller's stack frames but none of its other thread local
+    // state; in_current_scope (sonic_field.h) gives it the caller's scope.
+    void run_parallel(std::vector<std::function<void()>>& tasks);
+}
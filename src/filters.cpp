@@ -1,202 +1,420 @@
 #include "sonic_field.h"
+#include <bit>
 
 namespace sonic_field
 {
 
-    double rbj_filter::filter(double in0)
+    static bool SF_RBJ_LOOK_AHEAD = false;
+
+    void set_rbj_look_ahead(bool on)
     {
-        // filter
-        double yn = b0a0 * in0 + b1a0 * in1 + b2a0 * in2 - a1a0 * ou1 - a2a0 * ou2;
+        SF_RBJ_LOOK_AHEAD = on;
+    }
 
-        // push in/out buffers
-        in2 = in1;
-        in1 = in0;
-        ou2 = ou1;
-        ou1 = yn;
+    bool rbj_look_ahead()
+    {
+        return SF_RBJ_LOOK_AHEAD;
+    }
 
-        // return output
-        return yn;
+    void rbj_filter::prepare_look_ahead()
+    {
+        m_look_ahead = rbj_look_ahead();
+        if (!m_look_ahead)
+            return;
+        // y[k] = v[k] - a1 y[k-1] - a2 y[k-2] run forward from a unit impulse in v, and from a
+        // unit y[-1] and a unit y[-2] with no v.
+        double impulse[SF_RBJ_AHEAD];
+        double previous[]{ 0.0, 0.0 }, ou1_only[]{ 1.0, 0.0 }, ou2_only[]{ 0.0, 1.0 };
+        for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+        {
+            impulse[k] = (k == 0 ? 1.0 : 0.0) - a1a0 * previous[0] - a2a0 * previous[1];
+            m_from_ou1[k] = -a1a0 * ou1_only[0] - a2a0 * ou1_only[1];
+            m_from_ou2[k] = -a1a0 * ou2_only[0] - a2a0 * ou2_only[1];
+            previous[1] = previous[0];
+            previous[0] = impulse[k];
+            ou1_only[1] = ou1_only[0];
+            ou1_only[0] = m_from_ou1[k];
+            ou2_only[1] = ou2_only[0];
+            ou2_only[0] = m_from_ou2[k];
+        }
+        // Input j of a step reaches output k through the impulse response k - j samples on.
+        for (uint64_t j{ 0 }; j < SF_RBJ_AHEAD; ++j)
+        {
+            for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+                m_from_in[j][k] = k >= j ? impulse[k - j] : 0.0;
+        }
     }
 
-    double* rbj_filter::next()
+    bool rbj_filter::settle()
     {
-        SF_MESG_STACK("rbj_filter::next");
+        if (std::abs(ou1) > SF_SILENCE_THRESHOLD || std::abs(ou2) > SF_SILENCE_THRESHOLD ||
+            std::abs(in1) > SF_SILENCE_THRESHOLD || std::abs(in2) > SF_SILENCE_THRESHOLD)
+            return false;
+        ou1 = ou2 = in1 = in2 = 0.0;
+        return true;
+    }
+
+    double* rbj_filter::filter_block(double* data)
+    {
+        if (data == empty_block() && settle())
+            return data;
         return process_no_skip([&](double* block) {
-            if (block)
+            if (block && m_look_ahead)
             {
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
-                {
-                    block[idx] = filter(block[idx]);
-                };
+                with_block_size([&](auto size) {
+                    static_assert(decltype(size)::value % SF_RBJ_AHEAD == 0);
+                    // The feed forward half for the whole block, which vectorises.
+                    double v[BLOCK_SIZE];
+                    double b0{ b0a0 }, b1{ b1a0 }, b2{ b2a0 };
+                    v[0] = b0 * block[0] + b1 * in1 + b2 * in2;
+                    v[1] = b0 * block[1] + b1 * block[0] + b2 * in1;
+                    for (uint64_t idx{ 2 }; idx < size; ++idx)
+                        v[idx] = b0 * block[idx] + b1 * block[idx - 1] + b2 * block[idx - 2];
+                    in1 = block[size - 1];
+                    in2 = block[size - 2];
+                    // Then the feedback half a step at a time; only o1 and o2 carry between steps.
+                    // Local copies of the coefficients, which writes to the block could otherwise alias.
+                    double from_in[SF_RBJ_AHEAD][SF_RBJ_AHEAD], from_ou1[SF_RBJ_AHEAD], from_ou2[SF_RBJ_AHEAD];
+                    std::copy(&m_from_in[0][0], &m_from_in[0][0] + SF_RBJ_AHEAD * SF_RBJ_AHEAD, &from_in[0][0]);
+                    std::copy(m_from_ou1, m_from_ou1 + SF_RBJ_AHEAD, from_ou1);
+                    std::copy(m_from_ou2, m_from_ou2 + SF_RBJ_AHEAD, from_ou2);
+                    double o1{ ou1 }, o2{ ou2 };
+                    for (uint64_t idx{ 0 }; idx < size; idx += SF_RBJ_AHEAD)
+                    {
+                        // Written lane by lane over k so each line is a vector operation.
+                        double y[SF_RBJ_AHEAD];
+                        for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+                            y[k] = from_in[0][k] * v[idx];
+                        for (uint64_t j{ 1 }; j < SF_RBJ_AHEAD; ++j)
+                        {
+                            for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+                                y[k] += from_in[j][k] * v[idx + j];
+                        }
+                        for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+                            y[k] += from_ou1[k] * o1 + from_ou2[k] * o2;
+                        for (uint64_t k{ 0 }; k < SF_RBJ_AHEAD; ++k)
+                            block[idx + k] = y[k];
+                        o1 = y[SF_RBJ_AHEAD - 1];
+                        o2 = y[SF_RBJ_AHEAD - 2];
+                    }
+                    ou1 = o1;
+                    ou2 = o2;
+                    });
+            }
+            else if (block)
+            {
+                with_block_size([&](auto size) {
+                    // Work on local copies so the history stays in registers across the block.
+                    double i1{ in1 }, i2{ in2 }, o1{ ou1 }, o2{ ou2 };
+                    for (uint64_t idx{ 0 }; idx < size; ++idx)
+                    {
+                        double in0 = block[idx];
+                        double yn = b0a0 * in0 + b1a0 * i1 + b2a0 * i2 - a1a0 * o1 - a2a0 * o2;
+                        i2 = i1;
+                        i1 = in0;
+                        o2 = o1;
+                        o1 = yn;
+                        block[idx] = yn;
+                    };
+                    in1 = i1;
+                    in2 = i2;
+                    ou1 = o1;
+                    ou2 = o2;
+                    });
             }
             return block;
-            }, input().next());
+            }, data);
     }
 
-    const char* rbj_filter::name()
+    double* rbj_filter::next()
     {
-        return "rbj_filter";
+        SF_MESG_STACK("rbj_filter::next");
+        return filter_block(input().next());
     }
 
-    rbj_filter::rbj_filter(filter_type type, double frequency, double q, double db_gain)
+    uint64_t rbj_filter::next_n(std::span<double*> into)
     {
-        // reset filter coeffs
-        b0a0 = b1a0 = b2a0 = a1a0 = a2a0 = 0.0;
-
-        // reset in/out history
-        ou1 = ou2 = in1 = in2 = 0.0f;
+        SF_MESG_STACK("rbj_filter::next_n");
+        auto count = input().next_n(into);
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+            into[idx] = filter_block(into[idx]);
+        return count;
+    }
 
-        bool q_is_bandwidth;
-        double sample_rate = SAMPLES_PER_SECOND;
-        switch (type)
-        {
-        case filter_type::ALLPASS:
-        case filter_type::HIGHPASS:
-        case filter_type::LOWPASS:
-        case filter_type::LOWSHELF:
-        case filter_type::HIGHSHELF:
-            q_is_bandwidth = false;
-            break;
-        default:
-            q_is_bandwidth = true;
-            break;
-        }
-        // System.out.println("Q Is Bandwidth " + q_is_bandwidth);
-        // temp pi
-
-        // temp coef vars
-        double alpha, a0 = 0, a1 = 0, a2 = 0, b0 = 0, b1 = 0, b2 = 0;
-
-        // peaking, lowshelf and hishelf
-        if (type == filter_type::PEAK || type == filter_type::HIGHSHELF || type == filter_type::LOWSHELF)
-        {
-            double A = pow(10.0, (db_gain / 40.0));
-            double omega = 2.0 * PI * frequency / sample_rate;
-            double tsin = sin(omega);
-            double tcos = cos(omega);
-            if (type == filter_type::PEAK) alpha = tsin * sinh(log(2.0) / 2.0 * q * omega / tsin);
-            else
-                alpha = tsin / 2.0 * sqrt((A + 1 / A) * (1 / q - 1) + 2);
+    const char* rbj_filter::name()
+    {
+        return "rbj_filter";
+    }
 
-            double beta = sqrt(A) / q;
+    uint64_t rbj_filter::hash()
+    {
+        signal_hash ret{ name() };
+        ret << b0a0 << b1a0 << b2a0 << a1a0 << a2a0 << ou1 << ou2 << in1 << in2;
+        // Look ahead renders differ in rounding, so are kept apart; direct ones hash as they always have.
+        if (m_look_ahead)
+            ret << uint64_t(SF_RBJ_AHEAD);
+        return ret.inputs(m_inputs).value();
+    }
 
-            // peaking
-            if (type == filter_type::PEAK)
+    namespace
+    {
+        // The maths the rbj design needs. rbj_filter uses the library's...
+        struct exact_maths
+        {
+            static void sin_cos(double x, double& s, double& c)
             {
-                b0 = (1.0 + alpha * A);
-                b1 = (-2.0 * tcos);
-                b2 = (1.0 - alpha * A);
-                a0 = (1.0 + alpha / A);
-                a1 = (-2.0 * tcos);
-                a2 = (1.0 - alpha / A);
+                s = sin(x);
+                c = cos(x);
             }
 
-            // lowshelf
-            if (type == filter_type::LOWSHELF)
+            static double sinh(double x)
             {
-                b0 = (A * ((A + 1.0) - (A - 1.0) * tcos + beta * tsin));
-                b1 = (2.0 * A * ((A - 1.0) - (A + 1.0) * tcos));
-                b2 = (A * ((A + 1.0) - (A - 1.0) * tcos - beta * tsin));
-                a0 = ((A + 1.0) + (A - 1.0) * tcos + beta * tsin);
-                a1 = (-2.0 * ((A - 1.0) + (A + 1.0) * tcos));
-                a2 = ((A + 1.0) + (A - 1.0) * tcos - beta * tsin);
+                return std::sinh(x);
             }
 
-            // hishelf
-            if (type == filter_type::HIGHSHELF)
+            static double exp10(double x)
             {
-                b0 = (A * ((A + 1.0) + (A - 1.0) * tcos + beta * tsin));
-                b1 = (-2.0 * A * ((A - 1.0) + (A + 1.0) * tcos));
-                b2 = (A * ((A + 1.0) + (A - 1.0) * tcos - beta * tsin));
-                a0 = ((A + 1.0) - (A - 1.0) * tcos + beta * tsin);
-                a1 = (2.0 * ((A - 1.0) - (A + 1.0) * tcos));
-                a2 = ((A + 1.0) - (A - 1.0) * tcos - beta * tsin);
+                return pow(10.0, x);
             }
-        }
-        else
-        {
-            // other filters
-            double omega = 2.0 * PI * frequency / sample_rate;
-            double tsin = sin(omega);
-            double tcos = cos(omega);
-
-            if (q_is_bandwidth) alpha = tsin * sinh(log(2.0) / 2.0 * q * omega / tsin);
-            else
-                alpha = tsin / (2.0 * q);
+        };
 
-            // lowpass
-            if (type == filter_type::LOWPASS)
+        // ...and shaped_rbj these polynomials, good to a few parts in 1e15 over the ranges the
+        // design uses them on. They are all inline arithmetic, so designing a block of control
+        // points makes no library calls.
+        struct fast_maths
+        {
+            // For x in [0, pi]: Taylor series at a quarter of the angle, then doubled twice. Taking
+            // cosines as 1 - 2 sin^2 keeps 1 - cos accurate for low frequencies.
+            static void sin_cos(double x, double& s, double& c)
             {
-                b0 = (1.0 - tcos) / 2.0;
-                b1 = 1.0 - tcos;
-                b2 = (1.0 - tcos) / 2.0;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+                double q = x * 0.25;
+                double q2 = q * q;
+                double sq = q * (1.0 + q2 * (-1.0 / 6.0 + q2 * (1.0 / 120.0 + q2 * (-1.0 / 5040.0 + q2 * (1.0 / 362880.0
+                    + q2 * (-1.0 / 39916800.0 + q2 * (1.0 / 6227020800.0 + q2 * (-1.0 / 1307674368000.0))))))));
+                double cq = 1.0 + q2 * (-1.0 / 2.0 + q2 * (1.0 / 24.0 + q2 * (-1.0 / 720.0 + q2 * (1.0 / 40320.0
+                    + q2 * (-1.0 / 3628800.0 + q2 * (1.0 / 479001600.0 + q2 * (-1.0 / 87178291200.0)))))));
+                double sh = 2.0 * sq * cq;
+                double ch = 1.0 - 2.0 * sq * sq;
+                s = 2.0 * sh * ch;
+                c = 1.0 - 2.0 * sh * sh;
             }
 
-            // hipass
-            if (type == filter_type::HIGHPASS)
+            // For |x| up to about 700: e^x = 2^k e^r with |r| <= ln(2) / 2.
+            static double exp(double x)
             {
-                b0 = (1.0 + tcos) / 2.0;
-                b1 = -(1.0 + tcos);
-                b2 = (1.0 + tcos) / 2.0;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+                constexpr double log2e = 1.4426950408889634;
+                constexpr double ln2 = 0.6931471805599453;
+                // Adding and taking away 1.5 * 2^52 rounds to an integer without a library call.
+                constexpr double round = 6755399441055744.0;
+                double k = (x * log2e + round) - round;
+                double r = x - k * ln2;
+                double er = 1.0 + r * (1.0 + r * (1.0 / 2.0 + r * (1.0 / 6.0 + r * (1.0 / 24.0 + r * (1.0 / 120.0
+                    + r * (1.0 / 720.0 + r * (1.0 / 5040.0 + r * (1.0 / 40320.0 + r * (1.0 / 362880.0
+                    + r * (1.0 / 3628800.0 + r * (1.0 / 39916800.0 + r * (1.0 / 479001600.0))))))))))));
+                return er * std::bit_cast<double>(uint64_t(int64_t(k) + 1023) << 52);
             }
 
-            // bandpass csg
-            if (type == filter_type::BANDPASS_SKIRT)
+            static double sinh(double x)
             {
-                b0 = tsin / 2.0;
-                b1 = 0.0;
-                b2 = -tsin / 2;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+                double e = exp(x);
+                return (e - 1.0 / e) * 0.5;
             }
 
-            // bandpass czpg
-            if (type == filter_type::BANDPASS_PEAK)
+            static double exp10(double x)
             {
-                b0 = alpha;
-                b1 = 0.0;
-                b2 = -alpha;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+                return exp(x * 2.302585092994046);
             }
+        };
+
+        // The cookbook design itself, for one type so a loop of designs has no branches.
+        template<typename M, filter_type type>
+        rbj_coefficients rbj_design(double frequency, double q, double db_gain, double sample_rate)
+        {
+            constexpr bool q_is_bandwidth = !(type == filter_type::ALLPASS || type == filter_type::HIGHPASS ||
+                type == filter_type::LOWPASS || type == filter_type::LOWSHELF || type == filter_type::HIGHSHELF);
+            // System.out.println("Q Is Bandwidth " + q_is_bandwidth);
+            // temp pi
 
-            // notch
-            if (type == filter_type::NOTCH)
+            // temp coef vars
+            double alpha, a0 = 0, a1 = 0, a2 = 0, b0 = 0, b1 = 0, b2 = 0;
+
+            // peaking, lowshelf and hishelf
+            if constexpr (type == filter_type::PEAK || type == filter_type::HIGHSHELF || type == filter_type::LOWSHELF)
             {
-                b0 = 1.0;
-                b1 = -2.0 * tcos;
-                b2 = 1.0;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+                double A = M::exp10(db_gain / 40.0);
+                double omega = 2.0 * PI * frequency / sample_rate;
+                double tsin, tcos;
+                M::sin_cos(omega, tsin, tcos);
+                if constexpr (type == filter_type::PEAK) alpha = tsin * M::sinh(log(2.0) / 2.0 * q * omega / tsin);
+                else
+                    alpha = tsin / 2.0 * sqrt((A + 1 / A) * (1 / q - 1) + 2);
+
+                double beta = sqrt(A) / q;
+
+                // peaking
+                if constexpr (type == filter_type::PEAK)
+                {
+                    b0 = (1.0 + alpha * A);
+                    b1 = (-2.0 * tcos);
+                    b2 = (1.0 - alpha * A);
+                    a0 = (1.0 + alpha / A);
+                    a1 = (-2.0 * tcos);
+                    a2 = (1.0 - alpha / A);
+                }
+
+                // lowshelf
+                if constexpr (type == filter_type::LOWSHELF)
+                {
+                    b0 = (A * ((A + 1.0) - (A - 1.0) * tcos + beta * tsin));
+                    b1 = (2.0 * A * ((A - 1.0) - (A + 1.0) * tcos));
+                    b2 = (A * ((A + 1.0) - (A - 1.0) * tcos - beta * tsin));
+                    a0 = ((A + 1.0) + (A - 1.0) * tcos + beta * tsin);
+                    a1 = (-2.0 * ((A - 1.0) + (A + 1.0) * tcos));
+                    a2 = ((A + 1.0) + (A - 1.0) * tcos - beta * tsin);
+                }
+
+                // hishelf
+                if constexpr (type == filter_type::HIGHSHELF)
+                {
+                    b0 = (A * ((A + 1.0) + (A - 1.0) * tcos + beta * tsin));
+                    b1 = (-2.0 * A * ((A - 1.0) + (A + 1.0) * tcos));
+                    b2 = (A * ((A + 1.0) + (A - 1.0) * tcos - beta * tsin));
+                    a0 = ((A + 1.0) - (A - 1.0) * tcos + beta * tsin);
+                    a1 = (2.0 * ((A - 1.0) - (A + 1.0) * tcos));
+                    a2 = ((A + 1.0) - (A - 1.0) * tcos - beta * tsin);
+                }
+            }
+            else
+            {
+                // other filters
+                double omega = 2.0 * PI * frequency / sample_rate;
+                double tsin, tcos;
+                M::sin_cos(omega, tsin, tcos);
+
+                if constexpr (q_is_bandwidth) alpha = tsin * M::sinh(log(2.0) / 2.0 * q * omega / tsin);
+                else
+                    alpha = tsin / (2.0 * q);
+
+                // lowpass
+                if constexpr (type == filter_type::LOWPASS)
+                {
+                    b0 = (1.0 - tcos) / 2.0;
+                    b1 = 1.0 - tcos;
+                    b2 = (1.0 - tcos) / 2.0;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
+
+                // hipass
+                if constexpr (type == filter_type::HIGHPASS)
+                {
+                    b0 = (1.0 + tcos) / 2.0;
+                    b1 = -(1.0 + tcos);
+                    b2 = (1.0 + tcos) / 2.0;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
+
+                // bandpass csg
+                if constexpr (type == filter_type::BANDPASS_SKIRT)
+                {
+                    b0 = tsin / 2.0;
+                    b1 = 0.0;
+                    b2 = -tsin / 2;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
+
+                // bandpass czpg
+                if constexpr (type == filter_type::BANDPASS_PEAK)
+                {
+                    b0 = alpha;
+                    b1 = 0.0;
+                    b2 = -alpha;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
+
+                // notch
+                if constexpr (type == filter_type::NOTCH)
+                {
+                    b0 = 1.0;
+                    b1 = -2.0 * tcos;
+                    b2 = 1.0;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
+
+                // allpass
+                if constexpr (type == filter_type::ALLPASS)
+                {
+                    b0 = 1.0 - alpha;
+                    b1 = -2.0 * tcos;
+                    b2 = 1.0 + alpha;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0 * tcos;
+                    a2 = 1.0 - alpha;
+                }
             }
 
-            // allpass
-            if (type == filter_type::ALLPASS)
+            return { b0 / a0, b1 / a0, b2 / a0, a1 / a0, a2 / a0 };
+        }
+
+        // Calls design with the type as a std::integral_constant.
+        template<typename D>
+        inline decltype(auto) with_filter_type(filter_type type, D&& design)
+        {
+            switch (type)
             {
-                b0 = 1.0 - alpha;
-                b1 = -2.0 * tcos;
-                b2 = 1.0 + alpha;
-                a0 = 1.0 + alpha;
-                a1 = -2.0 * tcos;
-                a2 = 1.0 - alpha;
+            case filter_type::LOWPASS:
+                return design(std::integral_constant<filter_type, filter_type::LOWPASS>{});
+            case filter_type::HIGHPASS:
+                return design(std::integral_constant<filter_type, filter_type::HIGHPASS>{});
+            case filter_type::BANDPASS_SKIRT:
+                return design(std::integral_constant<filter_type, filter_type::BANDPASS_SKIRT>{});
+            case filter_type::BANDPASS_PEAK:
+                return design(std::integral_constant<filter_type, filter_type::BANDPASS_PEAK>{});
+            case filter_type::NOTCH:
+                return design(std::integral_constant<filter_type, filter_type::NOTCH>{});
+            case filter_type::ALLPASS:
+                return design(std::integral_constant<filter_type, filter_type::ALLPASS>{});
+            case filter_type::PEAK:
+                return design(std::integral_constant<filter_type, filter_type::PEAK>{});
+            case filter_type::LOWSHELF:
+                return design(std::integral_constant<filter_type, filter_type::LOWSHELF>{});
+            case filter_type::HIGHSHELF:
+                return design(std::integral_constant<filter_type, filter_type::HIGHSHELF>{});
+            default:
+                SF_THROW(std::invalid_argument{ "Unknown filter type: " + std::to_string(uint64_t(type)) });
             }
         }
 
-        // set filter coeffs
-        b0a0 = (b0 / a0);
-        b1a0 = (b1 / a0);
-        b2a0 = (b2 / a0);
-        a1a0 = (a1 / a0);
-        a2a0 = (a2 / a0);
+        template<typename M>
+        rbj_coefficients rbj_design(filter_type type, double frequency, double q, double db_gain, double sample_rate)
+        {
+            return with_filter_type(type, [&](auto t) {
+                return rbj_design<M, decltype(t)::value>(frequency, q, db_gain, sample_rate);
+                });
+        }
+    }
+
+    rbj_filter::rbj_filter(filter_type type, double frequency, double q, double db_gain)
+    {
+        // reset in/out history
+        ou1 = ou2 = in1 = in2 = 0.0f;
+
+        auto c = rbj_design<exact_maths>(type, frequency, q, db_gain, sonic_field::sample_rate());
+        b0a0 = c.b0a0;
+        b1a0 = c.b1a0;
+        b2a0 = c.b2a0;
+        a1a0 = c.a1a0;
+        a2a0 = c.a2a0;
+        prepare_look_ahead();
     }
 
     rbj_filter::rbj_filter(double b0a0, double  b1a0, double  b2a0, double  a1a0, double a2a0):
@@ -209,7 +427,9 @@ namespace sonic_field
         ou2{ 0 },
         in1{ 0 },
         in2{ 0 }
-    {}
+    {
+        prepare_look_ahead();
+    }
 
     rbj_filter::memory rbj_filter::store_memory() const
     {
@@ -229,6 +449,220 @@ namespace sonic_field
         return new rbj_filter{ b0a0, b1a0, b2a0, a1a0, a2a0 };
     }
 
+    biquad_bank::biquad_bank(uint64_t stages, const std::vector<biquad_channel>& channels) :
+        m_channels{ channels },
+        m_stages{ preview() ? 1 : stages },
+        m_coefficients((channels.size() + SF_BIQUAD_LANES - 1) / SF_BIQUAD_LANES, lane_coefficients{}),
+        m_history{}
+    {
+        SF_MARK_STACK;
+        if (channels.empty())
+            SF_THROW(std::invalid_argument{ "No channels in biquad_bank" });
+        if (stages == 0)
+            SF_THROW(std::invalid_argument{ "No stages in biquad_bank" });
+        m_history.resize(m_coefficients.size() * m_stages, lane_history{});
+        for (uint64_t idx{ 0 }; idx < channels.size(); ++idx)
+        {
+            const auto& channel = channels[idx];
+            rbj_filter design{ channel.m_type, channel.m_frequency, channel.m_q, channel.m_db_gain };
+            auto& group = m_coefficients[idx / SF_BIQUAD_LANES];
+            auto lane = idx % SF_BIQUAD_LANES;
+            group.b0a0[lane] = design.b0a0;
+            group.b1a0[lane] = design.b1a0;
+            group.b2a0[lane] = design.b2a0;
+            group.a1a0[lane] = design.a1a0;
+            group.a2a0[lane] = design.a2a0;
+            group.gain[lane] = channel.m_gain;
+        }
+    }
+
+    // As rbj_filter::settle but for the bank as a whole.
+    bool biquad_bank::settle()
+    {
+        for (const auto& history : m_history)
+        {
+            for (uint64_t lane{ 0 }; lane < SF_BIQUAD_LANES; ++lane)
+            {
+                if (std::abs(history.ou1[lane]) > SF_SILENCE_THRESHOLD || std::abs(history.ou2[lane]) > SF_SILENCE_THRESHOLD ||
+                    std::abs(history.in1[lane]) > SF_SILENCE_THRESHOLD || std::abs(history.in2[lane]) > SF_SILENCE_THRESHOLD)
+                    return false;
+            }
+        }
+        std::fill(m_history.begin(), m_history.end(), lane_history{});
+        return true;
+    }
+
+    // Runs a group's lanes through every stage over a block, leaving each lane's output in lanes
+    // (BLOCK_SIZE rows of SF_BIQUAD_LANES).
+    void biquad_bank::filter_group(uint64_t group, const double* block, double* lanes)
+    {
+        const auto& c = m_coefficients[group];
+        auto history = m_history.data() + group * m_stages;
+        auto lane_at = reinterpret_cast<double(*)[SF_BIQUAD_LANES]>(lanes);
+        with_block_size([&](auto size) {
+            for (uint64_t idx{ 0 }; idx < size; ++idx)
+            {
+                for (uint64_t lane{ 0 }; lane < SF_BIQUAD_LANES; ++lane)
+                    lane_at[idx][lane] = block[idx];
+            }
+            // A stage at a time over the whole block, as the chain of rbj_filters would, with the
+            // group's history in registers throughout.
+            for (uint64_t stage{ 0 }; stage < m_stages; ++stage, ++history)
+            {
+                auto h = *history;
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
+                {
+                    for (uint64_t lane{ 0 }; lane < SF_BIQUAD_LANES; ++lane)
+                    {
+                        double in0 = lane_at[idx][lane];
+                        double yn = c.b0a0[lane] * in0 + c.b1a0[lane] * h.in1[lane] + c.b2a0[lane] * h.in2[lane]
+                            - c.a1a0[lane] * h.ou1[lane] - c.a2a0[lane] * h.ou2[lane];
+                        h.in2[lane] = h.in1[lane];
+                        h.in1[lane] = in0;
+                        h.ou2[lane] = h.ou1[lane];
+                        h.ou1[lane] = yn;
+                        lane_at[idx][lane] = yn;
+                    }
+                }
+                *history = h;
+            }
+            });
+    }
+
+    // Adds a group's lanes into out in channel order, as an ADD mixer would.
+    void biquad_bank::mix_group(uint64_t group, const double* lanes, double* out)
+    {
+        const auto& c = m_coefficients[group];
+        auto lane_at = reinterpret_cast<const double(*)[SF_BIQUAD_LANES]>(lanes);
+        auto used = std::min(SF_BIQUAD_LANES, m_channels.size() - group * SF_BIQUAD_LANES);
+        with_block_size([&](auto size) {
+            for (uint64_t idx{ 0 }; idx < size; ++idx)
+            {
+                for (uint64_t lane{ 0 }; lane < used; ++lane)
+                    out[idx] += lane_at[idx][lane] * c.gain[lane];
+            }
+            });
+    }
+
+    double* biquad_bank::filter_block(double* data)
+    {
+        if (data == empty_block() && settle())
+            return data;
+        return process_no_skip([&](double* block) {
+            if (block)
+            {
+                // Every lane's value after each stage, one group at a time.
+                double lanes[BLOCK_SIZE][SF_BIQUAD_LANES];
+                double out[BLOCK_SIZE]{};
+                for (uint64_t group{ 0 }; group < m_coefficients.size(); ++group)
+                {
+                    filter_group(group, block, &lanes[0][0]);
+                    mix_group(group, &lanes[0][0], out);
+                }
+                std::copy(out, out + block_size(), block);
+            }
+            return block;
+            }, data);
+    }
+
+    // Groups share nothing until they are mixed, so each render thread takes a share of them
+    // through the whole batch; the lanes are then mixed block by block in channel order exactly as
+    // filter_block does.
+    void biquad_bank::filter_batch(std::span<double*> blocks)
+    {
+        SF_MARK_STACK;
+        auto groups = m_coefficients.size();
+        auto stride = BLOCK_SIZE * SF_BIQUAD_LANES;
+        m_batch_lanes.resize(groups * blocks.size() * stride);
+        for (auto& block : blocks)
+            block = writable_block(block);
+        auto shares = std::min(groups, render_threads());
+        std::vector<std::function<void()>> tasks{};
+        for (uint64_t share{ 0 }; share < shares; ++share)
+        {
+            tasks.emplace_back([this, blocks, share, shares, groups, stride]
+            {
+                SF_MESG_STACK("biquad_bank::filter_batch");
+                for (auto group = groups * share / shares; group < groups * (share + 1) / shares; ++group)
+                {
+                    for (uint64_t idx{ 0 }; idx < blocks.size(); ++idx)
+                        filter_group(group, blocks[idx], m_batch_lanes.data() + (group * blocks.size() + idx) * stride);
+                }
+            });
+        }
+        run_parallel(tasks);
+        for (uint64_t idx{ 0 }; idx < blocks.size(); ++idx)
+        {
+            auto block = blocks[idx];
+            std::fill(block, block + block_size(), 0.0);
+            for (uint64_t group{ 0 }; group < groups; ++group)
+                mix_group(group, m_batch_lanes.data() + (group * blocks.size() + idx) * stride, block);
+        }
+    }
+
+    double* biquad_bank::next()
+    {
+        SF_MESG_STACK("biquad_bank::next");
+        return filter_block(input().next());
+    }
+
+    uint64_t biquad_bank::next_n(std::span<double*> into)
+    {
+        SF_MESG_STACK("biquad_bank::next_n");
+        auto count = input().next_n(into);
+        if (render_threads() < 2 || m_coefficients.size() < 2)
+        {
+            for (uint64_t idx{ 0 }; idx < count; ++idx)
+                into[idx] = filter_block(into[idx]);
+            return count;
+        }
+        // Whether silence lets the bank settle depends on everything before it, so silent blocks
+        // go through one at a time between the runs of sound filtered in parallel.
+        uint64_t idx{ 0 };
+        while (idx < count)
+        {
+            if (into[idx] == empty_block())
+            {
+                into[idx] = filter_block(into[idx]);
+                ++idx;
+                continue;
+            }
+            auto end = idx;
+            while (end < count && into[end] != empty_block())
+                ++end;
+            filter_batch(into.subspan(idx, end - idx));
+            idx = end;
+        }
+        return count;
+    }
+
+    const char* biquad_bank::name()
+    {
+        return "biquad_bank";
+    }
+
+    uint64_t biquad_bank::hash()
+    {
+        signal_hash ret{ name() };
+        ret << m_stages;
+        for (const auto& c : m_coefficients)
+        {
+            for (uint64_t lane{ 0 }; lane < SF_BIQUAD_LANES; ++lane)
+                ret << c.b0a0[lane] << c.b1a0[lane] << c.b2a0[lane] << c.a1a0[lane] << c.a2a0[lane] << c.gain[lane];
+        }
+        for (const auto& h : m_history)
+        {
+            for (uint64_t lane{ 0 }; lane < SF_BIQUAD_LANES; ++lane)
+                ret << h.ou1[lane] << h.ou2[lane] << h.in1[lane] << h.in2[lane];
+        }
+        return ret.inputs(m_inputs).value();
+    }
+
+    signal_base* biquad_bank::copy()
+    {
+        return new biquad_bank{ m_stages, m_channels };
+    }
+
     decimator::decimator()
     {
         h0 = (8192 / 16384.0);
@@ -240,6 +674,13 @@ namespace sonic_field
         R1 = R2 = R3 = R4 = R5 = R6 = R7 = R8 = R9 = 0.0;
     }
 
+    bool decimator::settled() const
+    {
+        // With zero input the registers shift out to exactly zero within one block.
+        return R1 == 0.0 && R2 == 0.0 && R3 == 0.0 && R4 == 0.0 && R5 == 0.0 &&
+            R6 == 0.0 && R7 == 0.0 && R8 == 0.0 && R9 == 0.0;
+    }
+
     double decimator::decimate(double d,double e)
     {
         double h9x0 = h9 * d;
@@ -260,144 +701,697 @@ namespace sonic_field
         return R10;
     }
 
-    // I no longer can work out where this came from originally.
-    // The concept of shaping it is my own, the rest is other people's work.
-    // I belive this will be OK to release under GLP, if the original was less stringent then
-    // feel free to copy that and use it instead. This was translated by me from C to Java then
-    // to C++.
-    // PS I think it might have come from http://www.musicdsp.org/showone.php?id=24 wich is now
-    // defunct.
-    class shaped_ladder
+    namespace
     {
-        class inner_filter
-        {
-            double cutoff;
-            double res;
-            double fs;
-            double y1, y2, y3, y4;
-            double oldx;
-            double oldy1, oldy2, oldy3;
-            double x;
-            double r;
-            double p;
-            double k;
-        public:
-            inner_filter()
+        // Kernel positions tabulated between one input sample and the next; resampler interpolates
+        // linearly between neighbouring phases.
+        constexpr int64_t SF_RESAMPLE_PHASES = 256;
+
+        // Inputs either side and the Kaiser window shape, each quality's window being wide enough
+        // for its stop band to sit below the noise of the samples it is given.
+        std::pair<int64_t, double> resample_design(resample_quality quality)
+        {
+            switch (quality)
             {
-                fs = SAMPLES_PER_SECOND;
-                init();
+            case resample_quality::FAST:
+                return { 8, 6.0 };
+            case resample_quality::GOOD:
+                return { 16, 8.0 };
+            case resample_quality::BEST:
+                return { 32, 10.0 };
+            default:
+                SF_THROW(std::invalid_argument{ "Unknown resample quality: " + std::to_string(uint64_t(quality)) });
             }
+        }
 
-            void init()
+        // Zeroth order modified Bessel function of the first kind, for the Kaiser window.
+        double bessel_i0(double x)
+        {
+            double sum{ 1.0 };
+            double term{ 1.0 };
+            for (int k{ 1 }; term > sum * 1.0e-17; ++k)
             {
-                // initialize values
-                y1 = y2 = y3 = y4 = oldx = oldy1 = oldy2 = oldy3 = 0;
-                calc();
+                auto half = x / (2.0 * k);
+                term *= half * half;
+                sum += term;
             }
+            return sum;
+        }
 
-            void calc()
+        // The impulse response of a lowpass at cutoff (a fraction of the input Nyquist) distance
+        // samples from its centre, windowed to nothing at width samples.
+        double windowed_sinc(double distance, double cutoff, double width, double beta)
+        {
+            auto w = distance / width;
+            if (std::abs(w) >= 1.0) return 0.0;
+            auto x = PI * cutoff * distance;
+            auto sinc = std::abs(x) < 1.0e-9 ? 1.0 : std::sin(x) / x;
+            return cutoff * sinc * bessel_i0(beta * std::sqrt(1.0 - w * w)) / bessel_i0(beta);
+        }
+
+        // The odd taps of a half band FIR, scaled so they add up to a half either side: with the
+        // centre taken as one that is exactly unity gain for a constant.
+        std::vector<double> half_band_design(resample_quality quality)
+        {
+            auto [half, beta] = resample_design(quality);
+            std::vector<double> ret{};
+            double sum{ 0.0 };
+            for (int64_t idx{ 0 }; idx < half; ++idx)
             {
-                double f = (cutoff + cutoff) / fs; // [0 - 1]
-                p = f * (1.8f - 0.8f * f);
-                k = p + p - 1.f;
+                ret.push_back(windowed_sinc(idx + 0.5, 1.0, half, beta));
+                sum += 2.0 * ret.back();
+            }
+            for (auto& c : ret)
+                c /= sum;
+            return ret;
+        }
+    }
 
-                double t = (1.f - p) * 1.386249f;
-                double t2 = 12.f + t * t;
-                r = res * (t2 + 6.f * t) / (t2 - 6.f * t);
+    half_band_upsampler::half_band_upsampler(resample_quality quality) :
+        m_coefficients{ half_band_design(quality) }
+    {}
+
+    void half_band_upsampler::upsample(const double* in, double* out, uint64_t count) const
+    {
+        auto taps = m_coefficients.size();
+        double odd[WIRE_BLOCK_SIZE];
+        for (uint64_t start{ 0 }; start < count; start += WIRE_BLOCK_SIZE)
+        {
+            auto run = std::min(WIRE_BLOCK_SIZE, count - start);
+            auto from = in + start;
+            for (uint64_t idx{ 0 }; idx < run; ++idx)
+                odd[idx] = 0.0;
+            // Tap by tap over the run rather than sample by sample over the taps, so the inner
+            // loop is independent lanes the compiler can vectorise.
+            for (uint64_t tap{ 0 }; tap < taps; ++tap)
+            {
+                auto c = m_coefficients[tap];
+                auto before = from - tap;
+                auto after = from + tap + 1;
+                for (uint64_t idx{ 0 }; idx < run; ++idx)
+                    odd[idx] += c * (before[idx] + after[idx]);
+            }
+            for (uint64_t idx{ 0 }; idx < run; ++idx)
+            {
+                out[2 * (start + idx)] = from[idx];
+                out[2 * (start + idx) + 1] = odd[idx];
             }
+        }
+    }
 
-            double process(double input)
+    half_band_downsampler::half_band_downsampler(resample_quality quality) :
+        m_coefficients{ half_band_design(quality) }
+    {
+        for (auto& c : m_coefficients)
+            c *= 0.5;
+    }
+
+    void half_band_downsampler::downsample(const double* in, double* out, uint64_t count) const
+    {
+        auto taps = m_coefficients.size();
+        double odd[WIRE_BLOCK_SIZE];
+        for (uint64_t start{ 0 }; start < count; start += WIRE_BLOCK_SIZE)
+        {
+            auto run = std::min(WIRE_BLOCK_SIZE, count - start);
+            auto from = in + 2 * start;
+            for (uint64_t idx{ 0 }; idx < run; ++idx)
+                odd[idx] = 0.0;
+            for (uint64_t tap{ 0 }; tap < taps; ++tap)
             {
-                // process input
-                x = input - r * y4;
+                auto c = m_coefficients[tap];
+                auto before = from - 2 * tap - 1;
+                auto after = from + 2 * tap + 1;
+                for (uint64_t idx{ 0 }; idx < run; ++idx)
+                    odd[idx] += c * (before[2 * idx] + after[2 * idx]);
+            }
+            for (uint64_t idx{ 0 }; idx < run; ++idx)
+                out[start + idx] = 0.5 * from[2 * idx] + odd[idx];
+        }
+    }
+
+    resampler::resampler(double ratio, resample_quality quality) :
+        m_ratio{ ratio },
+        m_quality{ quality },
+        m_half{ 0 },
+        m_table{},
+        m_in{},
+        m_first{ 0 },
+        m_read{ 0 },
+        m_ended{ false },
+        m_produced{ 0 }
+    {
+        SF_MARK_STACK;
+        if (!(ratio > 0.0) || !std::isfinite(ratio))
+            SF_THROW(std::invalid_argument{ "Resample ratio must be positive: " + std::to_string(ratio) });
+        auto [half, beta] = resample_design(quality);
+        // Going down, the cutoff falls to the new Nyquist and the kernel widens to match.
+        auto cutoff = std::min(1.0, ratio);
+        auto width = half / cutoff;
+        m_half = int64_t(std::ceil(width));
+        m_table.resize((SF_RESAMPLE_PHASES + 1) * 2 * m_half);
+        for (int64_t phase{ 0 }; phase <= SF_RESAMPLE_PHASES; ++phase)
+        {
+            auto fraction = double(phase) / SF_RESAMPLE_PHASES;
+            auto row = &m_table[phase * 2 * m_half];
+            for (int64_t idx{ 0 }; idx < 2 * m_half; ++idx)
+                row[idx] = windowed_sinc(idx - m_half + 1 - fraction, cutoff, width, beta);
+        }
+        // The first outputs reach back before the start, which is silence.
+        m_in.assign(m_half, 0.0);
+        m_first = -m_half;
+    }
+
+    void resampler::pull()
+    {
+        auto block = input().next();
+        if (!block)
+        {
+            // Enough silence after the end for the last outputs.
+            m_ended = true;
+            m_in.insert(m_in.end(), 2 * m_half, 0.0);
+            return;
+        }
+        if (block == empty_block())
+        {
+            m_in.insert(m_in.end(), block_size(), 0.0);
+        }
+        else
+        {
+            m_in.insert(m_in.end(), block, block + block_size());
+            free_block(block);
+        }
+        m_read += block_size();
+    }
 
-                // Four cascaded onepole filters (bilinear transform)
-                y1 = x * p + oldx * p - k * y1;
-                y2 = y1 * p + oldy1 * p - k * y2;
-                y3 = y2 * p + oldy2 * p - k * y3;
-                y4 = y3 * p + oldy3 * p - k * y4;
+    uint64_t resampler::output_length() const
+    {
+        // Allow for rounding in the ratio so whole numbers of samples stay whole.
+        return uint64_t(std::ceil(m_read * m_ratio - 1.0e-6));
+    }
 
-                // Clipper band limited sigmoid
-                y4 -= (y4 * y4 * y4) / 6.f;
+    double* resampler::next()
+    {
+        SF_MESG_STACK("resampler::next");
+        // Read far enough to know whether there is anything left to produce.
+        auto needed = int64_t(std::floor(double(m_produced) / m_ratio)) + m_half;
+        while (!m_ended && m_first + int64_t(m_in.size()) <= needed)
+            pull();
+        auto length = output_length();
+        if (m_ended && m_produced >= length) return nullptr;
 
-                oldx = x;
-                oldy1 = y1;
-                oldy2 = y2;
-                oldy3 = y3;
-                return y4;
+        auto ret = new_block(false);
+        for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+        {
+            auto time = double(m_produced) / m_ratio;
+            auto sample = int64_t(std::floor(time));
+            // Everything up to the last input this output needs.
+            while (!m_ended && m_first + int64_t(m_in.size()) <= sample + m_half)
+            {
+                pull();
+                length = output_length();
             }
-
-            void set_cutoff(double c)
+            if (m_ended && m_produced >= length)
             {
-                // Only recalculate when the change is bigger than
-                // one cent
-                double cc = c / cutoff;
-                if (cc < 1.0) cc = 1.0 / cc;
-                if (cc > 1.0005777895)
-                {
-                    // System.out.println("Recomputing c " + c);
-                    cutoff = c;
-                    calc();
-                }
+                // Pad out the last block.
+                ret[idx] = 0.0;
+                continue;
+            }
+            auto position = (time - sample) * SF_RESAMPLE_PHASES;
+            auto phase = std::min(int64_t(position), SF_RESAMPLE_PHASES - 1);
+            auto fraction = position - phase;
+            auto row = &m_table[phase * 2 * m_half];
+            auto next_row = row + 2 * m_half;
+            auto x = &m_in[sample - m_half + 1 - m_first];
+            double a{ 0.0 };
+            double b{ 0.0 };
+            for (int64_t tap{ 0 }; tap < 2 * m_half; ++tap)
+            {
+                a += x[tap] * row[tap];
+                b += x[tap] * next_row[tap];
             }
+            ret[idx] = a + (b - a) * fraction;
+            ++m_produced;
+        }
+        // Drop input no output will look at again, a batch at a time.
+        auto oldest = int64_t(std::floor(double(m_produced) / m_ratio)) - m_half + 1;
+        if (oldest - m_first > int64_t(16 * block_size()))
+        {
+            m_in.erase(m_in.begin(), m_in.begin() + (oldest - m_first));
+            m_first = oldest;
+        }
+        return ret;
+    }
+
+    const char* resampler::name()
+    {
+        return "resampler";
+    }
+
+    uint64_t resampler::hash()
+    {
+        return (signal_hash{ name() } << m_ratio << uint64_t(m_quality) << m_produced).inputs(m_inputs).value();
+    }
+
+    signal_base* resampler::copy()
+    {
+        return new resampler{ m_ratio, m_quality };
+    }
+
+    // The engine of ladder_filter_driver, for SF_LADDER_LANES voices or one.
+    class shaped_ladder
+    {
+    public:
+        virtual ~shaped_ladder() = default;
+        // Filters a block of each of the first used voices and adds them into sum. Null inputs
+        // flush the filter: silence in with the controls held.
+        virtual void process(double** signals, double** resonances, double** cutoffs, uint64_t used, double* sum) = 0;
+        // How many samples late the output comes.
+        virtual uint64_t latency() const = 0;
+    };
+
+    namespace
+    {
+        constexpr uint64_t SF_MAX_LADDER_OVERSAMPLE = 4;
+
+        // A half band FIR run over a stream: each keeps the context it reads either side of a run
+        // from one call to the next, so its output is taps() samples (at the lower rate) late.
+        void upsample_stream(const half_band_upsampler& upsampler, std::vector<double>& context,
+            const double* in, double* out, uint64_t count)
+        {
+            auto taps = upsampler.taps();
+            double buffer[2 * SF_MAX_RESAMPLE_TAPS + SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+            std::copy(context.begin(), context.end(), buffer);
+            std::copy(in, in + count, buffer + context.size());
+            upsampler.upsample(buffer + taps - 1, out, count);
+            std::copy(buffer + count, buffer + count + context.size(), context.begin());
+        }
+
+        void downsample_stream(const half_band_downsampler& downsampler, std::vector<double>& context,
+            const double* in, double* out, uint64_t count)
+        {
+            auto taps = downsampler.taps();
+            double buffer[4 * SF_MAX_RESAMPLE_TAPS + SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+            std::copy(context.begin(), context.end(), buffer);
+            std::copy(in, in + 2 * count, buffer + context.size());
+            downsampler.downsample(buffer + 2 * taps, out, count);
+            std::copy(buffer + 2 * count, buffer + 2 * count + context.size(), context.begin());
+        }
+
+        // A control input moved late by the upsampling's latency, so it stays with the signal.
+        class delayed_control
+        {
+            double m_tail[BLOCK_SIZE];
+            bool m_tail_constant;
+            bool m_started;
+            double m_last;
+
+        public:
+            delayed_control() :
+                m_tail_constant{ true },
+                m_started{ false },
+                m_last{ 0.0 }
+            {}
 
-            void set_res(double r1)
+            // Fills out with a block delay samples late, null holding the last value. True if every
+            // value out is the same.
+            bool next(const double* block, uint64_t delay, double* out)
             {
-                // Only recalculate when the change is bigger than
-                // one cent
-                double rr = r1 / cutoff;
-                if (rr < 1.0) rr = 1.0 / r1;
-                if (rr > 1.0005777895)
+                auto size = block_size();
+                double value{ m_last };
+                bool constant = !block || is_constant_block(block, value);
+                if (!m_started)
+                {
+                    // Nothing came before, so start as the controls do.
+                    std::fill(m_tail, m_tail + delay, constant ? value : block[0]);
+                    m_tail_constant = true;
+                    m_started = true;
+                }
+                bool ret = constant && (delay == 0 || (m_tail_constant && m_tail[0] == value));
+                std::copy(m_tail, m_tail + delay, out);
+                if (constant)
+                {
+                    std::fill(out + delay, out + size, value);
+                    std::fill(m_tail, m_tail + delay, value);
+                }
+                else
                 {
-                    res = r1;
-                    calc();
+                    std::copy(block, block + size - delay, out + delay);
+                    std::copy(block + size - delay, block + size, m_tail);
+                    value = block[size - 1];
                 }
+                m_tail_constant = constant;
+                m_last = value;
+                return ret;
             }
         };
 
-        inner_filter filter{};
+        // From the cutoff (Hz) and resonance, and the rate the ladder runs at.
+        void ladder_design(double cutoff, double resonance, double rate, double& p, double& r)
+        {
+            double f = (cutoff + cutoff) / rate; // [0 - 1]
+            p = f * (1.8f - 0.8f * f);
 
-    public:
+            double t = (1.f - p) * 1.386249f;
+            double t2 = 12.f + t * t;
+            r = resonance * (t2 + 6.f * t) / (t2 - 6.f * t);
+        }
 
-        double* process(double* input, double* resonance, double* cutoff)
+        // I no longer can work out where this came from originally.
+        // The concept of shaping it is my own, the rest is other people's work.
+        // I belive this will be OK to release under GLP, if the original was less stringent then
+        // feel free to copy that and use it instead. This was translated by me from C to Java then
+        // to C++.
+        // PS I think it might have come from http://www.musicdsp.org/showone.php?id=24 wich is now
+        // defunct.
+        //
+        // L voices, each in a lane of every array so a step of all of them is one vector step.
+        template<uint64_t L>
+        class ladder_lanes : public shaped_ladder
         {
-            SF_MARK_STACK;
-            double* out = new_block(false);
-            for (uint64_t idx = 0; idx < BLOCK_SIZE; ++idx)
+            uint64_t m_oversample;
+            // Halvings of the rate between the ladders and the signal.
+            uint64_t m_stages;
+            half_band_upsampler m_upsampler;
+            half_band_downsampler m_downsampler;
+            // Context for the FIRs of each halving, voice by voice.
+            std::vector<double> m_up_context[L][2];
+            std::vector<double> m_down_context[L][2];
+            // How late the upsampled signal is.
+            uint64_t m_delay;
+            delayed_control m_resonances[L];
+            delayed_control m_cutoffs[L];
+            double m_y1[L], m_y2[L], m_y3[L], m_y4[L];
+            double m_oldx[L], m_oldy1[L], m_oldy2[L], m_oldy3[L];
+            // As the ladders run now, and the controls they were last worked out for.
+            double m_p[L], m_r[L];
+            double m_resonance[L], m_cutoff[L];
+            bool m_designed;
+
+        public:
+            explicit ladder_lanes(uint64_t oversample) :
+                m_oversample{ oversample },
+                m_stages{ oversample == 4 ? 2u : oversample == 2 ? 1u : 0u },
+                m_upsampler{ resample_quality::FAST },
+                m_downsampler{ resample_quality::FAST },
+                m_delay{ 0 },
+                m_designed{ false }
+            {
+                auto taps = m_upsampler.taps();
+                for (uint64_t stage{ 0 }; stage < m_stages; ++stage)
+                {
+                    for (uint64_t lane{ 0 }; lane < L; ++lane)
+                    {
+                        m_up_context[lane][stage].assign(2 * taps - 1, 0.0);
+                        m_down_context[lane][stage].assign(4 * taps, 0.0);
+                    }
+                    m_delay += taps >> stage;
+                }
+                for (uint64_t lane{ 0 }; lane < L; ++lane)
+                {
+                    m_y1[lane] = m_y2[lane] = m_y3[lane] = m_y4[lane] = 0.0;
+                    m_oldx[lane] = m_oldy1[lane] = m_oldy2[lane] = m_oldy3[lane] = 0.0;
+                    m_p[lane] = m_r[lane] = m_resonance[lane] = m_cutoff[lane] = 0.0;
+                }
+            }
+
+            virtual uint64_t latency() const override
             {
-                filter.set_res(resonance[idx]);
-                filter.set_cutoff(cutoff[idx]);
-                out[idx] = filter.process(input[idx]);
+                // As much again coming back down.
+                return 2 * m_delay;
             }
-            free_block(input);
-            free_block(resonance);
-            free_block(cutoff);
-            return out;
-        }
-    };
 
-    ladder_filter_driver::ladder_filter_driver()
+            virtual void process(double** signals, double** resonances, double** cutoffs, uint64_t used, double* sum) override
+            {
+                SF_MARK_STACK;
+                auto size = block_size();
+                auto high = size * m_oversample;
+                double in[L][SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+                double resonance[L][BLOCK_SIZE];
+                double cutoff[L][BLOCK_SIZE];
+                bool steady{ m_designed };
+                for (uint64_t lane{ 0 }; lane < L; ++lane)
+                {
+                    auto live = signals && lane < used;
+                    auto signal = live ? signals[lane] : nullptr;
+                    if (!signal || signal == empty_block())
+                        std::fill(in[lane], in[lane] + size, 0.0);
+                    else
+                        std::copy(signal, signal + size, in[lane]);
+                    for (uint64_t stage{ 0 }; stage < m_stages; ++stage)
+                    {
+                        double run[SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+                        auto count = size << stage;
+                        std::copy(in[lane], in[lane] + count, run);
+                        upsample_stream(m_upsampler, m_up_context[lane][stage], run, in[lane], count);
+                    }
+                    // Spare lanes hold at zero, which filters nothing.
+                    auto constant = m_resonances[lane].next(live ? resonances[lane] : nullptr, m_delay, resonance[lane]);
+                    constant &= m_cutoffs[lane].next(live ? cutoffs[lane] : nullptr, m_delay, cutoff[lane]);
+                    steady &= constant && resonance[lane][0] == m_resonance[lane] && cutoff[lane][0] == m_cutoff[lane];
+                }
+
+                // Where each control point takes the ladders, at the last sample of its interval so
+                // the ramps arrive on time.
+                auto points = size / SF_LADDER_CONTROL;
+                double to_p[BLOCK_SIZE / SF_LADDER_CONTROL][L];
+                double to_r[BLOCK_SIZE / SF_LADDER_CONTROL][L];
+                auto rate = double(sample_rate() * m_oversample);
+                for (uint64_t point{ 0 }; point < points; ++point)
+                {
+                    auto idx = (point + 1) * SF_LADDER_CONTROL - 1;
+                    for (uint64_t lane{ 0 }; lane < L; ++lane)
+                    {
+                        if (steady)
+                        {
+                            to_p[point][lane] = m_p[lane];
+                            to_r[point][lane] = m_r[lane];
+                        }
+                        else
+                        {
+                            ladder_design(cutoff[lane][idx], resonance[lane][idx], rate, to_p[point][lane], to_r[point][lane]);
+                        }
+                    }
+                }
+                if (!m_designed)
+                {
+                    std::copy(to_p[0], to_p[0] + L, m_p);
+                    std::copy(to_r[0], to_r[0] + L, m_r);
+                    m_designed = true;
+                }
+
+                // Locals the compiler can keep in registers, rather than members the stores to out
+                // might alias.
+                double y1[L], y2[L], y3[L], y4[L], oldx[L], oldy1[L], oldy2[L], oldy3[L], p[L], r[L];
+                for (uint64_t lane{ 0 }; lane < L; ++lane)
+                {
+                    y1[lane] = m_y1[lane];
+                    y2[lane] = m_y2[lane];
+                    y3[lane] = m_y3[lane];
+                    y4[lane] = m_y4[lane];
+                    oldx[lane] = m_oldx[lane];
+                    oldy1[lane] = m_oldy1[lane];
+                    oldy2[lane] = m_oldy2[lane];
+                    oldy3[lane] = m_oldy3[lane];
+                    p[lane] = m_p[lane];
+                    r[lane] = m_r[lane];
+                }
+                // Lane by lane within each sample, so a step of every lane is a vector step; the
+                // output replaces the input as it goes.
+                double lanes[SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE][L];
+                for (uint64_t idx{ 0 }; idx < high; ++idx)
+                {
+                    for (uint64_t lane{ 0 }; lane < L; ++lane)
+                        lanes[idx][lane] = in[lane][idx];
+                }
+                auto each_lane = [](auto operation) {
+                    for (uint64_t lane{ 0 }; lane < L; ++lane)
+                        operation(lane);
+                };
+                auto interval = SF_LADDER_CONTROL * m_oversample;
+                auto step = 1.0 / interval;
+                for (uint64_t point{ 0 }; point < points; ++point)
+                {
+                    double dp[L], dr[L];
+                    for (uint64_t lane{ 0 }; lane < L; ++lane)
+                    {
+                        dp[lane] = (to_p[point][lane] - p[lane]) * step;
+                        dr[lane] = (to_r[point][lane] - r[lane]) * step;
+                    }
+                    for (uint64_t idx{ point * interval }; idx < (point + 1) * interval; ++idx)
+                    {
+                        // Each operation across all the lanes before the next, so each is one
+                        // vector step (written lane by lane the compiler leaves them scalar).
+                        double x[L], k[L];
+                        each_lane([&](uint64_t lane) { p[lane] += dp[lane]; });
+                        each_lane([&](uint64_t lane) { r[lane] += dr[lane]; });
+                        each_lane([&](uint64_t lane) { k[lane] = p[lane] + p[lane] - 1.f; });
+
+                        // process input
+                        each_lane([&](uint64_t lane) { x[lane] = lanes[idx][lane] - r[lane] * y4[lane]; });
+
+                        // Four cascaded onepole filters (bilinear transform)
+                        each_lane([&](uint64_t lane) { y1[lane] = x[lane] * p[lane] + oldx[lane] * p[lane] - k[lane] * y1[lane]; });
+                        each_lane([&](uint64_t lane) { y2[lane] = y1[lane] * p[lane] + oldy1[lane] * p[lane] - k[lane] * y2[lane]; });
+                        each_lane([&](uint64_t lane) { y3[lane] = y2[lane] * p[lane] + oldy2[lane] * p[lane] - k[lane] * y3[lane]; });
+                        each_lane([&](uint64_t lane) { y4[lane] = y3[lane] * p[lane] + oldy3[lane] * p[lane] - k[lane] * y4[lane]; });
+
+                        // Clipper band limited sigmoid
+                        each_lane([&](uint64_t lane) { y4[lane] -= (y4[lane] * y4[lane] * y4[lane]) * (1.0 / 6.0); });
+
+                        each_lane([&](uint64_t lane) { oldx[lane] = x[lane]; });
+                        each_lane([&](uint64_t lane) { oldy1[lane] = y1[lane]; });
+                        each_lane([&](uint64_t lane) { oldy2[lane] = y2[lane]; });
+                        each_lane([&](uint64_t lane) { oldy3[lane] = y3[lane]; });
+                        each_lane([&](uint64_t lane) { lanes[idx][lane] = y4[lane]; });
+                    }
+                    // Land exactly on the point rather than where the steps add up to.
+                    std::copy(to_p[point], to_p[point] + L, p);
+                    std::copy(to_r[point], to_r[point] + L, r);
+                }
+                for (uint64_t lane{ 0 }; lane < L; ++lane)
+                {
+                    m_y1[lane] = y1[lane];
+                    m_y2[lane] = y2[lane];
+                    m_y3[lane] = y3[lane];
+                    m_y4[lane] = y4[lane];
+                    m_oldx[lane] = oldx[lane];
+                    m_oldy1[lane] = oldy1[lane];
+                    m_oldy2[lane] = oldy2[lane];
+                    m_oldy3[lane] = oldy3[lane];
+                    m_p[lane] = p[lane];
+                    m_r[lane] = r[lane];
+                    m_resonance[lane] = resonance[lane][size - 1];
+                    m_cutoff[lane] = cutoff[lane][size - 1];
+                }
+
+                for (uint64_t lane{ 0 }; lane < used; ++lane)
+                {
+                    double run[SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+                    for (uint64_t idx{ 0 }; idx < high; ++idx)
+                        run[idx] = lanes[idx][lane];
+                    for (uint64_t stage{ m_stages }; stage > 0; --stage)
+                    {
+                        auto count = size << (stage - 1);
+                        double half[SF_MAX_LADDER_OVERSAMPLE * BLOCK_SIZE];
+                        downsample_stream(m_downsampler, m_down_context[lane][stage - 1], run, half, count);
+                        std::copy(half, half + count, run);
+                    }
+                    for (uint64_t idx{ 0 }; idx < size; ++idx)
+                        sum[idx] += run[idx];
+                }
+            }
+        };
+    }
+
+    ladder_filter_driver::ladder_filter_driver(uint64_t voices, uint64_t oversample) :
+        m_voices{ voices },
+        m_oversample{ oversample },
+        m_ladders{},
+        m_signals(voices, nullptr),
+        m_resonances(voices, nullptr),
+        m_cutoffs(voices, nullptr),
+        m_pending{},
+        m_skip{ 0 },
+        m_read{ 0 },
+        m_written{ 0 },
+        m_ended{ false }
     {
-        m_ladder = new shaped_ladder{};
+        SF_MARK_STACK;
+        if (voices == 0)
+            SF_THROW(std::invalid_argument{ "Ladder filter needs at least one voice" });
+        if (oversample != 1 && oversample != 2 && oversample != 4)
+            SF_THROW(std::invalid_argument{ "Ladder oversampling must be 1, 2 or 4: " + std::to_string(oversample) });
+        auto rate = preview() ? 1 : oversample;
+        if (voices == 1)
+        {
+            // A lone voice would leave most of a group idle.
+            m_ladders.push_back(new ladder_lanes<1>{ rate });
+        }
+        else
+        {
+            for (uint64_t voice{ 0 }; voice < voices; voice += SF_LADDER_LANES)
+                m_ladders.push_back(new ladder_lanes<SF_LADDER_LANES>{ rate });
+        }
+        m_skip = m_ladders.front()->latency();
     }
 
     ladder_filter_driver::~ladder_filter_driver()
     {
-        delete m_ladder;
+        for (auto ladder : m_ladders)
+            delete ladder;
+    }
+
+    void ladder_filter_driver::release_inputs()
+    {
+        for (uint64_t voice{ 0 }; voice < m_voices; ++voice)
+        {
+            for (auto block : { m_signals[voice], m_resonances[voice], m_cutoffs[voice] })
+            {
+                if (block && block != empty_block()) free_block(block);
+            }
+        }
     }
 
     double* ladder_filter_driver::next()
     {
-        if (input_count() != 3)
-            SF_THROW(std::invalid_argument{ "Ladder filter requires three inputs (signal, resonance, cutoff)" });
-        double* signal = input(0).next();
-        double* resonance = input(1).next();
-        double* cutoff = input(2).next();
-        if (signal == nullptr && resonance == nullptr && cutoff == nullptr)
+        SF_MESG_STACK("ladder_filter_driver::next");
+        if (input_count() != 3 * m_voices)
+            SF_THROW(std::invalid_argument{ "Ladder filter requires three inputs (signal, resonance, cutoff) per voice" });
+        auto size = block_size();
+        // Run on (with silence once the inputs end) until there is a block to give or everything
+        // read has been given.
+        while (m_pending.size() < size && !(m_ended && m_written == m_read))
+        {
+            if (!m_ended)
+            {
+                uint64_t ended{ 0 };
+                for (uint64_t voice{ 0 }; voice < m_voices; ++voice)
+                {
+                    m_signals[voice] = input(3 * voice).next();
+                    m_resonances[voice] = input(3 * voice + 1).next();
+                    m_cutoffs[voice] = input(3 * voice + 2).next();
+                    ended += (m_signals[voice] == nullptr) + (m_resonances[voice] == nullptr) + (m_cutoffs[voice] == nullptr);
+                }
+                if (ended == 3 * m_voices)
+                {
+                    m_ended = true;
+                }
+                else if (ended)
+                {
+                    release_inputs();
+                    SF_THROW(std::invalid_argument{ "Inputs to ladder filter do not have the same length" });
+                }
+                else
+                {
+                    m_read += size;
+                }
+            }
+            double sum[BLOCK_SIZE];
+            std::fill(sum, sum + size, 0.0);
+            auto lanes = m_voices == 1 ? 1 : SF_LADDER_LANES;
+            for (uint64_t group{ 0 }; group < m_ladders.size(); ++group)
+            {
+                auto first = group * lanes;
+                auto used = std::min(lanes, m_voices - first);
+                if (m_ended)
+                    m_ladders[group]->process(nullptr, nullptr, nullptr, used, sum);
+                else
+                    m_ladders[group]->process(&m_signals[first], &m_resonances[first], &m_cutoffs[first], used, sum);
+            }
+            if (!m_ended)
+                release_inputs();
+            auto from = std::min(m_skip, size);
+            m_skip -= from;
+            auto to = m_ended ? std::min(size, from + m_read - m_written) : size;
+            m_pending.insert(m_pending.end(), sum + from, sum + to);
+            m_written += to - from;
+        }
+        if (m_pending.size() < size)
             return nullptr;
-        if (signal == nullptr || resonance == nullptr || cutoff == nullptr)
-            SF_THROW(std::invalid_argument{ "Inputs to ladder filter do not have the same length" });
-        return m_ladder->process(signal, resonance, cutoff);
+        auto ret = new_block(false);
+        std::copy(m_pending.begin(), m_pending.begin() + size, ret);
+        m_pending.erase(m_pending.begin(), m_pending.begin() + size);
+        return ret;
     }
 
     const char* ladder_filter_driver::name()
@@ -407,17 +1401,34 @@ namespace sonic_field
 
     signal_base* ladder_filter_driver::copy()
     {
-        return new ladder_filter_driver{};
+        return new ladder_filter_driver{ m_voices, m_oversample };
     }
 
-    shaped_rbj::shaped_rbj(filter_type type): m_memory{}, m_type{type}
-    {}
+    shaped_rbj::shaped_rbj(filter_type type, uint64_t control) :
+        m_type{ type },
+        m_control{ control },
+        m_designed{ false },
+        m_frequency{ 0 },
+        m_q{ 0 },
+        m_db_gain{ 0 },
+        m_coefficients{},
+        m_memory{}
+    {
+        if (control == 0 || block_size() % control)
+            SF_THROW(std::invalid_argument{ "Shaped rbj control interval must divide the block size: " + std::to_string(control) });
+    }
 
     const char* shaped_rbj::name()
     {
         return "shaped_rbj";
     }
 
+    uint64_t shaped_rbj::hash()
+    {
+        return (signal_hash{ name() } << uint64_t(m_type) << m_control << m_memory.m_ou1 << m_memory.m_ou2 << m_memory.m_in1
+            << m_memory.m_in2).inputs(m_inputs).value();
+    }
+
     double* shaped_rbj::next()
     {
         SF_MESG_STACK("shaped_rbj::next");
@@ -431,25 +1442,365 @@ namespace sonic_field
             return nullptr;
         if (signal == nullptr || frequency == nullptr || q == nullptr || db_gain == nullptr)
             SF_THROW(std::invalid_argument{ "Inputs to shaped rbj filter do not have the same length" });
-        rbj_filter filter{m_type, frequency[0], q[0], db_gain[0]};
-        filter.restore_memory(m_memory);
+
+        double i1{ m_memory.m_in1 }, i2{ m_memory.m_in2 }, o1{ m_memory.m_ou1 }, o2{ m_memory.m_ou2 };
+        auto filter = [&](double* block, uint64_t from, uint64_t to, const rbj_coefficients& c) {
+            for (uint64_t idx{ from }; idx < to; ++idx)
+            {
+                double in0 = block[idx];
+                double yn = c.b0a0 * in0 + c.b1a0 * i1 + c.b2a0 * i2 - c.a1a0 * o1 - c.a2a0 * o2;
+                i2 = i1;
+                i1 = in0;
+                o2 = o1;
+                o1 = yn;
+                block[idx] = yn;
+            }
+        };
+
+        double constant_frequency, constant_q, constant_db_gain;
+        bool constant = is_constant_block(frequency, constant_frequency) && is_constant_block(q, constant_q) &&
+            is_constant_block(db_gain, constant_db_gain);
+        bool steady = constant && m_designed &&
+            constant_frequency == m_frequency && constant_q == m_q && constant_db_gain == m_db_gain;
         auto ret = process_no_skip([&](double* block) {
-            for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+            if (steady)
             {
-                block[idx] = filter.filter(block[idx]);
+                // Nothing to design or interpolate.
+                filter(block, 0, block_size(), m_coefficients);
+                return block;
+            }
+            auto control = [](const double* from, uint64_t idx) {
+                return from == empty_block() ? 0.0 : from[idx];
             };
+            auto points = block_size() / m_control;
+            rbj_coefficients designed[BLOCK_SIZE];
+            auto rate = double(sample_rate());
+            if (constant)
+            {
+                // One design serves every point.
+                auto design = rbj_design<fast_maths>(m_type, constant_frequency, constant_q, constant_db_gain, rate);
+                std::fill(designed, designed + points, design);
+            }
+            else
+            {
+                double frequencies[BLOCK_SIZE], qs[BLOCK_SIZE], db_gains[BLOCK_SIZE];
+                // Each point is the last sample of its interval, so the ramp arrives on time.
+                for (uint64_t point{ 0 }; point < points; ++point)
+                {
+                    auto idx = (point + 1) * m_control - 1;
+                    frequencies[point] = control(frequency, idx);
+                    qs[point] = control(q, idx);
+                    db_gains[point] = control(db_gain, idx);
+                }
+                with_filter_type(m_type, [&](auto type) {
+                    for (uint64_t point{ 0 }; point < points; ++point)
+                    {
+                        designed[point] = rbj_design<fast_maths, decltype(type)::value>(
+                            frequencies[point], qs[point], db_gains[point], rate);
+                    }
+                    });
+            }
+            if (!m_designed)
+                m_coefficients = designed[0];
+            // Ramp each coefficient from one point to the next across the interval.
+            auto step = 1.0 / m_control;
+            for (uint64_t point{ 0 }; point < points; ++point)
+            {
+                const auto& from = m_coefficients;
+                const auto& to = designed[point];
+                rbj_coefficients delta{
+                    (to.b0a0 - from.b0a0) * step, (to.b1a0 - from.b1a0) * step, (to.b2a0 - from.b2a0) * step,
+                    (to.a1a0 - from.a1a0) * step, (to.a2a0 - from.a2a0) * step };
+                auto c = from;
+                for (uint64_t idx{ point * m_control }; idx < (point + 1) * m_control; ++idx)
+                {
+                    c.b0a0 += delta.b0a0;
+                    c.b1a0 += delta.b1a0;
+                    c.b2a0 += delta.b2a0;
+                    c.a1a0 += delta.a1a0;
+                    c.a2a0 += delta.a2a0;
+                    filter(block, idx, idx + 1, c);
+                }
+                m_coefficients = to;
+            }
+            auto last = block_size() - 1;
+            m_frequency = control(frequency, last);
+            m_q = control(q, last);
+            m_db_gain = control(db_gain, last);
+            m_designed = true;
             return block;
             }, signal);
-        m_memory = filter.store_memory();
-        free_block(frequency);
-        free_block(q);
-        free_block(db_gain);
+        m_memory = { o1, o2, i1, i2 };
+        if (frequency != empty_block()) free_block(frequency);
+        if (q != empty_block()) free_block(q);
+        if (db_gain != empty_block()) free_block(db_gain);
         return ret;
     }
 
     signal_base* shaped_rbj::copy()
     {
-        return new shaped_rbj{m_type};
+        return new shaped_rbj{ m_type, m_control };
+    }
+
+    namespace
+    {
+        // Simper's trapezoidal state variable filter, g being tan(pi frequency / rate) and k 1 / q.
+        struct svf_coefficients
+        {
+            double a1, a2, a3, k;
+        };
+
+        // Just short of Nyquist, where the tangent goes to infinity. Kept out of svf_design, as
+        // the compiler will not vectorise a loop with the comparisons in.
+        double svf_frequency(double frequency, double rate)
+        {
+            return std::min(std::max(frequency, 0.0), 0.49 * rate);
+        }
+
+        // Zero q would make k infinite, so it is held just above; out of svf_design likewise.
+        double svf_q(double q)
+        {
+            return std::max(q, 1.0e-3);
+        }
+
+        inline svf_coefficients svf_design(double frequency, double q, double rate)
+        {
+            double s, c;
+            fast_maths::sin_cos(PI * frequency / rate, s, c);
+            double g = s / c;
+            double k = 1.0 / q;
+            double a1 = 1.0 / (1.0 + g * (g + k));
+            double a2 = g * a1;
+            return { a1, a2, g * a2, k };
+        }
+    }
+
+    // Every response is a sum of the input and the two integrator outputs:
+    // c0 v0 + (band - k c0) v1 + c2 v2.
+    struct svf_mix
+    {
+        double c0, band, c2;
+    };
+
+    static svf_mix svf_mix_of(svf_response response)
+    {
+        switch (response)
+        {
+        case svf_response::LOW:
+            return { 0, 0, 1 };
+        case svf_response::BAND:
+            return { 0, 1, 0 };
+        case svf_response::HIGH:
+            return { 1, 0, -1 };
+        case svf_response::NOTCH:
+            return { 1, 0, 0 };
+        case svf_response::PEAK:
+            return { -1, 0, 2 };
+        }
+        SF_THROW(std::invalid_argument{ "Unknown svf response" });
+    }
+
+    svf_filter::svf_filter() :
+        m_taps{},
+        m_pending{},
+        m_started{ false },
+        m_ended{ false },
+        m_designed{ false },
+        m_frequency{ 0 },
+        m_q{ 0 },
+        m_a1{ 0 },
+        m_a2{ 0 },
+        m_a3{ 0 },
+        m_k{ 0 },
+        m_ic1{ 0 },
+        m_ic2{ 0 }
+    {}
+
+    svf_filter::~svf_filter()
+    {
+        for (auto& pending : m_pending)
+        {
+            for (auto block : pending)
+                if (block && block != empty_block()) free_block(block);
+        }
+    }
+
+    const char* svf_filter::name()
+    {
+        return "svf_filter";
+    }
+
+    uint64_t svf_filter::hash()
+    {
+        return (signal_hash{ name() } << m_ic1 << m_ic2).inputs(m_inputs).value();
+    }
+
+    uint64_t svf_filter::tap(svf_response response)
+    {
+        SF_MARK_STACK;
+        if (m_started)
+            SF_THROW(std::logic_error{ "Cannot tap an svf filter once it has been pulled" });
+        m_taps.push_back(response);
+        m_pending.emplace_back();
+        return m_taps.size() - 1;
+    }
+
+    double* svf_filter::next()
+    {
+        SF_MARK_STACK;
+        SF_THROW(std::logic_error{ "An svf filter is pulled through its taps (svf_tap)" });
+    }
+
+    double* svf_filter::take(uint64_t tap)
+    {
+        m_started = true;
+        auto& pending = m_pending.at(tap);
+        if (pending.empty() && !m_ended)
+            step();
+        if (pending.empty())
+            return nullptr;
+        auto block = pending.front();
+        pending.pop_front();
+        return block;
+    }
+
+    // Moves the state on by a block and leaves a block of every tap's response waiting for it.
+    void svf_filter::step()
+    {
+        SF_MESG_STACK("svf_filter::step");
+        if (input_count() != 3)
+            SF_THROW(std::invalid_argument{ "SVF filter requires three inputs (signal, frequency, q)" });
+        double* signal = input(0).next();
+        double* frequency = input(1).next();
+        double* q = input(2).next();
+        if (signal == nullptr && frequency == nullptr && q == nullptr)
+        {
+            m_ended = true;
+            return;
+        }
+        if (signal == nullptr || frequency == nullptr || q == nullptr)
+            SF_THROW(std::invalid_argument{ "Inputs to svf filter do not have the same length" });
+
+        double constant_frequency, constant_q;
+        bool constant_f = is_constant_block(frequency, constant_frequency);
+        bool constant_q_block = is_constant_block(q, constant_q);
+        process_no_skip([&](double* block) {
+            auto size = block_size();
+            double a1[BLOCK_SIZE], a2[BLOCK_SIZE], a3[BLOCK_SIZE], k[BLOCK_SIZE];
+            if (constant_f && constant_q_block)
+            {
+                if (!(m_designed && constant_frequency == m_frequency && constant_q == m_q))
+                {
+                    auto rate = double(sample_rate());
+                    auto design = svf_design(svf_frequency(constant_frequency, rate), svf_q(constant_q), rate);
+                    m_a1 = design.a1;
+                    m_a2 = design.a2;
+                    m_a3 = design.a3;
+                    m_k = design.k;
+                    m_frequency = constant_frequency;
+                    m_q = constant_q;
+                    m_designed = true;
+                }
+                std::fill(a1, a1 + size, m_a1);
+                std::fill(a2, a2 + size, m_a2);
+                std::fill(a3, a3 + size, m_a3);
+                std::fill(k, k + size, m_k);
+            }
+            else
+            {
+                // Every sample its own design, in a loop with nothing carried from one to the
+                // next.
+                auto rate = double(sample_rate());
+                double frequencies[BLOCK_SIZE], qs[BLOCK_SIZE];
+                if (constant_f)
+                {
+                    std::fill(frequencies, frequencies + size, svf_frequency(constant_frequency, rate));
+                }
+                else
+                {
+                    for (uint64_t idx{ 0 }; idx < size; ++idx)
+                        frequencies[idx] = svf_frequency(frequency[idx], rate);
+                }
+                if (constant_q_block)
+                {
+                    std::fill(qs, qs + size, svf_q(constant_q));
+                }
+                else
+                {
+                    for (uint64_t idx{ 0 }; idx < size; ++idx)
+                        qs[idx] = svf_q(q[idx]);
+                }
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
+                {
+                    auto design = svf_design(frequencies[idx], qs[idx], rate);
+                    a1[idx] = design.a1;
+                    a2[idx] = design.a2;
+                    a3[idx] = design.a3;
+                    k[idx] = design.k;
+                }
+                // The next constant block is worked out afresh.
+                m_designed = false;
+            }
+
+            // The state moves on once, keeping the band and low outputs for the taps.
+            double v1s[BLOCK_SIZE], v2s[BLOCK_SIZE];
+            double ic1{ m_ic1 }, ic2{ m_ic2 };
+            for (uint64_t idx{ 0 }; idx < size; ++idx)
+            {
+                double v3 = block[idx] - ic2;
+                double v1 = a1[idx] * ic1 + a2[idx] * v3;
+                double v2 = ic2 + a2[idx] * ic1 + a3[idx] * v3;
+                ic1 = 2.0 * v1 - ic1;
+                ic2 = 2.0 * v2 - ic2;
+                v1s[idx] = v1;
+                v2s[idx] = v2;
+            }
+            m_ic1 = ic1;
+            m_ic2 = ic2;
+
+            // Then each tap is a pass of its own with nothing carried between samples. The first
+            // takes the input's block, so goes last.
+            for (auto tap = m_taps.size(); tap-- > 0;)
+            {
+                auto mix = svf_mix_of(m_taps[tap]);
+                auto out = tap == 0 ? block : new_block(false);
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
+                    out[idx] = mix.c0 * block[idx] + (mix.band - k[idx] * mix.c0) * v1s[idx] + mix.c2 * v2s[idx];
+                m_pending[tap].push_back(out);
+            }
+            return block;
+            }, signal);
+        if (frequency != empty_block()) free_block(frequency);
+        if (q != empty_block()) free_block(q);
+    }
+
+    svf_output::svf_output(svf_filter* filter, svf_response response) :
+        m_filter{ filter },
+        m_response{ response },
+        m_tap{ filter->tap(response) }
+    {}
+
+    double* svf_output::next()
+    {
+        SF_MESG_STACK("svf_output::next");
+        return m_filter->take(m_tap);
+    }
+
+    void svf_output::sources(std::vector<signal_base*>& into)
+    {
+        // Every tap pulls through the one filter, so taps of the same filter are never rendered
+        // apart.
+        into.push_back(m_filter);
+    }
+
+    const char* svf_output::name()
+    {
+        return "svf_output";
+    }
+
+    uint64_t svf_output::hash()
+    {
+        return (signal_hash{ name() } << uint64_t(m_response) << m_tap).input(m_filter->hash()).value();
     }
 
 } // sonic_field
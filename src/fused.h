@@ -0,0 +1,309 @@
+#pragma once
+#include <array>
+#include <type_traits>
+#include <utility>
+#include "sonic_field.h"
+
+// Statically typed processor chains
+// =================================
+// The runtime graph puts every processor in its own heap object behind a virtual next(), so each
+// sample goes out to memory between every stage. Here each stage is a plain type taking one sample
+// and returning one, and joining stages with >> builds a single type for the whole chain. fuse()
+// turns that into one processor whose loop runs every stage on a sample before moving to the next,
+// so the sample stays in a register from the first stage to the last.
+//
+// Use these for fixed chains like generate_rich_base; anything built at run time stays a signal.
+//
+//     generate_noise(length)
+//         >> fuse(fused::seed(pitch, 0.01, 0.75)
+//             >> fused::repeat<2>(fused::rbj(filter_type::PEAK, pitch, 0.2, 20))
+//             >> fused::gain(0.1, 0.005));
+//
+// Each stage computes exactly what its runtime counterpart does, sample for sample, and adds its
+// parameters to the processor's hash() for the render cache. That includes previews: a repeat made
+// while preview() is on runs only its first stage, as repeat() builds only one pass.
+namespace sonic_field
+{
+    namespace fused
+    {
+        struct stage {};
+
+        template<typename S>
+        concept fusable = std::is_base_of_v<stage, S>;
+
+        template<fusable A, fusable B>
+        class then : public stage
+        {
+            A m_first;
+            B m_second;
+
+        public:
+            then(A first, B second) : m_first{ first }, m_second{ second } {}
+
+            double operator()(double x)
+            {
+                return m_second(m_first(x));
+            }
+
+            void hash(signal_hash& into)
+            {
+                m_first.hash(into);
+                m_second.hash(into);
+            }
+        };
+
+        template<fusable A, fusable B>
+        inline then<A, B> operator>>(A first, B second)
+        {
+            return { first, second };
+        }
+
+        // N independent copies of a stage one after another, like repeat() for signals; and like
+        // it, only the first when made for a preview.
+        template<uint64_t N, fusable S>
+        class repeated : public stage
+        {
+            std::array<S, N> m_stages;
+            bool m_all;
+
+            template<std::size_t... I>
+            repeated(const S& proto, std::index_sequence<I...>) :
+                m_stages{ ((void)I, proto)... },
+                m_all{ !preview() }
+            {}
+
+        public:
+            explicit repeated(const S& proto) : repeated(proto, std::make_index_sequence<N>{}) {}
+
+            double operator()(double x)
+            {
+                x = m_stages[0](x);
+                if (m_all)
+                {
+                    for (uint64_t idx{ 1 }; idx < N; ++idx)
+                        x = m_stages[idx](x);
+                }
+                return x;
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << uint64_t(m_all ? N : 1);
+                for (auto& s : m_stages)
+                    s.hash(into);
+            }
+        };
+
+        template<uint64_t N, fusable S>
+        inline repeated<N, S> repeat(const S& proto)
+        {
+            return repeated<N, S>{ proto };
+        }
+
+        // As seeder.
+        class seed : public stage
+        {
+            double m_rate;
+            double m_amplitude;
+            uint64_t m_position;
+
+        public:
+            seed(double pitch, double amplitude, double phase) :
+                m_rate{ 2 * PI * pitch / sample_rate() },
+                m_amplitude{ amplitude },
+                m_position{ uint64_t(sample_rate() * phase) }
+            {}
+
+            double operator()(double x)
+            {
+                return x + fast_cos(m_position++ * m_rate) * m_amplitude;
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << m_rate << m_amplitude << m_position;
+            }
+        };
+
+        // As rbj_filter.
+        class rbj : public stage
+        {
+            rbj_filter m_filter;
+
+        public:
+            rbj(filter_type type, double frequency, double q, double db_gain) :
+                m_filter{ type, frequency, q, db_gain }
+            {}
+
+            double operator()(double x)
+            {
+                return m_filter.filter(x);
+            }
+
+            void hash(signal_hash& into)
+            {
+                into.input(m_filter.hash());
+            }
+        };
+
+        // As gain_controller.
+        class gain : public stage
+        {
+            double m_scale;
+            double m_attack;
+            double m_release;
+
+        public:
+            gain(double attack, double release) : gain(1.0, attack, release) {}
+
+            gain(double scale, double attack, double release) :
+                m_scale{ scale },
+                m_attack{ 1.0 + attack / block_size() },
+                m_release{ 1.0 + release / block_size() }
+            {}
+
+            double operator()(double x)
+            {
+                auto v = x / m_scale;
+                if (std::abs(v) > 0.5)
+                    m_scale *= m_attack;
+                else
+                    m_scale /= m_release;
+                if (v < -1.0)
+                    v = -1.0;
+                else if (v > 1.0)
+                    v = 1.0;
+                return v;
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << m_scale << m_attack << m_release;
+            }
+        };
+
+        // As power.
+        class power : public stage
+        {
+            double m_factor;
+
+        public:
+            explicit power(double factor) : m_factor{ factor } {}
+
+            double operator()(double x)
+            {
+                return x < 0.0 ? -std::pow(-x, m_factor) : std::pow(x, m_factor);
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << m_factor;
+            }
+        };
+
+        // As saturater.
+        class saturate : public stage
+        {
+            double m_factor;
+
+        public:
+            explicit saturate(double factor) : m_factor{ factor } {}
+
+            double operator()(double x)
+            {
+                return x < 0.0 ? x / (m_factor - x) : x / (x + m_factor);
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << m_factor;
+            }
+        };
+
+        // As amplifier.
+        class amplify : public stage
+        {
+            double m_factor;
+
+        public:
+            explicit amplify(double factor) : m_factor{ factor } {}
+
+            double operator()(double x)
+            {
+                return x * m_factor;
+            }
+
+            void hash(signal_hash& into)
+            {
+                into << m_factor;
+            }
+        };
+
+        // Runs a whole chain over each block in a single loop. Silence goes in as zeros since
+        // stages such as seed make sound from it.
+        template<fusable C>
+        class processor : public signal_mono_base
+        {
+            C m_chain;
+
+            double* run(double* data)
+            {
+                return process_no_skip([&](double* block) {
+                    if (block)
+                    {
+                        with_block_size([&](auto size) {
+                            for (uint64_t idx{ 0 }; idx < size; ++idx)
+                            {
+                                block[idx] = m_chain(block[idx]);
+                            }
+                            });
+                    }
+                    return block;
+                    }, data);
+            }
+
+        public:
+            explicit processor(const C& chain) : m_chain{ chain } {}
+
+            virtual double* next() override
+            {
+                SF_MESG_STACK("fused::processor::next");
+                return run(input().next());
+            }
+
+            virtual uint64_t next_n(std::span<double*> into) override
+            {
+                SF_MESG_STACK("fused::processor::next_n");
+                auto count = input().next_n(into);
+                for (uint64_t idx{ 0 }; idx < count; ++idx)
+                    into[idx] = run(into[idx]);
+                return count;
+            }
+
+            virtual const char* name() override
+            {
+                return "fused";
+            }
+
+            virtual uint64_t hash() override
+            {
+                signal_hash ret{ name() };
+                m_chain.hash(ret);
+                return ret.inputs(m_inputs).value();
+            }
+
+            // The copy takes the chain as it stands, so copy before rendering as with repeat().
+            virtual signal_base* copy() override
+            {
+                return new processor{ m_chain };
+            }
+        };
+    }
+
+    template<fused::fusable C>
+    inline signal fuse(const C& chain)
+    {
+        SF_MESG_STACK("fuse - create fused processor");
+        return add_to_scope({ new fused::processor<C>{chain} });
+    }
+}
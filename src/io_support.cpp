@@ -0,0 +1,305 @@
+#include "io_support.h"
+#include "memory_manager.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace sonic_field
+{
+    namespace
+    {
+        constexpr uint64_t SF_READ_AHEAD_BYTES = 1024 * 1024;
+        std::mutex SF_MAPPINGS_MUTEX{};
+        std::unordered_map<std::string, std::weak_ptr<const mapped_file>> SF_MAPPINGS{};
+
+        constexpr uint64_t SF_WRITE_BUFFER_BYTES = 2 * 1024 * 1024;
+        constexpr uint64_t SF_WRITE_ALIGN = 4096;
+
+        struct write_job
+        {
+            int m_fd;
+            const char* m_data;
+            uint64_t m_bytes;
+            uint64_t m_offset;
+            bool* m_busy;
+            int* m_error;
+        };
+
+        // Returns zero or the errno of the failed write.
+        int write_fully(int fd, const char* data, uint64_t bytes, uint64_t offset)
+        {
+            while (bytes)
+            {
+                auto done = pwrite(fd, data, bytes, offset);
+                if (done < 0)
+                {
+                    if (errno == EINTR) continue;
+                    return errno;
+                }
+                data += done;
+                bytes -= done;
+                offset += done;
+            }
+            return 0;
+        }
+
+        // The one thread all buffered writers hand full buffers to. A job's busy flag (guarded by
+        // the mutex) is cleared once its buffer is on its way to disk and can be refilled.
+        class io_thread
+        {
+            std::mutex m_mutex;
+            std::condition_variable m_queued;
+            std::condition_variable m_finished;
+            std::deque<write_job> m_jobs;
+            bool m_stop;
+            std::thread m_thread;
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock{ m_mutex };
+                while (true)
+                {
+                    m_queued.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+                    if (m_jobs.empty()) return;
+                    auto job = m_jobs.front();
+                    m_jobs.pop_front();
+                    lock.unlock();
+                    auto error = write_fully(job.m_fd, job.m_data, job.m_bytes, job.m_offset);
+                    lock.lock();
+                    if (error && !*job.m_error)
+                        *job.m_error = error;
+                    *job.m_busy = false;
+                    m_finished.notify_all();
+                }
+            }
+
+        public:
+            io_thread() :
+                m_mutex{},
+                m_queued{},
+                m_finished{},
+                m_jobs{},
+                m_stop{ false },
+                m_thread{ [this] { run(); } }
+            {}
+
+            ~io_thread()
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ m_mutex };
+                    m_stop = true;
+                }
+                m_queued.notify_all();
+                m_thread.join();
+            }
+
+            void submit(const write_job& job)
+            {
+                {
+                    std::lock_guard<std::mutex> lock{ m_mutex };
+                    *job.m_busy = true;
+                    m_jobs.push_back(job);
+                }
+                m_queued.notify_one();
+            }
+
+            void wait(const bool& busy)
+            {
+                std::unique_lock<std::mutex> lock{ m_mutex };
+                m_finished.wait(lock, [&] { return !busy; });
+            }
+        };
+
+        io_thread& io()
+        {
+            static io_thread thread{};
+            return thread;
+        }
+    }
+
+    struct async_file_writer::buffer
+    {
+        char* m_data;
+        uint64_t m_used;
+        bool m_busy;
+        int m_error;
+
+        buffer() :
+            m_data{ static_cast<char*>(std::aligned_alloc(SF_WRITE_ALIGN, SF_WRITE_BUFFER_BYTES)) },
+            m_used{ 0 },
+            m_busy{ false },
+            m_error{ 0 }
+        {
+            if (!m_data) throw std::bad_alloc();
+        }
+
+        ~buffer()
+        {
+            std::free(m_data);
+        }
+    };
+
+    async_file_writer::async_file_writer(const std::string& name) :
+        m_name{ name },
+        m_fd{ -1 },
+        m_position{ 0 },
+        m_buffers{ std::make_unique<buffer>(), std::make_unique<buffer>() },
+        m_filling{ nullptr }
+    {
+        SF_MARK_STACK;
+        m_fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+            SF_THROW(std::logic_error{ "could not open " + name + " for writing: " + strerror(errno) });
+        m_filling = m_buffers[0].get();
+    }
+
+    async_file_writer::~async_file_writer()
+    {
+        if (m_fd < 0) return;
+        try
+        {
+            close();
+        }
+        catch (...)
+        {
+            // Already reported; nothing more can be done from a destructor.
+        }
+    }
+
+    void async_file_writer::wait_for(buffer& which)
+    {
+        SF_MARK_STACK;
+        io().wait(which.m_busy);
+        if (which.m_error)
+            SF_THROW(std::logic_error{ "writing " + m_name + " failed: " + strerror(which.m_error) });
+    }
+
+    // Send the filling buffer to the I/O thread and carry on in the other one.
+    void async_file_writer::submit()
+    {
+        auto& full = *m_filling;
+        if (full.m_used)
+            io().submit({ m_fd, full.m_data, full.m_used, m_position - full.m_used, &full.m_busy, &full.m_error });
+        m_filling = m_filling == m_buffers[0].get() ? m_buffers[1].get() : m_buffers[0].get();
+        wait_for(*m_filling);
+        m_filling->m_used = 0;
+    }
+
+    void async_file_writer::write(const void* data, uint64_t bytes)
+    {
+        auto from = static_cast<const char*>(data);
+        while (bytes)
+        {
+            auto& fill = *m_filling;
+            auto take = std::min(bytes, SF_WRITE_BUFFER_BYTES - fill.m_used);
+            memcpy(fill.m_data + fill.m_used, from, take);
+            fill.m_used += take;
+            m_position += take;
+            from += take;
+            bytes -= take;
+            if (fill.m_used == SF_WRITE_BUFFER_BYTES)
+                submit();
+        }
+    }
+
+    void async_file_writer::write_at(uint64_t offset, const void* data, uint64_t bytes)
+    {
+        SF_MARK_STACK;
+        submit();
+        wait_for(*m_buffers[0]);
+        wait_for(*m_buffers[1]);
+        if (auto error = write_fully(m_fd, static_cast<const char*>(data), bytes, offset))
+            SF_THROW(std::logic_error{ "writing " + m_name + " failed: " + strerror(error) });
+    }
+
+    void async_file_writer::close()
+    {
+        SF_MARK_STACK;
+        if (m_fd < 0) return;
+        auto fd = m_fd;
+        m_fd = -1;
+        // Everything in flight has to finish before the descriptor goes, even on error.
+        io().wait(m_buffers[0]->m_busy);
+        io().wait(m_buffers[1]->m_busy);
+        auto error = m_buffers[0]->m_error ? m_buffers[0]->m_error : m_buffers[1]->m_error;
+        auto& last = *m_filling;
+        if (!error && last.m_used)
+            error = write_fully(fd, last.m_data, last.m_used, m_position - last.m_used);
+        last.m_used = 0;
+        if (::close(fd) && !error)
+            error = errno;
+        if (error)
+            SF_THROW(std::logic_error{ "writing " + m_name + " failed: " + strerror(error) });
+    }
+
+    mapped_file::~mapped_file()
+    {
+        if (m_size)
+            munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    std::shared_ptr<const mapped_file> map_file(const std::string& name)
+    {
+        SF_MARK_STACK;
+        auto fd = open(name.c_str(), O_RDONLY);
+        if (fd < 0)
+            SF_THROW(std::out_of_range{ "could not open file " + name + ": " + strerror(errno) });
+        struct stat info {};
+        if (fstat(fd, &info))
+        {
+            close(fd);
+            SF_THROW(std::out_of_range{ "could not stat file " + name + ": " + strerror(errno) });
+        }
+        auto key = name + ":" + std::to_string(info.st_dev) + ":" + std::to_string(info.st_ino) + ":" +
+            std::to_string(info.st_size) + ":" + std::to_string(info.st_mtim.tv_sec) + "." +
+            std::to_string(info.st_mtim.tv_nsec);
+
+        std::lock_guard<std::mutex> lock{ SF_MAPPINGS_MUTEX };
+        auto found = SF_MAPPINGS.find(key);
+        if (found != SF_MAPPINGS.end())
+        {
+            if (auto shared = found->second.lock())
+            {
+                close(fd);
+                return shared;
+            }
+        }
+        // Stale entries are only ever left behind by files which have since been rewritten.
+        for (auto it = SF_MAPPINGS.begin(); it != SF_MAPPINGS.end();)
+        {
+            if (it->second.expired())
+                it = SF_MAPPINGS.erase(it);
+            else
+                ++it;
+        }
+
+        uint64_t size = info.st_size;
+        const char* data = nullptr;
+        if (size)
+        {
+            auto mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                close(fd);
+                SF_THROW(std::runtime_error{ "could not map file " + name + ": " + strerror(errno) });
+            }
+            // Readers go front to back so ask for aggressive read ahead; sequential read ahead then
+            // keeps going from the first window. Both are hints only.
+            madvise(mapped, size, MADV_SEQUENTIAL);
+            madvise(mapped, std::min(size, SF_READ_AHEAD_BYTES), MADV_WILLNEED);
+            data = static_cast<const char*>(mapped);
+        }
+        close(fd);
+        std::shared_ptr<const mapped_file> ret{ new mapped_file{ data, size } };
+        SF_MAPPINGS[key] = ret;
+        return ret;
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// File access for the signal readers and writers.
+namespace sonic_field
+{
+    // A whole file mapped read only. Readers of the same unchanged file at the same time share one
+    // mapping, and so one set of page cache pages and read ahead, rather than each doing their own
+    // reads; the mapping goes when the last of them lets go.
+    class mapped_file
+    {
+        const char* m_data;
+        uint64_t m_size;
+
+    public:
+        mapped_file(const char* data, uint64_t size) : m_data{ data }, m_size{ size } {}
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file();
+
+        const char* data() const
+        {
+            return m_data;
+        }
+
+        uint64_t size() const
+        {
+            return m_size;
+        }
+    };
+
+    // Appends to a file through large buffers written out by a background I/O thread. There are
+    // two buffers so the caller fills one while the other is on its way to disk, and only waits if
+    // it gets a whole buffer ahead of the disk.
+    class async_file_writer
+    {
+        struct buffer;
+        const std::string m_name;
+        int m_fd;
+        uint64_t m_position;
+        std::unique_ptr<buffer> m_buffers[2];
+        buffer* m_filling;
+
+        void submit();
+        void wait_for(buffer&);
+
+    public:
+        explicit async_file_writer(const std::string& name);
+        async_file_writer(const async_file_writer&) = delete;
+        async_file_writer& operator=(const async_file_writer&) = delete;
+        ~async_file_writer();
+
+        void write(const void* data, uint64_t bytes);
+        // Overwrite bytes already written (e.g. a header); everything buffered goes out first.
+        void write_at(uint64_t offset, const void* data, uint64_t bytes);
+        // Bytes appended so far.
+        uint64_t position() const
+        {
+            return m_position;
+        }
+        // Write out everything and close the file, throwing if any write failed.
+        void close();
+    };
+
+    // Map a file for reading from start to end. A file rewritten since it was last mapped (different
+    // inode, size or modification time) gets a new mapping.
+    std::shared_ptr<const mapped_file> map_file(const std::string& name);
+}
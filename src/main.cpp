@@ -23,6 +23,12 @@ int main(int argc, char** argv)
         {"--generate-named", true},
         {"--work-space", true},
         {"--output-space", true},
+        {"--threads", true},
+        {"--cache-mb", true},
+        {"--render-cache", true},
+        {"--sample-rate", true},
+        {"--preview", false},
+        {"--rbj-look-ahead", false},
         {"--verbose", false},
         {"--help", false}
     };
@@ -98,6 +104,42 @@ int main(int argc, char** argv)
         sonic_field::set_work_space(options["--work-space"]);
         sonic_field::set_output_space(options["--output-space"]);
 
+        // Render at this rate rather than 128 kHz, e.g. 32000 for quick drafts.
+        if (in("--sample-rate"))
+        {
+            sonic_field::set_sample_rate(std::stoull(options["--sample-rate"]));
+        }
+
+        // Render a quick draft instead; this sets the rate so --sample-rate is ignored.
+        if (in("--preview"))
+        {
+            sonic_field::set_preview(true);
+        }
+
+        // Faster rbj filters which differ from earlier renders by rounding.
+        if (in("--rbj-look-ahead"))
+        {
+            sonic_field::set_rbj_look_ahead(true);
+        }
+
+        // Render independent branches of the graph on this many threads.
+        if (in("--threads"))
+        {
+            sonic_field::set_render_threads(std::stoull(options["--threads"]));
+        }
+
+        // Keep written signals in memory, up to this many megabytes, instead of going to disk.
+        if (in("--cache-mb"))
+        {
+            sonic_field::set_signal_cache_bytes(std::stoull(options["--cache-mb"]) * 1024 * 1024);
+        }
+
+        // Reuse signals rendered by earlier runs from unchanged parts of the graph.
+        if (in("--render-cache"))
+        {
+            sonic_field::set_render_cache(options["--render-cache"]);
+        }
+
         // Do verbose (in memory tracking)
         if (in("--verbose"))
         {
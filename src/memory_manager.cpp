@@ -1,9 +1,16 @@
 #include "memory_manager.h"
+#include <sys/mman.h>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 
-thread_local std::unordered_map<void*, std::pair<std::size_t, std::string> > SF_MEMORY_TRACKER{};
+#ifdef SF_RELEASE
+constinit thread_local SF_STACK_RING SF_V_RING{};
+#else
 thread_local std::vector<const char*> SF_V_STACK{};
+#endif
 thread_local uint64_t SF_IN_SF_MEMORY_TRACKER = 0;
-thread_local bool SF_TRACK_MEMORY = false;
+std::atomic<bool> SF_TRACK_MEMORY{ false };
 
 SF_TRACK_SUPPR::SF_TRACK_SUPPR()
 {
@@ -15,6 +22,7 @@ SF_TRACK_SUPPR::~SF_TRACK_SUPPR()
     --SF_IN_SF_MEMORY_TRACKER;
 }
 
+#ifndef SF_RELEASE
 SF_STACK_ENTRY::SF_STACK_ENTRY(const char* msg)
 {
     ++SF_IN_SF_MEMORY_TRACKER;
@@ -27,49 +35,226 @@ SF_STACK_ENTRY::~SF_STACK_ENTRY()
     SF_NO_TRACK;
     SF_V_STACK.pop_back();
 }
+#endif
 
-void DUMP_STACK(const char* exp, const char* what)
+// Calls back with each recorded stack frame, innermost first.
+template<typename L>
+static void for_each_frame(const L& each)
 {
+#ifdef SF_RELEASE
+    auto depth = SF_V_RING.m_depth;
+    auto kept = std::min(depth, SF_STACK_RING_SIZE);
+    for (uint64_t idx{ 0 }; idx < kept; ++idx)
+        each(SF_V_RING.m_frames[(depth - 1 - idx) % SF_STACK_RING_SIZE]);
+    if (depth > kept)
+        each("(outer frames are not kept in release builds)");
+#else
     auto idx = SF_V_STACK.size();
-    std::cerr << "Error encountered: " << exp << "{" << what << "}\n";
     while (idx > 0)
     {
         --idx;
-        std::cerr << "... " << SF_V_STACK[idx] << '\n';
+        each(SF_V_STACK[idx]);
     }
+#endif
+}
+
+std::vector<const char*> SF_STACK_FRAMES()
+{
+    SF_NO_TRACK;
+    std::vector<const char*> frames{};
+    for_each_frame([&](const char* frame) { frames.push_back(frame); });
+    std::reverse(frames.begin(), frames.end());
+    return frames;
+}
+
+SF_STACK_ADOPT::SF_STACK_ADOPT(const std::vector<const char*>& frames) :
+    m_count{ frames.size() }
+{
+#ifdef SF_RELEASE
+    for (auto frame : frames)
+        SF_V_RING.m_frames[SF_V_RING.m_depth++ % SF_STACK_RING_SIZE] = frame;
+#else
+    SF_NO_TRACK;
+    SF_V_STACK.insert(SF_V_STACK.end(), frames.begin(), frames.end());
+#endif
+}
+
+SF_STACK_ADOPT::~SF_STACK_ADOPT()
+{
+#ifdef SF_RELEASE
+    SF_V_RING.m_depth -= m_count;
+#else
+    SF_NO_TRACK;
+    SF_V_STACK.resize(SF_V_STACK.size() - m_count);
+#endif
+}
+
+void DUMP_STACK(const char* exp, const char* what)
+{
+    std::cerr << "Error encountered: " << exp << "{" << what << "}\n";
+    for_each_frame([](const char* frame) { std::cerr << "... " << frame << '\n'; });
     std::cerr.flush();
 }
 
+// Allocation tracking samples rather than recording every allocation: roughly one allocation per
+// SF_SAMPLE_BYTES allocated is recorded, against an interned call stack, in fixed lock free tables.
+// Each sample stands for SF_SAMPLE_BYTES (or its own size if larger) so live bytes per call site
+// come out about right while the cost is a subtraction per allocation and a probe per free. The
+// tables are shared rather than kept per thread because blocks and signals are often freed on a
+// different thread to the one which allocated them; claiming a slot is a single compare exchange.
+constexpr int64_t  SF_SAMPLE_BYTES = 64 * 1024;
+constexpr uint64_t SF_SAMPLE_SLOTS = 1 << 16;
+constexpr uint64_t SF_SAMPLE_PROBES = 64;
+constexpr uint64_t SF_SITE_SLOTS = 1 << 12;
+constexpr uint64_t SF_SITE_FRAMES = 16;
+// What intern_site gives once the site table is full; no slot has it.
+constexpr uint32_t SF_SITE_UNKNOWN = SF_SITE_SLOTS;
+
+// m_info is the bytes the sample stands for above the site in the low SF_SITE_BITS, so both are
+// published together; zero until they are.
+constexpr uint64_t SF_SITE_BITS = 16;
+static_assert(SF_SITE_SLOTS < (uint64_t(1) << SF_SITE_BITS));
+
+struct SF_SAMPLE
+{
+    std::atomic<void*> m_ptr;
+    std::atomic<uint64_t> m_info;
+};
+
+struct SF_SITE
+{
+    std::atomic<uint64_t> m_hash;
+    std::atomic<bool> m_ready;
+    uint32_t m_depth;
+    const char* m_frames[SF_SITE_FRAMES];
+};
+
+// A slot whose sample has been freed; probing carries on past it.
+static void* const SF_SAMPLE_FREED = reinterpret_cast<void*>(1);
+static SF_SAMPLE SF_SAMPLES[SF_SAMPLE_SLOTS]{};
+static SF_SITE SF_SITES[SF_SITE_SLOTS]{};
+static std::atomic<uint64_t> SF_SAMPLES_LIVE{ 0 };
+static std::atomic<uint64_t> SF_SAMPLES_DROPPED{ 0 };
+thread_local int64_t SF_SAMPLE_COUNTDOWN = SF_SAMPLE_BYTES;
+
+static uint64_t sample_slot(const void* ptr)
+{
+    auto h = reinterpret_cast<uint64_t>(ptr) >> 4;
+    h *= 0x9E3779B97F4A7C15ull;
+    return h >> 48;
+}
+
+// Frames are string literals so a stack is identified by the addresses of its innermost frames.
+static uint32_t intern_site()
+{
+    const char* frames[SF_SITE_FRAMES];
+    uint32_t depth{ 0 };
+    uint64_t hash{ 1469598103934665603ull };
+    for_each_frame([&](const char* frame)
+    {
+        if (depth == SF_SITE_FRAMES) return;
+        frames[depth++] = frame;
+        hash ^= reinterpret_cast<uint64_t>(frame);
+        hash *= 1099511628211ull;
+    });
+    // Zero marks a free site slot.
+    hash |= 1;
+    for (uint64_t probe{ 0 }; probe < SF_SITE_SLOTS; ++probe)
+    {
+        auto idx = (hash + probe) % SF_SITE_SLOTS;
+        auto& site = SF_SITES[idx];
+        auto seen = site.m_hash.load(std::memory_order_acquire);
+        if (seen == hash) return uint32_t(idx);
+        if (seen == 0 && site.m_hash.compare_exchange_strong(seen, hash, std::memory_order_acq_rel))
+        {
+            site.m_depth = depth;
+            std::copy(frames, frames + depth, site.m_frames);
+            site.m_ready.store(true, std::memory_order_release);
+            return uint32_t(idx);
+        }
+        if (seen == hash) return uint32_t(idx);
+    }
+    return SF_SITE_UNKNOWN;
+}
+
+static void record_sample(void* ptr, std::size_t sz)
+{
+    auto site = intern_site();
+    if (site == SF_SITE_UNKNOWN)
+    {
+        // A sample which could not be put down to a site would only mislead.
+        SF_SAMPLES_DROPPED.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto start = sample_slot(ptr);
+    for (uint64_t probe{ 0 }; probe < SF_SAMPLE_PROBES; ++probe)
+    {
+        auto& slot = SF_SAMPLES[(start + probe) % SF_SAMPLE_SLOTS];
+        auto seen = slot.m_ptr.load(std::memory_order_relaxed);
+        if (seen != nullptr && seen != SF_SAMPLE_FREED) continue;
+        // Nothing can free ptr until it has been returned, so the slot is ours once claimed.
+        if (slot.m_ptr.compare_exchange_strong(seen, ptr, std::memory_order_acq_rel))
+        {
+            auto bytes = std::max(uint64_t(sz), uint64_t(SF_SAMPLE_BYTES));
+            slot.m_info.store((bytes << SF_SITE_BITS) | site, std::memory_order_release);
+            SF_SAMPLES_LIVE.fetch_add(1, std::memory_order_release);
+            return;
+        }
+    }
+    SF_SAMPLES_DROPPED.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void forget_sample(void* ptr)
+{
+    auto start = sample_slot(ptr);
+    for (uint64_t probe{ 0 }; probe < SF_SAMPLE_PROBES; ++probe)
+    {
+        auto& slot = SF_SAMPLES[(start + probe) % SF_SAMPLE_SLOTS];
+        auto seen = slot.m_ptr.load(std::memory_order_relaxed);
+        if (seen == nullptr) return;
+        if (seen != ptr) continue;
+        // Cleared first so whoever claims the slot next never shows this sample's site.
+        slot.m_info.store(0, std::memory_order_relaxed);
+        if (slot.m_ptr.compare_exchange_strong(seen, SF_SAMPLE_FREED, std::memory_order_release))
+        {
+            SF_SAMPLES_LIVE.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
 void SF_TRACK_MEMORY_ON()
 {
-    SF_MEMORY_TRACKER.clear();
-    SF_TRACK_MEMORY = true;
+    SF_TRACK_MEMORY_OFF();
+    SF_TRACK_MEMORY.store(true, std::memory_order_relaxed);
 }
 
 void SF_TRACK_MEMORY_OFF()
 {
-    SF_TRACK_MEMORY = false;
-    SF_MEMORY_TRACKER.clear();
+    SF_TRACK_MEMORY.store(false, std::memory_order_relaxed);
+    for (auto& slot : SF_SAMPLES)
+    {
+        slot.m_ptr.store(nullptr, std::memory_order_relaxed);
+        slot.m_info.store(0, std::memory_order_relaxed);
+    }
+    SF_SAMPLES_LIVE.store(0);
+    SF_SAMPLES_DROPPED.store(0);
 }
 
 inline void* _do_new(std::size_t sz)
 {
     auto ret = std::malloc(sz);
     if (!ret) throw std::bad_alloc();
-    if (SF_TRACK_MEMORY && !SF_IN_SF_MEMORY_TRACKER)
+    if (SF_TRACK_MEMORY.load(std::memory_order_relaxed) && !SF_IN_SF_MEMORY_TRACKER)
     {
-        SF_NO_TRACK;
-        std::string stack{};
-        auto idx = SF_V_STACK.size();
-        while(idx > 0)
+        SF_SAMPLE_COUNTDOWN -= int64_t(sz);
+        if (SF_SAMPLE_COUNTDOWN <= 0)
         {
-            --idx;
-            if (stack.size())
-                stack += "\n";
-            stack += "...";
-            stack += SF_V_STACK[idx];
+            SF_SAMPLE_COUNTDOWN += SF_SAMPLE_BYTES;
+            if (SF_SAMPLE_COUNTDOWN <= 0)
+                SF_SAMPLE_COUNTDOWN = SF_SAMPLE_BYTES;
+            record_sample(ret, sz);
         }
-        SF_MEMORY_TRACKER.insert({ ret, {sz, stack } });
     }
     return ret;
 }
@@ -86,11 +271,8 @@ void* operator new[](std::size_t sz)
 
 inline void _do_delete(void* ptr) noexcept
 {
-    if (SF_TRACK_MEMORY && !SF_IN_SF_MEMORY_TRACKER)
-    {
-        SF_NO_TRACK;
-        SF_MEMORY_TRACKER.erase(ptr);
-    }
+    if (ptr && SF_SAMPLES_LIVE.load(std::memory_order_relaxed))
+        forget_sample(ptr);
     std::free(ptr);
 }
 
@@ -104,30 +286,312 @@ void operator delete[](void* ptr) noexcept
     _do_delete(ptr);
 }
 
+// The sized forms too, or the library's would free what ours allocated.
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    _do_delete(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept
+{
+    _do_delete(ptr);
+}
+
+// Live sampled bytes grouped by call site, largest first.
 void SF_PRINT_TRACKED_MEMORY()
 {
-    for (const auto& kvp : SF_MEMORY_TRACKER)
+    SF_NO_TRACK;
+    std::unordered_map<uint32_t, std::pair<uint64_t, uint64_t>> sites{};
+    for (auto& slot : SF_SAMPLES)
     {
-        std::cerr << "LEAK: " << kvp.first << " of: " << kvp.second.first << "\n"
-            << kvp.second.second << std::endl;
+        auto ptr = slot.m_ptr.load(std::memory_order_acquire);
+        if (ptr == nullptr || ptr == SF_SAMPLE_FREED) continue;
+        // Claimed but not yet filled in.
+        auto info = slot.m_info.load(std::memory_order_acquire);
+        if (!info) continue;
+        auto& site = sites[uint32_t(info & ((uint64_t(1) << SF_SITE_BITS) - 1))];
+        site.first += info >> SF_SITE_BITS;
+        ++site.second;
+    }
+    std::vector<std::pair<uint32_t, std::pair<uint64_t, uint64_t>>> ordered{ sites.begin(), sites.end() };
+    std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b)
+    {
+        return a.second.first > b.second.first;
+    });
+    for (const auto& entry : ordered)
+    {
+        const auto& site = SF_SITES[entry.first];
+        std::cerr << "LEAK: about " << entry.second.first << " bytes from " << entry.second.second
+            << " sampled allocations\n";
+        if (site.m_ready.load(std::memory_order_acquire))
+        {
+            for (uint32_t idx{ 0 }; idx < site.m_depth; ++idx)
+                std::cerr << "..." << site.m_frames[idx] << "\n";
+        }
+        std::cerr.flush();
     }
+    if (auto dropped = SF_SAMPLES_DROPPED.load())
+        std::cerr << "Memory tracking dropped " << dropped << " samples" << std::endl;
 }
 
 namespace sonic_field
 {
-    thread_local std::vector<std::unique_ptr<double>> SF_BLOCK_POOL;
-    double* new_block(bool init)
+    // Blocks move between threads in magazines: each thread caches two of them and swaps
+    // whole magazines with a global depot, so only the depot exchange touches shared state.
+    constexpr uint64_t SF_MAGAZINE_SIZE = 64;
+
+    struct alignas(SF_BLOCK_ALIGN) block_magazine
+    {
+        std::atomic<block_magazine*> m_next;
+        uint64_t m_count;
+        double* m_blocks[SF_MAGAZINE_SIZE];
+    };
+
+    // Treiber stack of magazines. Magazines are never freed so a stale m_next read is harmless;
+    // the top 16 bits of the head carry a tag to defeat ABA.
+    class magazine_stack
+    {
+        static constexpr uint64_t PTR_MASK = (uint64_t(1) << 48) - 1;
+        static constexpr uint64_t TAG_ONE  = uint64_t(1) << 48;
+        std::atomic<uint64_t> m_head{0};
+
+        static block_magazine* to_ptr(uint64_t head)
+        {
+            return reinterpret_cast<block_magazine*>(head & PTR_MASK);
+        }
+
+    public:
+        void push(block_magazine* mag)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            uint64_t next;
+            do
+            {
+                mag->m_next.store(to_ptr(head), std::memory_order_relaxed);
+                next = (uintptr_t(mag) & PTR_MASK) | ((head & ~PTR_MASK) + TAG_ONE);
+            }
+            while (!m_head.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+        }
+
+        block_magazine* pop()
+        {
+            auto head = m_head.load(std::memory_order_acquire);
+            while (auto mag = to_ptr(head))
+            {
+                auto next = (uintptr_t(mag->m_next.load(std::memory_order_relaxed)) & PTR_MASK) |
+                    ((head & ~PTR_MASK) + TAG_ONE);
+                if (m_head.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire))
+                    return mag;
+            }
+            return nullptr;
+        }
+    };
+
+    // Each slab starts with a table of per block metadata, found by masking a block's address
+    // down to its slab; this is why slabs are aligned to their own size.
+    struct block_meta
+    {
+        std::atomic<uint32_t> m_refs;
+        uint32_t m_flags;
+        double m_value;
+    };
+
+    constexpr uint32_t SF_BLOCK_CONSTANT = 1;
+
+    constexpr uint64_t SF_BLOCK_BYTES = sizeof(double) * BLOCK_SIZE;
+    constexpr uint64_t SF_SLAB_HEADER_BLOCKS =
+        (SF_BLOCKS_PER_SLAB * sizeof(block_meta) + SF_BLOCK_BYTES - 1) / SF_BLOCK_BYTES;
+
+    inline block_meta& meta_of(const double* block)
+    {
+        auto addr = uintptr_t(block);
+        auto slab = addr & ~(SF_SLAB_SIZE - 1);
+        return reinterpret_cast<block_meta*>(slab)[(addr - slab) / SF_BLOCK_BYTES];
+    }
+
+    // The depot; full holds any magazine with blocks in it, empty holds drained ones.
+    magazine_stack SF_FULL_MAGAZINES{};
+    magazine_stack SF_EMPTY_MAGAZINES{};
+
+    // Slabs are only ever touched on the cold path (mapping a new slab).
+    std::mutex SF_SLAB_MUTEX{};
+    std::vector<void*> SF_SLABS{};
+    std::atomic<uint64_t> SF_SLABS_MAPPED{0};
+    std::atomic<int64_t> SF_BLOCKS_LIVE{0};
+
+    // Map one slab aligned to its own size so it can be backed by a single huge page.
+    void* map_slab()
+    {
+        void* slab = MAP_FAILED;
+#ifdef SF_HUGETLB
+        // Explicit huge pages need to have been reserved by the system; fall back if not.
+        slab = mmap(nullptr, SF_SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (slab == MAP_FAILED)
+        {
+            // Over map and then trim both ends to get the alignment.
+            auto raw = mmap(nullptr, SF_SLAB_SIZE * 2, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (raw == MAP_FAILED)
+            {
+                SF_THROW(std::runtime_error{std::string{"Could not map block slab: "} + strerror(errno)});
+            }
+            auto base = uintptr_t(raw);
+            auto aligned = (base + SF_SLAB_SIZE - 1) & ~(SF_SLAB_SIZE - 1);
+            if (aligned > base)
+                munmap(raw, aligned - base);
+            auto tail = base + SF_SLAB_SIZE * 2 - (aligned + SF_SLAB_SIZE);
+            if (tail)
+                munmap(reinterpret_cast<void*>(aligned + SF_SLAB_SIZE), tail);
+            slab = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+            // Transparent huge pages are a hint only, so failure is fine.
+            madvise(slab, SF_SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+        }
+        return slab;
+    }
+
+    block_magazine* new_magazine()
+    {
+        SF_NO_TRACK;
+        auto mag = new block_magazine{};
+        mag->m_count = 0;
+        return mag;
+    }
+
+    block_magazine* empty_magazine()
+    {
+        auto mag = SF_EMPTY_MAGAZINES.pop();
+        return mag ? mag : new_magazine();
+    }
+
+    // Map a new slab, returning one full magazine and putting the rest in the depot.
+    block_magazine* magazines_from_slab()
     {
-        double* block;
-        if (SF_BLOCK_POOL.size())
+        void* slab;
         {
-            block = SF_BLOCK_POOL.back().release();
-            SF_BLOCK_POOL.pop_back();
+            std::lock_guard<std::mutex> lck{SF_SLAB_MUTEX};
+            if ((SF_SLABS.size() + 1) * SF_BLOCKS_PER_SLAB > SF_BLOCK_POOL_MAX)
+            {
+                SF_THROW(std::logic_error{"Working memory exhausted@ " + std::to_string(SF_BLOCK_POOL_MAX) + " blocks"});
+            }
+            slab = map_slab();
+            {
+                SF_NO_TRACK;
+                SF_SLABS.push_back(slab);
+            }
+            ++SF_SLABS_MAPPED;
         }
-        else
+        auto blocks = reinterpret_cast<double*>(slab);
+        block_magazine* ret = nullptr;
+        for (uint64_t first{ SF_SLAB_HEADER_BLOCKS }; first < SF_BLOCKS_PER_SLAB; first += SF_MAGAZINE_SIZE)
+        {
+            auto mag = empty_magazine();
+            auto last = std::min(first + SF_MAGAZINE_SIZE, SF_BLOCKS_PER_SLAB);
+            // Fill in reverse so blocks are handed out in address order.
+            for (uint64_t idx{ last }; idx > first; --idx)
+            {
+                mag->m_blocks[mag->m_count++] = blocks + (idx - 1) * BLOCK_SIZE;
+            }
+            if (ret)
+                SF_FULL_MAGAZINES.push(mag);
+            else
+                ret = mag;
+        }
+        return ret;
+    }
+
+    struct magazine_cache
+    {
+        block_magazine* m_loaded;
+        block_magazine* m_previous;
+        // Live block changes are batched up and published on depot exchanges.
+        int64_t m_live_delta;
+
+        magazine_cache(): m_loaded{ nullptr }, m_previous{ nullptr }, m_live_delta{ 0 } {}
+
+        void publish()
+        {
+            SF_BLOCKS_LIVE.fetch_add(m_live_delta, std::memory_order_relaxed);
+            m_live_delta = 0;
+        }
+
+        void give_back(block_magazine*& mag)
+        {
+            if (!mag) return;
+            if (mag->m_count)
+                SF_FULL_MAGAZINES.push(mag);
+            else
+                SF_EMPTY_MAGAZINES.push(mag);
+            mag = nullptr;
+        }
+
+        // Hand both magazines to the depot so blocks are not stranded on an exiting thread.
+        void flush()
+        {
+            give_back(m_loaded);
+            give_back(m_previous);
+            publish();
+        }
+
+        double* pop()
         {
-            block = new double[BLOCK_SIZE];
+            if (!m_loaded || !m_loaded->m_count)
+            {
+                if (m_previous && m_previous->m_count)
+                {
+                    std::swap(m_loaded, m_previous);
+                }
+                else
+                {
+                    auto full = SF_FULL_MAGAZINES.pop();
+                    if (!full)
+                        full = magazines_from_slab();
+                    give_back(m_loaded);
+                    m_loaded = full;
+                    publish();
+                }
+            }
+            ++m_live_delta;
+            return m_loaded->m_blocks[--m_loaded->m_count];
         }
+
+        void push(double* block)
+        {
+            if (!m_loaded || m_loaded->m_count == SF_MAGAZINE_SIZE)
+            {
+                if (m_previous && m_previous->m_count < SF_MAGAZINE_SIZE)
+                {
+                    std::swap(m_loaded, m_previous);
+                }
+                else
+                {
+                    give_back(m_previous);
+                    m_previous = m_loaded;
+                    m_loaded = empty_magazine();
+                    publish();
+                }
+            }
+            --m_live_delta;
+            m_loaded->m_blocks[m_loaded->m_count++] = block;
+        }
+
+        ~magazine_cache()
+        {
+            flush();
+        }
+    };
+
+    thread_local magazine_cache SF_BLOCK_CACHE{};
+
+    double* new_block(bool init)
+    {
+        double* block = SF_BLOCK_CACHE.pop();
+        auto& meta = meta_of(block);
+        meta.m_refs.store(1, std::memory_order_relaxed);
+        meta.m_flags = 0;
         if (init)
             memset(block, 0, sizeof(double) * BLOCK_SIZE);
         return block;
@@ -143,15 +607,92 @@ namespace sonic_field
         {
             SF_THROW(std::logic_error{"Trying to free a empty block"});
         }
-        SF_BLOCK_POOL.emplace_back(std::unique_ptr<double>{block});
-        if (SF_BLOCK_POOL.size() > SF_BLOCK_POOL_MAX)
+        // Only the last reference returns the block to the pool.
+        if (meta_of(block).m_refs.fetch_sub(1, std::memory_order_acq_rel) > 1)
+            return;
+        SF_BLOCK_CACHE.push(block);
+    }
+
+    double* share_block(double* block)
+    {
+        if (block && block != empty_block())
+            meta_of(block).m_refs.fetch_add(1, std::memory_order_relaxed);
+        return block;
+    }
+
+    double* writable_block(double* block)
+    {
+        if (!block || block == empty_block())
+            return block;
+        auto& meta = meta_of(block);
+        if (meta.m_refs.load(std::memory_order_acquire) == 1)
         {
-            SF_THROW(std::logic_error{"Working memory exhausted@ " + std::to_string(SF_BLOCK_POOL_MAX) + " blocks"});
+            // The caller is about to write so it can no longer be trusted to be constant.
+            meta.m_flags = 0;
+            return block;
         }
+        auto ret = new_block(false);
+        memcpy(ret, block, SF_BLOCK_BYTES);
+        free_block(block);
+        return ret;
+    }
+
+    double* new_constant_block(double value)
+    {
+        return fill_constant_block(new_block(false), value);
+    }
+
+    double* fill_constant_block(double* block, double value)
+    {
+        std::fill_n(block, BLOCK_SIZE, value);
+        auto& meta = meta_of(block);
+        meta.m_flags |= SF_BLOCK_CONSTANT;
+        meta.m_value = value;
+        return block;
+    }
+
+    bool is_constant_block(const double* block, double& value)
+    {
+        if (block == empty_block())
+        {
+            value = 0;
+            return true;
+        }
+        if (!block)
+            return false;
+        const auto& meta = meta_of(block);
+        if (!(meta.m_flags & SF_BLOCK_CONSTANT))
+            return false;
+        value = meta.m_value;
+        return true;
     }
 
     void clear_block_pool()
     {
-        SF_BLOCK_POOL.clear();
+        SF_BLOCK_CACHE.flush();
+    }
+
+    block_pool_stats block_pool_statistics()
+    {
+        auto live = SF_BLOCKS_LIVE.load(std::memory_order_relaxed) + SF_BLOCK_CACHE.m_live_delta;
+        return { SF_SLABS_MAPPED.load(), uint64_t(live < 0 ? 0 : live) };
+    }
+
+    render_context SF_RENDER_CONTEXT{ SAMPLES_PER_SECOND, BLOCK_SIZE, SAMPLES_PER_SECOND >> 1, WIRE_BLOCK_SIZE, false };
+
+    void set_sample_rate(uint64_t rate)
+    {
+        SF_MARK_STACK;
+        if (std::find(std::begin(SF_SAMPLE_RATES), std::end(SF_SAMPLE_RATES), rate) == std::end(SF_SAMPLE_RATES))
+            SF_THROW(std::invalid_argument{ "Unsupported sample rate: " + std::to_string(rate) });
+        auto wire = rate > 64000 ? rate >> 1 : rate;
+        SF_RENDER_CONTEXT = { rate, rate / 1000, wire, wire / 1000, SF_RENDER_CONTEXT.m_preview };
+    }
+
+    void set_preview(bool on)
+    {
+        SF_MARK_STACK;
+        set_sample_rate(on ? SF_SAMPLE_RATES[0] : SAMPLES_PER_SECOND);
+        SF_RENDER_CONTEXT.m_preview = on;
     }
 }
@@ -14,17 +14,58 @@
 #include <tuple>
 #include <memory>
 #include <typeinfo>
+#include <type_traits>
 
 void DUMP_STACK(const char*, const char*);
 void SF_PRINT_TRACKED_MEMORY();
 void SF_TRACK_MEMORY_ON();
 void SF_TRACK_MEMORY_OFF();
 
+#ifdef SF_RELEASE
+// Release builds keep only the innermost frames in a fixed ring, so marking the stack on every
+// next() is a store and an increment with nothing to allocate or free. The frames nearest an
+// error are the ones kept, which is what DUMP_STACK needs.
+constexpr uint64_t SF_STACK_RING_SIZE = 64;
+
+struct SF_STACK_RING
+{
+    const char* m_frames[SF_STACK_RING_SIZE];
+    uint64_t m_depth;
+};
+
+extern constinit thread_local SF_STACK_RING SF_V_RING;
+
+struct SF_STACK_ENTRY
+{
+    explicit SF_STACK_ENTRY(const char* msg)
+    {
+        SF_V_RING.m_frames[SF_V_RING.m_depth++ % SF_STACK_RING_SIZE] = msg;
+    }
+
+    ~SF_STACK_ENTRY()
+    {
+        --SF_V_RING.m_depth;
+    }
+};
+#else
 struct SF_STACK_ENTRY
 {
     explicit SF_STACK_ENTRY(const char* msg);
     ~SF_STACK_ENTRY();
 };
+#endif
+
+// The frames on this thread's stack, outermost first.
+std::vector<const char*> SF_STACK_FRAMES();
+
+// Puts frames from another thread's stack on this one for as long as it lives, so work handed
+// between threads still shows where it came from.
+struct SF_STACK_ADOPT
+{
+    explicit SF_STACK_ADOPT(const std::vector<const char*>& frames);
+    ~SF_STACK_ADOPT();
+    uint64_t m_count;
+};
 
 struct SF_TRACK_SUPPR
 {
@@ -32,6 +73,22 @@ struct SF_TRACK_SUPPR
     ~SF_TRACK_SUPPR();
 };
 
+// Tracks allocations for as long as it lives and, when it goes, reports the bytes still live by
+// call site.
+struct SF_TRACK_MEMORY_SCOPE
+{
+    explicit SF_TRACK_MEMORY_SCOPE()
+    {
+        SF_TRACK_MEMORY_ON();
+    }
+
+    ~SF_TRACK_MEMORY_SCOPE()
+    {
+        SF_PRINT_TRACKED_MEMORY();
+        SF_TRACK_MEMORY_OFF();
+    }
+};
+
 #define _JOIN_1(_x, _y) _x##_y
 #define _JOIN_2(_p, _q) _JOIN_1(_p, _q)
 #define _STRINGY(_s) #_s
@@ -45,16 +102,122 @@ struct SF_TRACK_SUPPR
 // This are used in memory assignement etc. so we define them here which is 'above' the rest of sonic field.
 namespace sonic_field
 {
+    // The highest (and default) sample rate. Blocks hold a millisecond, so at this rate they are
+    // full and BLOCK_SIZE is how much storage each has; at lower rates only block_size() of it is
+    // used. WIRE_BLOCK_SIZE is likewise the most samples a block stores in a signal file.
     constexpr uint64_t SAMPLES_PER_SECOND = 128000;
     constexpr uint64_t BLOCK_SIZE = SAMPLES_PER_SECOND / 1000;
     constexpr uint64_t WIRE_BLOCK_SIZE = BLOCK_SIZE >> 1;
+    // Rates a render can run at; each must give a whole number of samples per block.
+    constexpr uint64_t SF_SAMPLE_RATES[]{ 32000, 48000, 64000, 96000, 128000 };
+
+    // What renders run at. Signal files are stored at the wire rate: half the sample rate above
+    // 64 kHz, where the top octave is only there to keep aliasing out of the audible band, and the
+    // sample rate itself at or below it.
+    struct render_context
+    {
+        uint64_t m_sample_rate;
+        uint64_t m_block_size;
+        uint64_t m_wire_rate;
+        uint64_t m_wire_block_size;
+        bool m_preview;
+    };
+    // Only read through the functions below; set with set_sample_rate and set_preview.
+    extern render_context SF_RENDER_CONTEXT;
+
+    // Must be one of SF_SAMPLE_RATES and must not be changed while any signal is alive, since
+    // blocks, files and caches all assume the rate they were made at.
+    void set_sample_rate(uint64_t rate);
+
+    // Preview renders trade quality for turnaround while a piece is being worked on: they run at
+    // the lowest supported rate, readers do no cleaning, reverberators use a cheaper tank, repeat()
+    // makes one pass of its chain and wav files are named as previews. The graph a piece builds is
+    // unchanged, so turning preview off (which goes back to the default rate) gives the full render.
+    // The same rules as set_sample_rate apply.
+    void set_preview(bool on);
+
+    inline bool preview()
+    {
+        return SF_RENDER_CONTEXT.m_preview;
+    }
+
+    inline uint64_t sample_rate()
+    {
+        return SF_RENDER_CONTEXT.m_sample_rate;
+    }
+
+    // Samples in a block: a millisecond's worth.
+    inline uint64_t block_size()
+    {
+        return SF_RENDER_CONTEXT.m_block_size;
+    }
+
+    inline uint64_t wire_rate()
+    {
+        return SF_RENDER_CONTEXT.m_wire_rate;
+    }
+
+    inline uint64_t wire_block_size()
+    {
+        return SF_RENDER_CONTEXT.m_wire_block_size;
+    }
+
+    // Calls kernel with the block size as a std::integral_constant, so a loop over a block can be
+    // compiled for each supported rate with a constant trip count the optimiser can unroll and
+    // vectorise. Use it for the hot per sample loops; elsewhere block_size() will do.
+    template<typename K>
+    inline decltype(auto) with_block_size(K&& kernel)
+    {
+        switch (block_size())
+        {
+        case 32:
+            return kernel(std::integral_constant<uint64_t, 32>{});
+        case 48:
+            return kernel(std::integral_constant<uint64_t, 48>{});
+        case 64:
+            return kernel(std::integral_constant<uint64_t, 64>{});
+        case 96:
+            return kernel(std::integral_constant<uint64_t, 96>{});
+        default:
+            return kernel(std::integral_constant<uint64_t, BLOCK_SIZE>{});
+        }
+    }
     // Set the working memory to 256 meg.
     constexpr uint64_t SF_BLOCK_POOL_MAX = (2048l * 1024l * 1024l) / (sizeof(double) * BLOCK_SIZE);
+    // Blocks are carved out of slabs; each slab is one (2 meg) huge page and every block starts
+    // on a cache line so it can be used with aligned SIMD loads.
+    constexpr uint64_t SF_BLOCK_ALIGN = 64;
+    constexpr uint64_t SF_SLAB_SIZE = 2l * 1024l * 1024l;
+    constexpr uint64_t SF_BLOCKS_PER_SLAB = SF_SLAB_SIZE / (sizeof(double) * BLOCK_SIZE);
+    static_assert((sizeof(double) * BLOCK_SIZE) % SF_BLOCK_ALIGN == 0, "Blocks must be cache line multiples");
+
+    struct block_pool_stats
+    {
+        uint64_t slabs_mapped;
+        uint64_t blocks_live;
+    };
+
     inline double* empty_block()
     {
         return (double*)-1;
     }
+    // Blocks may be freed on a different thread to the one which allocated them.
     double* new_block(bool init = true);
+    // Blocks are reference counted; free_block drops a reference and the last one returns the
+    // block to the pool.
     void free_block(double* block);
+    // Adds a reference so the same storage can be handed to more than one consumer.
+    double* share_block(double* block);
+    // Copy on write; returns the block itself if this is the only reference, otherwise a private
+    // copy (dropping the reference to the original).
+    double* writable_block(double* block);
+    // Constant blocks carry metadata saying every sample has the same value. The samples are
+    // still filled in so code which ignores the metadata sees the same thing. The empty block
+    // counts as constant zero. Writing via writable_block clears the metadata.
+    double* new_constant_block(double value);
+    double* fill_constant_block(double* block, double value);
+    bool is_constant_block(const double* block, double& value);
+    // Hands the calling thread's cached blocks back to the shared depot.
     void clear_block_pool();
+    block_pool_stats block_pool_statistics();
 }
@@ -1,7 +1,21 @@
 #include "library.h" 
+#include "../fused.h"
 
 namespace sonic_field
 {
+    // A peak filter per pitch, each repeated as repeat() would (which runs once for no repeats),
+    // amplified by the pitch's gain and mixed; all in one biquad_bank.
+    static std::vector<biquad_channel> bank_channels(
+        double width,
+        double resonance,
+        const std::vector<std::pair<double, double>>& pitches)
+    {
+        std::vector<biquad_channel> channels{};
+        for (auto pitch: pitches)
+            channels.push_back({ filter_type::PEAK, pitch.first, width, resonance, pitch.second });
+        return channels;
+    }
+
     signal filter_bank(
         signal input, 
         double width, 
@@ -12,20 +26,8 @@ namespace sonic_field
         SF_MARK_STACK;
         if (pitches.empty())
             SF_THROW(std::invalid_argument{"Pitch vector empty in filter_bank"});
-        auto sig_store = input
-            >> store();
-        auto output_mixer = mix(mixer_type::ADD);
-        for(auto pitch: pitches)
-        {
-            copy(sig_store)
-                >> repeat(repeats, { filter_rbj(filter_type::PEAK, pitch.first, width, resonance) })
-                >> amplify(pitch.second)
-                >> output_mixer;
-        }
-        // Drain the store;
-        sig_store
-            >> run();
-        return output_mixer;
+        return input
+            >> filter_rbj_bank(std::max<uint64_t>(repeats, 1), bank_channels(width, resonance, pitches));
     }
 
     signal filter_bank(
@@ -38,28 +40,21 @@ namespace sonic_field
         SF_MARK_STACK;
         if (pitches.empty())
             SF_THROW(std::invalid_argument{"Pitch vector empty in filter_bank"});
-        auto output_mixer = mix(mixer_type::ADD);
-        for(auto pitch: pitches)
-        {
-            read(input)
-                >> repeat(repeats, { filter_rbj(filter_type::PEAK, pitch.first, width, resonance) })
-                >> amplify(pitch.second)
-                >> output_mixer;
-        }
-        return output_mixer;
+        return read(input)
+            >> filter_rbj_bank(std::max<uint64_t>(repeats, 1), bank_channels(width, resonance, pitches));
     }
 
     signal generate_rich_base(uint64_t length, double pitch)
     {
         SF_MARK_STACK;
         return generate_noise(length)
-            >> seed(pitch * 2.0, 0.02, 0.25)
-            >> repeat(3, { filter_rbj(filter_type::PEAK, pitch, 0.1, 20) })
-            >> control_gain(0.1, 0.005)
-            >> filter_rbj(filter_type::LOWPASS, pitch, 2, 0.0)
-            >> distort_power(1.25)
-            >> distort_saturate(0.5)
-            >> control_gain(0.1, 0.005);
+            >> fuse(fused::seed(pitch * 2.0, 0.02, 0.25)
+                >> fused::repeat<3>(fused::rbj(filter_type::PEAK, pitch, 0.1, 20))
+                >> fused::gain(0.1, 0.005)
+                >> fused::rbj(filter_type::LOWPASS, pitch, 2, 0.0)
+                >> fused::power(1.25)
+                >> fused::saturate(0.5)
+                >> fused::gain(0.1, 0.005));
 
     }
 
@@ -67,12 +62,12 @@ namespace sonic_field
     {
         SF_MARK_STACK;
         return generate_noise(length)
-            >> seed(pitch, 0.01, 0.75)
-            >> repeat(2, { filter_rbj(filter_type::PEAK, pitch / 2.0, 0.2, 20) })
-            >> control_gain(0.1, 0.005)
-            >> filter_rbj(filter_type::LOWPASS, pitch / 2.0, 2, 0.0)
-            >> distort_power(1.25)
-            >> control_gain(0.1, 0.005);
+            >> fuse(fused::seed(pitch, 0.01, 0.75)
+                >> fused::repeat<2>(fused::rbj(filter_type::PEAK, pitch / 2.0, 0.2, 20))
+                >> fused::gain(0.1, 0.005)
+                >> fused::rbj(filter_type::LOWPASS, pitch / 2.0, 2, 0.0)
+                >> fused::power(1.25)
+                >> fused::gain(0.1, 0.005));
     }
 
     signal generate_pure_tone(uint64_t length, double pitch, uint64_t cycles)
@@ -110,7 +110,10 @@ namespace sonic_field
     template<typename T, uint64_t max_length> class static_delay_line_eight_tap;
     template<typename T, uint64_t OverSampleCount> class StateVariable;
 
-    constexpr double SAMPLE_RATE = double(sonic_field::SAMPLES_PER_SECOND);
+    inline double sample_rate()
+    {
+        return double(sonic_field::sample_rate());
+    }
 
     template<typename T>
     class MVerb
@@ -146,7 +149,7 @@ namespace sonic_field
         MVerb() {
             DampingFreq = 0.9;
             BandwidthFreq = 0.9;
-            SampleRate = SAMPLE_RATE;
+            SampleRate = sample_rate();
             Decay = 0.5;
             Gain = 1.;
             Mix = 1.;
@@ -422,7 +425,7 @@ namespace sonic_field
 
         void set_length(uint64_t length)
         {
-            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / SAMPLE_RATE)));
+            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / sample_rate())));
             m_length = length;
         }
 
@@ -509,7 +512,7 @@ namespace sonic_field
 
         void set_length(uint64_t length)
         {
-            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / SAMPLE_RATE)));
+            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / sample_rate())));
             m_length = length;
         }
 
@@ -553,7 +556,7 @@ namespace sonic_field
 
         void set_length(uint64_t length)
         {
-            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / SAMPLE_RATE)));
+            if (length >= max_length) SF_THROW(std::invalid_argument("length of delay too long: " + std::to_string(length * 1000 / sample_rate())));
             m_length = length;
         }
 
@@ -600,7 +603,7 @@ namespace sonic_field
         {
             auto do_set = [&](uint64_t& to, uint64_t& from)
             {
-                if (from >= m_length) SF_THROW(std::invalid_argument("offset of index too long: " + std::to_string(from * 1000ll / SAMPLE_RATE)));
+                if (from >= m_length) SF_THROW(std::invalid_argument("offset of index too long: " + std::to_string(from * 1000ll / sample_rate())));
                 to = from;
             };
             do_set(m_index1, index1);
@@ -633,7 +636,7 @@ namespace sonic_field
 
         void set_length(uint64_t length)
         {
-            if (length >= max_length) SF_THROW(std::invalid_argument("length of four tap delay too long: " + std::to_string(length * 1000ll / SAMPLE_RATE)));
+            if (length >= max_length) SF_THROW(std::invalid_argument("length of four tap delay too long: " + std::to_string(length * 1000ll / sample_rate())));
             m_length = length;
         }
 
@@ -688,7 +691,7 @@ namespace sonic_field
         {
             auto do_set = [&](uint64_t& to, uint64_t& from)
             {
-                if (from >= m_length) SF_THROW(std::invalid_argument("offset of index too long: " + std::to_string(from * 1000ll / SAMPLE_RATE)));
+                if (from >= m_length) SF_THROW(std::invalid_argument("offset of index too long: " + std::to_string(from * 1000ll / sample_rate())));
                 to = from;
             };
             do_set(m_index1, index1);
@@ -737,7 +740,7 @@ namespace sonic_field
 
         void set_length(uint64_t length)
         {
-            if (length >= max_length) SF_THROW(std::invalid_argument("length of four tap delay too long: " + std::to_string(length * 1000ll / SAMPLE_RATE)));
+            if (length >= max_length) SF_THROW(std::invalid_argument("length of four tap delay too long: " + std::to_string(length * 1000ll / sample_rate())));
             m_length = length;
         }
 
@@ -779,7 +782,7 @@ namespace sonic_field
     public:
         StateVariable()
         {
-            SetSampleRate(SAMPLE_RATE);
+            SetSampleRate(sample_rate());
             Frequency(1000.);
             Resonance(0);
             Type(LOWPASS);
@@ -852,12 +855,153 @@ namespace sonic_field
             f = 2. * sinf(sonic_field::PI * frequency / sampleRate);
         }
     };
+
+    // The reverberator used for previews. It takes MVerb's parameters and keeps the shape of its
+    // figure of eight tank, but has two input diffusers rather than four, a single all pass and
+    // delay each side, one pole filters in place of the oversampled state variable ones, no early
+    // reflection network and no parameter smoothing. It sounds like a thinner MVerb and costs
+    // about a fifth as much per sample.
+    template<typename T>
+    class preview_verb
+    {
+    private:
+        all_pass_filter<T, 320000> all_pass[2];
+        all_pass_filter<T, 320000> tank_all_pass[2];
+        static_delayline<T, 320000> predelay;
+        static_delayline<T, 320000> tank_delay[2];
+        T SampleRate, DampingFreq, Density, BandwidthFreq, PreDelayTime, Decay, Gain, Mix, EarlyMix, Size;
+        T BandwidthCoefficient, DampingCoefficient, DecayCoefficient;
+        T Bandwidth[2], Damping[2];
+        T PreviousLeftTank, PreviousRightTank;
+
+        // For a one pole low pass at frequency.
+        T one_pole(T frequency)
+        {
+            return std::exp(-2.0 * sonic_field::PI * frequency / SampleRate);
+        }
+
+    public:
+        preview_verb()
+        {
+            SampleRate = sample_rate();
+            DampingFreq = 0.9;
+            Density = 0.5;
+            BandwidthFreq = 0.9;
+            PreDelayTime = 0.1;
+            Decay = 0.5;
+            Gain = 1.;
+            Mix = 1.;
+            EarlyMix = 1.;
+            Size = 1.;
+            reset();
+        }
+
+        void process(T** inputs, T** outputs, uint64_t sampleFrames)
+        {
+            SF_MARK_STACK;
+            for (uint64_t i = 0; i < sampleFrames; ++i)
+            {
+                T left = inputs[0][i];
+                T right = inputs[1][i];
+                Bandwidth[0] = left + BandwidthCoefficient * (Bandwidth[0] - left);
+                Bandwidth[1] = right + BandwidthCoefficient * (Bandwidth[1] - right);
+                T smearedInput = predelay((Bandwidth[0] + Bandwidth[1]) * 0.5);
+                smearedInput = all_pass[0](smearedInput);
+                smearedInput = all_pass[1](smearedInput);
+                T leftTank = tank_delay[0](tank_all_pass[0](smearedInput + PreviousRightTank));
+                T rightTank = tank_delay[1](tank_all_pass[1](smearedInput + PreviousLeftTank));
+                Damping[0] = leftTank + DampingCoefficient * (Damping[0] - leftTank);
+                Damping[1] = rightTank + DampingCoefficient * (Damping[1] - rightTank);
+                PreviousLeftTank = Damping[0] * DecayCoefficient;
+                PreviousRightTank = Damping[1] * DecayCoefficient;
+                T accumulatorL = 0.6 * (rightTank - 0.5 * leftTank);
+                T accumulatorR = 0.6 * (leftTank - 0.5 * rightTank);
+                accumulatorL = accumulatorL * EarlyMix + (1 - EarlyMix) * Bandwidth[0];
+                accumulatorR = accumulatorR * EarlyMix + (1 - EarlyMix) * Bandwidth[1];
+                left = (left + Mix * (accumulatorL - left)) * Gain;
+                right = (right + Mix * (accumulatorR - right)) * Gain;
+                if (!(std::isfinite(left) && std::isfinite(right)))
+                {
+                    SF_THROW(std::overflow_error{"Overflow or NaN in preview reverberator. left: " + std::to_string(left) + " right: " + std::to_string(right)});
+                }
+                outputs[0][i] = left;
+                outputs[1][i] = right;
+            }
+        }
+
+        void reset()
+        {
+            SF_MARK_STACK;
+            // As MVerb once its smoothed parameters have settled.
+            BandwidthCoefficient = one_pole(BandwidthFreq + 100.);
+            DampingCoefficient = one_pole(DampingFreq + 100.);
+            DecayCoefficient = 0.7995 * Decay + 0.005;
+            Bandwidth[0] = Bandwidth[1] = Damping[0] = Damping[1] = 0.;
+            PreviousLeftTank = PreviousRightTank = 0.;
+            predelay.clear();
+            predelay.set_length(uint64_t(PreDelayTime * 200 * (SampleRate / 1000)));
+            all_pass[0].clear();
+            all_pass[1].clear();
+            all_pass[0].set_length(uint64_t(0.0048 * SampleRate));
+            all_pass[1].set_length(uint64_t(0.0127 * SampleRate));
+            all_pass[0].set_feedback(0.75);
+            all_pass[1].set_feedback(0.625);
+            tank_all_pass[0].clear();
+            tank_all_pass[1].clear();
+            tank_all_pass[0].set_length(uint64_t(0.020 * SampleRate * Size));
+            tank_all_pass[1].set_length(uint64_t(0.030 * SampleRate * Size));
+            tank_all_pass[0].set_feedback(Density);
+            tank_all_pass[1].set_feedback(Density);
+            tank_delay[0].clear();
+            tank_delay[1].clear();
+            tank_delay[0].set_length(uint64_t(0.15 * SampleRate * Size));
+            tank_delay[1].set_length(uint64_t(0.14 * SampleRate * Size));
+        }
+
+        // Takes MVerb's parameter numbers; call reset() after setting them.
+        void setParameter(uint64_t index, T value)
+        {
+            SF_MARK_STACK;
+            switch (index)
+            {
+            case MVerb<T>::DAMPINGFREQ:
+                DampingFreq = value;
+                break;
+            case MVerb<T>::DENSITY:
+                Density = value;
+                break;
+            case MVerb<T>::BANDWIDTHFREQ:
+                BandwidthFreq = value;
+                break;
+            case MVerb<T>::PREDELAY:
+                PreDelayTime = value;
+                break;
+            case MVerb<T>::SIZE:
+                Size = (0.95 * value) + 0.05;
+                break;
+            case MVerb<T>::DECAY:
+                Decay = value;
+                break;
+            case MVerb<T>::GAIN:
+                Gain = value;
+                break;
+            case MVerb<T>::MIX:
+                Mix = value;
+                break;
+            case MVerb<T>::EARLYMIX:
+                EarlyMix = value;
+                break;
+            }
+        }
+    };
     } // mverb
 
     namespace sonic_field
     {
 
-    std::unique_ptr<mreverb> create_mreverb(
+    // Sets up either kind of reverb the same way.
+    template<typename V>
+    std::unique_ptr<V> create_reverb(
         double damping_freq,
         double density,
         double bandwidth_freq,
@@ -868,7 +1012,7 @@ namespace sonic_field
         double mix,
         double early_mix)
     {
-        std::unique_ptr<mreverb> ret{ new mreverb{} };
+        std::unique_ptr<V> ret{ new V{} };
         ret->setParameter(mreverb::DAMPINGFREQ, damping_freq);
         ret->setParameter(mreverb::DENSITY, density);
         ret->setParameter(mreverb::BANDWIDTHFREQ, bandwidth_freq);
@@ -881,7 +1025,23 @@ namespace sonic_field
         ret->reset();
         return ret;
     }
-    std::pair<double*, double*> mreverb_process_block(mreverb* verb, double* left, double* right)
+
+    std::unique_ptr<mreverb> create_mreverb(
+        double damping_freq,
+        double density,
+        double bandwidth_freq,
+        double decay,
+        double predelay,
+        double size,
+        double gain,
+        double mix,
+        double early_mix)
+    {
+        return create_reverb<mreverb>(damping_freq, density, bandwidth_freq, decay, predelay, size, gain, mix, early_mix);
+    }
+
+    template<typename V>
+    std::pair<double*, double*> mreverb_process_block(V* verb, double* left, double* right)
     {
         double* lrin[2];
         lrin[0] = left;
@@ -889,7 +1049,7 @@ namespace sonic_field
         double* lrout[2];
         lrout[0] = new_block(false);
         lrout[1] = new_block(false);
-        verb->process(lrin, lrout, BLOCK_SIZE);
+        verb->process(lrin, lrout, block_size());
         free_block(left);
         if (left != right) free_block(right);
         return { lrout[0], lrout[1] };
@@ -913,7 +1073,10 @@ namespace sonic_field
         double mix,
         double early_mix): m_left{ add_to_scope(new signal_writer{ left }) }, m_right{ add_to_scope(new signal_writer{ right }) }
     {
-        m_reverb = create_mreverb(damping_freq, density, bandwidth_freq, decay, predelay, size, gain, mix, early_mix);
+        if (preview())
+            m_preview_reverb = create_reverb<preview_mreverb>(damping_freq, density, bandwidth_freq, decay, predelay, size, gain, mix, early_mix);
+        else
+            m_reverb = create_mreverb(damping_freq, density, bandwidth_freq, decay, predelay, size, gain, mix, early_mix);
     }
 
     class writer_plug : public signal_mono_base
@@ -973,11 +1136,16 @@ namespace sonic_field
                     return;
                 }
                 if (left == nullptr || right == nullptr) SF_THROW(std::logic_error{ "Not all mixing inputs same length" });
-                auto verbed = mreverb_process_block(m_reverb.get(), left, right);
+                auto verbed = m_reverb ?
+                    mreverb_process_block(m_reverb.get(), left, right) :
+                    mreverb_process_block(m_preview_reverb.get(), left, right);
                 left_plug->set_data(verbed.first);
                 right_plug->set_data(verbed.second);
-                free_block(m_left.next());
-                free_block(m_right.next());
+                for (auto side : { &m_left, &m_right })
+                {
+                    auto done = side->next();
+                    if (done != empty_block()) free_block(done);
+                }
             }
         }
     }
@@ -1004,7 +1172,7 @@ namespace sonic_field
         double saturate,
         double wow,
         double flutter) :
-        m_buffer{ new double[delay * BLOCK_SIZE] },
+        m_buffer{ new double[delay * block_size()] },
         m_delay{ delay },
         m_feedback{ feedback },
         m_mix{ mix },
@@ -1013,7 +1181,7 @@ namespace sonic_field
         m_flutter{ flutter },
         m_index{ 0 }
     {
-        memset(m_buffer, 0, sizeof(double)* delay * BLOCK_SIZE);
+        memset(m_buffer, 0, sizeof(double)* delay * block_size());
     };
 
     double* echo_chamber::next()
@@ -1022,15 +1190,16 @@ namespace sonic_field
         return process_no_skip([&](double* block) {
             if (block)
             {
-                uint64_t length = m_delay * BLOCK_SIZE;
-                constexpr double wow_rate = 2 * PI * 1.0 / SAMPLES_PER_SECOND;
-                constexpr double flutter_rate = 2 * PI * 40.0 / SAMPLES_PER_SECOND;
+                auto size = block_size();
+                uint64_t length = m_delay * size;
+                double wow_rate = 2 * PI * 1.0 / sample_rate();
+                double flutter_rate = 2 * PI * 40.0 / sample_rate();
 
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
                 {
                     // Up to +-10ms wow and +-1 ms flutter.
-                    uint64_t wow = int64_t(m_wow * (1.0+fast_cos(m_index * wow_rate)) * double(BLOCK_SIZE) * 10.0);
-                    uint64_t flutter = int64_t(m_flutter * (1.0+fast_cos(m_index * flutter_rate)) * double(BLOCK_SIZE));
+                    uint64_t wow = int64_t(m_wow * (1.0+fast_cos(m_index * wow_rate)) * double(size) * 10.0);
+                    uint64_t flutter = int64_t(m_flutter * (1.0+fast_cos(m_index * flutter_rate)) * double(size));
                     uint64_t at = (wow + flutter + m_index) % length;
                     double evalue = m_buffer[at];
                     double ivalue = block[idx];
@@ -1076,7 +1245,7 @@ namespace sonic_field
         {
             if (tap.first > m_length) m_length = tap.first;
         }
-        m_length *= BLOCK_SIZE;
+        m_length *= block_size();
         m_buffer = new double[m_length];
         memset(m_buffer, 0, sizeof(double)* m_length);
     }
@@ -1093,13 +1262,13 @@ namespace sonic_field
             if (block)
             {
                 auto out = new_block();
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     double accumulator{block[idx]};
                     m_buffer[m_position % m_length] = accumulator;
                     for (const auto& tap : m_taps)
                     {
-                        int64_t at = int64_t(m_position) - int64_t(tap.first * BLOCK_SIZE);
+                        int64_t at = int64_t(m_position) - int64_t(tap.first * block_size());
                         if (at > 0)
                         {
                             accumulator += m_buffer[at % m_length] * tap.second;
@@ -1120,6 +1289,15 @@ namespace sonic_field
         return "situator";
     }
 
+    uint64_t situator::hash()
+    {
+        signal_hash ret{ name() };
+        for (const auto& tap : m_taps)
+            ret << tap.first << tap.second;
+        // Only the start, with an empty buffer, can be cached.
+        return m_position ? 0 : ret.inputs(m_inputs).value();
+    }
+
     signal_base* situator::copy()
     {
         return new situator{ m_taps };
@@ -0,0 +1,220 @@
+#include "signal_cache.h"
+#include "sonic_field.h"
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace sonic_field
+{
+    namespace
+    {
+        struct cache_entry
+        {
+            std::shared_ptr<const cached_signal> m_signal;
+            bool m_on_disk;
+            std::list<std::string>::iterator m_use;
+        };
+
+        // Guards everything below. Spilling happens with it held so a signal is always either
+        // cached or complete on disk.
+        std::mutex SF_CACHE_MUTEX{};
+        uint64_t SF_CACHE_BUDGET = 0;
+        // By cached signals and reservations of signals still being written.
+        uint64_t SF_CACHE_USED = 0;
+        // Most recently used first.
+        std::list<std::string> SF_CACHE_USE{};
+        std::unordered_map<std::string, cache_entry> SF_CACHE{};
+
+        std::string SF_RENDER_CACHE{};
+
+        // Renders at different sample rates are different files.
+        std::string rendered_path(uint64_t hash)
+        {
+            char name[48];
+            snprintf(name, sizeof(name), "%016llx-%llu.sig", static_cast<unsigned long long>(hash),
+                static_cast<unsigned long long>(sample_rate()));
+            return join_path({ SF_RENDER_CACHE, name });
+        }
+
+        // Hard links cost nothing; copy if the directories are on different file systems.
+        bool link_or_copy(const std::string& from, const std::string& to)
+        {
+            std::error_code error{};
+            std::filesystem::remove(to, error);
+            std::filesystem::create_hard_link(from, to, error);
+            if (!error)
+                return true;
+            error.clear();
+            return std::filesystem::copy_file(from, to, std::filesystem::copy_options::overwrite_existing, error) &&
+                !error;
+        }
+
+        void write_out(const std::string& path, cache_entry& entry)
+        {
+            if (entry.m_on_disk)
+                return;
+            std::cerr << "Spilling Signal: name: " << path << std::endl;
+            signal_writer::write_file(path, entry.m_signal->m_blocks, entry.m_signal->m_codec);
+            entry.m_on_disk = true;
+        }
+
+        void drop(const std::string& path)
+        {
+            auto found = SF_CACHE.find(path);
+            SF_CACHE_USED -= found->second.m_signal->m_bytes;
+            SF_CACHE_USE.erase(found->second.m_use);
+            SF_CACHE.erase(found);
+        }
+
+        bool make_room(uint64_t bytes)
+        {
+            while (SF_CACHE_USED + bytes > SF_CACHE_BUDGET && !SF_CACHE_USE.empty())
+            {
+                auto path = SF_CACHE_USE.back();
+                write_out(path, SF_CACHE.at(path));
+                drop(path);
+            }
+            return SF_CACHE_USED + bytes <= SF_CACHE_BUDGET;
+        }
+    }
+
+    cached_signal::cached_signal(std::vector<double*>&& blocks, signal_codec codec) :
+        m_blocks{ std::move(blocks) },
+        m_codec{ codec },
+        m_peak{ 0 },
+        m_bytes{ 0 }
+    {
+        for (auto block : m_blocks)
+        {
+            if (block == empty_block())
+                continue;
+            m_bytes += BLOCK_SIZE * sizeof(double);
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+                m_peak = std::max(m_peak, std::abs(block[idx]));
+        }
+    }
+
+    cached_signal::~cached_signal()
+    {
+        for (auto block : m_blocks)
+        {
+            if (block != empty_block()) free_block(block);
+        }
+    }
+
+    void set_signal_cache_bytes(uint64_t bytes)
+    {
+        SF_MARK_STACK;
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        SF_CACHE_BUDGET = bytes;
+        make_room(0);
+    }
+
+    uint64_t signal_cache_bytes()
+    {
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        return SF_CACHE_BUDGET;
+    }
+
+    bool reserve_cache_bytes(uint64_t bytes)
+    {
+        SF_MARK_STACK;
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        if (!make_room(bytes))
+            return false;
+        SF_CACHE_USED += bytes;
+        return true;
+    }
+
+    void release_cache_bytes(uint64_t bytes)
+    {
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        SF_CACHE_USED -= bytes;
+    }
+
+    void cache_signal(const std::string& path, std::shared_ptr<const cached_signal> signal)
+    {
+        SF_MARK_STACK;
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        if (SF_CACHE.count(path))
+            drop(path);
+        SF_CACHE_USE.push_front(path);
+        SF_CACHE[path] = { signal, false, SF_CACHE_USE.begin() };
+    }
+
+    std::shared_ptr<const cached_signal> find_cached_signal(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        auto found = SF_CACHE.find(path);
+        if (found == SF_CACHE.end())
+            return {};
+        SF_CACHE_USE.splice(SF_CACHE_USE.begin(), SF_CACHE_USE, found->second.m_use);
+        return found->second.m_signal;
+    }
+
+    void persist_signal(const std::string& path)
+    {
+        SF_MARK_STACK;
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        auto found = SF_CACHE.find(path);
+        if (found != SF_CACHE.end())
+            write_out(path, found->second);
+    }
+
+    bool forget_cached_signal(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock{ SF_CACHE_MUTEX };
+        if (!SF_CACHE.count(path))
+            return false;
+        drop(path);
+        return true;
+    }
+
+    void set_render_cache(const std::string& directory)
+    {
+        SF_MARK_STACK;
+        if (!directory.empty())
+        {
+            std::error_code error{};
+            std::filesystem::create_directories(directory, error);
+            if (error)
+                SF_THROW(std::invalid_argument{ "Cannot use render cache " + directory + ": " + error.message() });
+        }
+        SF_RENDER_CACHE = directory;
+    }
+
+    const std::string& render_cache()
+    {
+        return SF_RENDER_CACHE;
+    }
+
+    bool fetch_rendered(uint64_t hash, const std::string& path)
+    {
+        SF_MARK_STACK;
+        if (SF_RENDER_CACHE.empty() || !hash)
+            return false;
+        auto from = rendered_path(hash);
+        if (!std::filesystem::exists(from) || !link_or_copy(from, path))
+            return false;
+        std::cerr << "Render cache hit: name: " << path << " from: " << from << std::endl;
+        return true;
+    }
+
+    void store_rendered(uint64_t hash, const std::string& path)
+    {
+        SF_MARK_STACK;
+        if (SF_RENDER_CACHE.empty() || !hash)
+            return;
+        // Made under another name and renamed so a half made entry is never seen; the name is the
+        // thread's own in case two threads render the same thing at once.
+        auto to = rendered_path(hash);
+        auto making = to + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".making";
+        std::error_code error{};
+        if (link_or_copy(path, making))
+            std::filesystem::rename(making, to, error);
+        if (error)
+            std::filesystem::remove(making, error);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Signals written to the work space kept in memory so reading them back costs no I/O and none of
+// the loss of the wire format. The cache has a budget in bytes (zero, the default, turns it off).
+// When a new signal needs room the least recently used ones are written out as ordinary .sig files
+// and dropped. Signals still only in memory when the program ends are lost, so anything needed
+// after the run has to be persisted (signal_to_wav does this for what it converts).
+namespace sonic_field
+{
+    enum class signal_codec;
+
+    // The blocks of a finished signal at the full rate. The cache holds a reference to each.
+    struct cached_signal
+    {
+        std::vector<double*> m_blocks;
+        signal_codec m_codec;
+        // Largest magnitude of any sample, which readers scale to one as they do for files.
+        double m_peak;
+        // Held by the blocks; the empty block takes none.
+        uint64_t m_bytes;
+
+        cached_signal(std::vector<double*>&& blocks, signal_codec codec);
+        cached_signal(const cached_signal&) = delete;
+        cached_signal& operator=(const cached_signal&) = delete;
+        ~cached_signal();
+    };
+
+    // Changing the budget spills whatever no longer fits.
+    void set_signal_cache_bytes(uint64_t bytes);
+    uint64_t signal_cache_bytes();
+
+    // Take bytes from the budget for a signal being written, spilling others to make room. False
+    // if there is not room even so, in which case the writer should go to disk.
+    bool reserve_cache_bytes(uint64_t bytes);
+    void release_cache_bytes(uint64_t bytes);
+
+    // Hand over a finished signal; its bytes must already have been reserved.
+    void cache_signal(const std::string& path, std::shared_ptr<const cached_signal> signal);
+
+    // The signal for the .sig path if it is in memory (which counts as using it) or null.
+    std::shared_ptr<const cached_signal> find_cached_signal(const std::string& path);
+
+    // Make sure the .sig file exists on disk; the signal stays cached.
+    void persist_signal(const std::string& path);
+
+    // Drop any cached signal for the path without writing it. True if there was one.
+    bool forget_cached_signal(const std::string& path);
+
+    // The render cache: .sig files kept in a directory under the hash (see signal_hash) of the graph
+    // which rendered them, so writing the same graph again links the old file rather than
+    // rendering. An empty directory, the default, turns it off. Entries are never removed, and do
+    // not notice changes to the code of processors, so clear the directory after any.
+    void set_render_cache(const std::string& directory);
+    const std::string& render_cache();
+    // Link (or copy) the file rendered for the hash to path. False if there is none.
+    bool fetch_rendered(uint64_t hash, const std::string& path);
+    // Keep the file just written at path as the render for the hash.
+    void store_rendered(uint64_t hash, const std::string& path);
+}
@@ -1,10 +1,17 @@
 #include "sonic_field.h"
 #include <math.h>
 #include <atomic>
+#include <deque>
+#include <mutex>
 
 namespace sonic_field
 {
-    thread_local std::vector<std::vector<signal>> scopes{};
+    // A deque so the scope lent to other threads stays put as more are opened.
+    thread_local std::deque<std::vector<signal>> scopes{};
+    // The scope a task running for another thread adds to when it has none of its own.
+    thread_local std::vector<signal>* lent_scope{ nullptr };
+    // Scopes are lent while their owner goes on adding to them.
+    std::mutex scopes_mutex{};
 
     scope::scope()
     {
@@ -26,9 +33,28 @@ namespace sonic_field
     {
         SF_NO_TRACK;
         SF_MESG_STACK("Add to scope");
-        if (!scopes.size()) SF_THROW(std::logic_error{ "No current scope - have you defined a scope?" });
-        scopes.back().push_back(sig);
-        return scopes.back().back();
+        std::lock_guard<std::mutex> lock{ scopes_mutex };
+        auto into = scopes.size() ? &scopes.back() : lent_scope;
+        if (!into) SF_THROW(std::logic_error{ "No current scope - have you defined a scope?" });
+        into->push_back(sig);
+        return into->back();
+    }
+
+    std::function<void()> in_current_scope(std::function<void()> task)
+    {
+        auto lent = scopes.size() ? &scopes.back() : lent_scope;
+        return [lent, task = std::move(task)] {
+            struct restore
+            {
+                std::vector<signal>* m_was;
+                ~restore()
+                {
+                    lent_scope = m_was;
+                }
+            } restore_lent{ lent_scope };
+            lent_scope = lent;
+            task();
+        };
     }
 
     std::string WORK_SPACE{};
@@ -65,7 +91,8 @@ namespace sonic_field
     void delete_sig_file(const std::string& name)
     {
         auto fname = work_space() + name + ".sig";
-        if (std::remove(fname.c_str()))
+        auto cached = forget_cached_signal(fname);
+        if (std::remove(fname.c_str()) && !cached)
            SF_THROW(std::runtime_error{"Failed to remove file: " + fname});
     }
 
@@ -101,43 +128,206 @@ namespace sonic_field
         return ret;
     }
 
+    // The PACKED chunk coding. Samples are turned into unsigned integers which sort the same way as
+    // the floats, so nearby values have nearby bits, and each is predicted to carry on in a straight
+    // line from the two before it. The difference, zigzagged so small negatives are small too, is
+    // stored little endian in 1 to 4 bytes; the lengths go two bits each in control bytes at the
+    // front of the chunk.
+    static uint32_t ordered_bits(float v)
+    {
+        uint32_t bits;
+        memcpy(&bits, &v, sizeof(bits));
+        return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+    }
+
+    static float from_ordered_bits(uint32_t bits)
+    {
+        bits = bits & 0x80000000u ? bits & 0x7fffffffu : ~bits;
+        float v;
+        memcpy(&v, &bits, sizeof(v));
+        return v;
+    }
+
+    static void pack_chunk(const std::vector<float>& in, std::vector<uint8_t>& out)
+    {
+        auto count = in.size();
+        out.assign(count / 4, 0);
+        uint32_t last{ 0 };
+        uint32_t before{ 0 };
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+        {
+            auto bits = ordered_bits(in[idx]);
+            auto diff = bits - (2 * last - before);
+            auto zig = (diff << 1) ^ uint32_t(int32_t(diff) >> 31);
+            uint32_t len = zig < 0x100u ? 1 : zig < 0x10000u ? 2 : zig < 0x1000000u ? 3 : 4;
+            out[idx >> 2] |= uint8_t((len - 1) << ((idx & 3) * 2));
+            for (uint32_t byte{ 0 }; byte < len; ++byte)
+                out.push_back(uint8_t(zig >> (8 * byte)));
+            before = last;
+            last = bits;
+        }
+        // So unpacking can always load four bytes at once.
+        out.insert(out.end(), 3, 0);
+    }
+
+    // False if the bytes do not hold exactly count samples.
+    static bool unpack_chunk(const uint8_t* in, uint64_t bytes, float* out, uint64_t count)
+    {
+        if (count % 4 || bytes < count / 4 + 3)
+            return false;
+        auto controls = in;
+        auto data = in + count / 4;
+        auto end = in + bytes - 3;
+        uint32_t last{ 0 };
+        uint32_t before{ 0 };
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+        {
+            uint32_t len = ((controls[idx >> 2] >> ((idx & 3) * 2)) & 3) + 1;
+            if (data + len > end)
+                return false;
+            uint32_t zig;
+            memcpy(&zig, data, sizeof(zig));
+            zig &= 0xffffffffu >> (32 - 8 * len);
+            data += len;
+            auto diff = (zig >> 1) ^ (0u - (zig & 1));
+            auto bits = diff + (2 * last - before);
+            out[idx] = from_ordered_bits(bits);
+            before = last;
+            last = bits;
+        }
+        return data == end;
+    }
+
+    signal_file::signal_file(const std::string& path) :
+        m_map{ map_file(path) },
+        m_levels{ 0, 0, 0 },
+        m_rate{ SAMPLES_PER_SECOND >> 1 },
+        m_block_samples{ WIRE_BLOCK_SIZE },
+        m_samples{ 0 },
+        m_chunk_samples{ 0 },
+        m_data{ nullptr },
+        m_chunks{ nullptr },
+        m_chunk_count{ 0 },
+        m_unpacked{},
+        m_unpacked_chunk{ std::numeric_limits<uint64_t>::max() },
+        m_content_hash{ 0 }
+    {
+        SF_MARK_STACK;
+        auto size = m_map->size();
+        auto data = m_map->data();
+        signal_file_header_v2 header{};
+        if (size >= sizeof(header) && !memcmp(data, SF_SIGNAL_MAGIC, sizeof(SF_SIGNAL_MAGIC)))
+        {
+            memcpy(&header, data, sizeof(header));
+            if (header.version != SF_SIGNAL_VERSION)
+                SF_THROW(std::out_of_range{ "signal file version " + std::to_string(header.version) +
+                    " not supported: " + path });
+            if (header.sample_rate % 1000 != 0 || header.sample_rate == 0 ||
+                header.sample_rate / 1000 > WIRE_BLOCK_SIZE)
+                SF_THROW(std::out_of_range{ "signal file rate " + std::to_string(header.sample_rate) +
+                    " not supported: " + path });
+            m_rate = header.sample_rate;
+            m_block_samples = m_rate / 1000;
+            if (header.chunk_samples == 0 || header.chunk_samples % m_block_samples != 0 ||
+                header.index_offset > size || header.chunks > (size - header.index_offset) / sizeof(signal_chunk) ||
+                header.chunks != (header.samples + header.chunk_samples - 1) / header.chunk_samples)
+                SF_THROW(std::out_of_range{ "signal file corrupt: " + path });
+            m_levels = header.levels;
+            m_samples = header.samples;
+            m_chunk_samples = header.chunk_samples;
+            m_chunks = reinterpret_cast<const signal_chunk*>(data + header.index_offset);
+            m_chunk_count = header.chunks;
+        }
+        else
+        {
+            if (size < sizeof(m_levels)) SF_THROW(std::out_of_range{ "signal file corrupt" });
+            memcpy(&m_levels, data, sizeof(m_levels));
+            m_samples = (size - sizeof(m_levels)) / sizeof(float);
+            m_data = reinterpret_cast<const float*>(data + sizeof(m_levels));
+        }
+    }
+
+    const float* signal_file::wire_block(uint64_t position)
+    {
+        if (position + m_block_samples > m_samples)
+            SF_THROW(std::out_of_range{ "reading past the end of a signal file" });
+        if (m_data)
+            return m_data + position;
+        auto index = position / m_chunk_samples;
+        const auto& chunk = m_chunks[index];
+        if (chunk.flags & SF_CHUNK_SILENT)
+            return nullptr;
+        auto within = position % m_chunk_samples;
+        if (chunk.offset + chunk.bytes > m_map->size())
+            SF_THROW(std::out_of_range{ "signal file chunk corrupt" });
+        if (chunk.flags & SF_CHUNK_PACKED)
+        {
+            if (m_unpacked_chunk != index)
+            {
+                m_unpacked.resize(std::min(m_chunk_samples, m_samples - index * m_chunk_samples));
+                m_unpacked_chunk = std::numeric_limits<uint64_t>::max();
+                if (!unpack_chunk(reinterpret_cast<const uint8_t*>(m_map->data() + chunk.offset), chunk.bytes,
+                    m_unpacked.data(), m_unpacked.size()))
+                    SF_THROW(std::out_of_range{ "signal file chunk corrupt" });
+                m_unpacked_chunk = index;
+            }
+            return m_unpacked.data() + within;
+        }
+        if ((within + m_block_samples) * sizeof(float) > chunk.bytes || chunk.offset % sizeof(float))
+            SF_THROW(std::out_of_range{ "signal file chunk corrupt" });
+        return reinterpret_cast<const float*>(m_map->data() + chunk.offset) + within;
+    }
+
+    uint64_t signal_file::content_hash()
+    {
+        SF_MARK_STACK;
+        if (m_content_hash || !m_map)
+            return m_content_hash;
+        signal_hash ret{ "signal_file" };
+        auto data = m_map->data();
+        auto size = m_map->size();
+        ret << size;
+        uint64_t word{ 0 };
+        for (uint64_t at{ 0 }; at < size; at += sizeof(word))
+        {
+            memcpy(&word, data + at, std::min(uint64_t(sizeof(word)), size - at));
+            ret << word;
+        }
+        m_content_hash = ret.value();
+        return m_content_hash;
+    }
+
+    void signal_file::close()
+    {
+        m_map.reset();
+        m_data = nullptr;
+        m_chunks = nullptr;
+        m_samples = 0;
+        m_unpacked = {};
+        m_unpacked_chunk = std::numeric_limits<uint64_t>::max();
+    }
+
     signal_reader::signal_reader(const std::string& name, clean_level clean):
         m_name{ work_space() + name + ".sig" },
-        m_filter{ filter_type::LOWPASS, MAX_FREQUENCY, 1.0, 0.0 },
-        m_clean_level{ clean },
+        m_file{ m_name },
+        m_upsampler{ clean == clean_level::MILD ? resample_quality::FAST : resample_quality::GOOD },
+        // Previews run at a rate with nothing to clean, but a NONE reader is cheapest whatever the rate.
+        m_clean_level{ preview() ? clean_level::NONE : clean },
         m_position{ 0 }
     {
-        signal_file_header header{};
-        m_in.open(m_name, std::ifstream::ate | std::ifstream::binary);
-        if (!m_in)
-            SF_THROW(std::out_of_range{ "could not open file " + m_name});
-
-        m_len = (uint64_t(m_in.tellg()) - sizeof(header)) / sizeof(float);
-        m_in.seekg(0);
-        m_in.read(reinterpret_cast<char*>(&header), sizeof(header));
-        if (!m_in) SF_THROW(std::out_of_range{ "signal file corrupt" });
+        auto header = m_file.levels();
+        m_len = m_file.samples();
         m_scale = -header.peak_negative > header.peak_positive ?
             -1.0 / header.peak_negative : 1.0 / header.peak_positive;
-        if (m_len % WIRE_BLOCK_SIZE != 0)
+        if (m_file.rate() != wire_rate())
+            SF_THROW(std::invalid_argument{ "signal file " + m_name + " is at " + std::to_string(m_file.rate()) +
+                " Hz but renders at this sample rate store " + std::to_string(wire_rate()) + " Hz" });
+        if (m_len % wire_block_size() != 0)
             SF_THROW(std::out_of_range{ "signal file not integer number of blocks corrupt: " + m_name});
         switch (clean)
         {
         case clean_level::NONE:
-            break;
         case clean_level::MILD:
-            {
-                // Stablise the filter to the first imput value.
-                float samp{ 0 };
-                m_in.read(reinterpret_cast<char*>(&samp), sizeof(float));
-                m_in.seekg(sizeof(header));
-                double dsamp = double(samp);
-                // Definitely don't need this many loops - but what is a reasonable value?
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
-                {
-                    m_filter.filter(dsamp);
-                }
-            }
-            break;
         case clean_level::NORMAL:
             break;
         default:
@@ -148,93 +338,197 @@ namespace sonic_field
                     << " len: " << m_len << std::endl;
     }
 
+    // The upsampler reaches less than a wire block either side, so a silent block gives silence
+    // when its neighbours are silent (or beyond the ends) too.
+    bool signal_reader::silent_around()
+    {
+        if (m_clean_level == clean_level::NONE || sample_rate() == wire_rate())
+            return true;
+        auto wire = wire_block_size();
+        if (m_position >= wire && m_file.wire_block(m_position - wire))
+            return false;
+        // MILD holds the first sample before the start, which is zero here.
+        return m_len <= wire || !m_file.wire_block(m_position + wire);
+    }
+
+    // The scaled samples of the block at m_position with the upsampler's taps either side.
+    void signal_reader::read_context(double* into)
+    {
+        int64_t wire = wire_block_size();
+        int64_t taps = m_upsampler.taps();
+        int64_t from = int64_t(m_position) - taps + 1;
+        int64_t to = int64_t(m_position) + wire + taps;
+        int64_t end = int64_t(m_position + m_len);
+        double before{ 0.0 };
+        if (m_clean_level == clean_level::MILD)
+        {
+            if (auto first = m_file.wire_block(0)) before = double(first[0]) * m_scale;
+        }
+        int64_t at{ from };
+        while (at < to)
+        {
+            if (at < 0)
+            {
+                *into++ = before;
+                ++at;
+                continue;
+            }
+            if (at >= end)
+            {
+                *into++ = 0.0;
+                ++at;
+                continue;
+            }
+            auto block_start = at - at % wire;
+            auto count = std::min(block_start + wire, to) - at;
+            if (auto buf = m_file.wire_block(block_start))
+            {
+                for (int64_t idx{ 0 }; idx < count; ++idx)
+                    into[idx] = double(buf[at - block_start + idx]) * m_scale;
+            }
+            else
+            {
+                for (int64_t idx{ 0 }; idx < count; ++idx)
+                    into[idx] = 0.0;
+            }
+            into += count;
+            at += count;
+        }
+    }
+
     double* signal_reader::next()
     {
         SF_MESG_STACK("signal_reader::next");
         if (!m_len)
         {
-            m_in.close();
+            m_file.close();
             return nullptr;
         }
-        double* ret = new_block(false);
-        float buf[WIRE_BLOCK_SIZE];
-        m_in.read(reinterpret_cast<char*>(&buf), sizeof(buf));
-        if (!m_in)
-            SF_THROW(std::out_of_range{ "signal file corrupt" });
-        auto jdx = 0;
-        switch (m_clean_level)
+        static const float zeros[WIRE_BLOCK_SIZE]{};
+        auto wire = wire_block_size();
+        auto size = block_size();
+        auto buf = m_file.wire_block(m_position);
+        if (!buf)
         {
-        case clean_level::NONE:
-            for (uint64_t idx{ 0 }; idx < WIRE_BLOCK_SIZE; ++idx)
+            if (silent_around())
             {
-                // Very fast upscale which will probably be good enough most of the time.
-                auto v = double(buf[idx]) * m_scale;
-                ret[jdx++] = v;
-                ret[jdx++] = v;
+                m_len -= wire;
+                m_position += wire;
+                return empty_block();
             }
-            break;
-        case clean_level::MILD:
-        case clean_level::NORMAL:
-            for (uint64_t idx{ 0 }; idx < WIRE_BLOCK_SIZE; ++idx)
+            buf = zeros;
+        }
+        double* ret = new_block(false);
+        if (size == wire)
+        {
+            // Stored at the full rate so there is nothing to clean up.
+            for (uint64_t idx{ 0 }; idx < wire; ++idx)
+                ret[idx] = double(buf[idx]) * m_scale;
+        }
+        else
+        {
+            switch (m_clean_level)
             {
-                // Use the filter to remove harmonics created by naive upscaling.
-                auto v = double(buf[idx]) * m_scale;
-                ret[jdx++] = m_filter.filter(v);
-                ret[jdx++] = m_filter.filter(v);
+            case clean_level::NONE:
+                for (uint64_t idx{ 0 }, jdx{ 0 }; idx < wire; ++idx)
+                {
+                    // Very fast upscale which will probably be good enough most of the time.
+                    auto v = double(buf[idx]) * m_scale;
+                    ret[jdx++] = v;
+                    ret[jdx++] = v;
+                }
+                break;
+            case clean_level::MILD:
+            case clean_level::NORMAL:
+                {
+                    // Interpolate properly rather than repeating samples, which makes images of
+                    // everything mirrored about the wire rate's Nyquist.
+                    double context[WIRE_BLOCK_SIZE + 2 * SF_MAX_RESAMPLE_TAPS];
+                    read_context(context);
+                    m_upsampler.upsample(context + m_upsampler.taps() - 1, ret, wire);
+                }
+                break;
+            default:
+                SF_THROW(std::logic_error{ "This code should never be reached" });
             }
-            break;
-        default:
-            SF_THROW(std::logic_error{ "This code should never be reached" });
         }
 
         if (m_clean_level == clean_level::NORMAL)
         {
-            if (m_len < 11 * WIRE_BLOCK_SIZE)
+            if (m_len < 11 * wire)
             {
-                double size = 10 * WIRE_BLOCK_SIZE;
-                double scale = 1.0 - ((size - double(m_len))/ size);
-                constexpr double step = 1.0 / (10 * BLOCK_SIZE);
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                double length = 10 * wire;
+                double scale = 1.0 - ((length - double(m_len))/ length);
+                double step = 1.0 / (10 * size);
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
                 {
                     ret[idx] *= scale;
                     scale -= step;
                 }
             }
-            else if (m_position < 10 * WIRE_BLOCK_SIZE)
+            else if (m_position < 10 * wire)
             {
-                double size = 10 * WIRE_BLOCK_SIZE;
-                constexpr double step = 1.0 / (10 * BLOCK_SIZE);
-                double scale = 1.0 - ((size - double(m_position)) / size);
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                double length = 10 * wire;
+                double step = 1.0 / (10 * size);
+                double scale = 1.0 - ((length - double(m_position)) / length);
+                for (uint64_t idx{ 0 }; idx < size; ++idx)
                 {
                     ret[idx] *= scale;
                     scale += step;
                 }
             }
         }
-        m_len -= WIRE_BLOCK_SIZE;
-        m_position += WIRE_BLOCK_SIZE;
+        m_len -= wire;
+        m_position += wire;
         return ret;
     }
 
+    uint64_t signal_reader::skip(uint64_t blocks)
+    {
+        SF_MESG_STACK("signal_reader::skip");
+        // The upsampler keeps no state so there is nothing to bring along.
+        auto wire = wire_block_size();
+        auto count = std::min(blocks, m_len / wire);
+        m_position += count * wire;
+        m_len -= count * wire;
+        if (!m_len)
+            m_file.close();
+        return count;
+    }
+
     const char* signal_reader::name()
     {
         return "reader";
     }
 
+    uint64_t signal_reader::hash()
+    {
+        return (signal_hash{ name() } << uint64_t(m_clean_level) << m_position).input(m_file.content_hash()).value();
+    }
+
     const char* storer::name()
     {
         return "storer";
     }
 
+    uint64_t storer::hash()
+    {
+        return (signal_hash{ name() } << m_position).input(m_hash).value();
+    }
+
     void storer::inject(signal& in)
     {
         SF_MARK_STACK;
         signal_mono_base::inject(in);
-        while (auto block = in.next())
+        if (!render_cache().empty())
+            m_hash = in.hash();
+        double* batch[SF_BATCH_BLOCKS];
+        uint64_t count{ 0 };
+        do
         {
-            m_store.emplace_back(block);
-        }
+            count = in.next_n(batch);
+            m_store.insert(m_store.end(), batch, batch + count);
+        } while (count == SF_BATCH_BLOCKS);
     }
 
     double* storer::next()
@@ -249,24 +543,23 @@ namespace sonic_field
             return nullptr;
     }
 
+    void storer::sources(std::vector<signal_base*>&)
+    {
+        // Everything was pulled at inject.
+    }
+
     signal_base* storer::copy()
     {
         SF_MARK_STACK;
         if (m_position != 0)
             SF_THROW(std::logic_error{"Trying to copy a used store"});
         storer* ret = new storer();
+        ret->m_hash = m_hash;
+        // The copy shares the blocks; whoever writes to one first gets a private copy.
+        ret->m_store.reserve(m_store.size());
         for(auto b: m_store)
         {
-            if (b == empty_block())
-            {
-                ret->m_store.push_back(b);
-            }
-            else
-            {
-                auto nb = new_block();
-                memcpy(nb, b, BLOCK_SIZE*sizeof(double));
-                ret->m_store.emplace_back(nb);
-            }
+            ret->m_store.push_back(share_block(b));
         }
         return ret;
     }
@@ -276,14 +569,23 @@ namespace sonic_field
         return "leveler";
     }
 
+    uint64_t leveler::hash()
+    {
+        return (signal_hash{ name() } << m_position).input(m_hash).value();
+    }
+
     void leveler::inject(signal& in)
     {
         SF_MARK_STACK;
         signal_mono_base::inject(in);
+        if (!render_cache().empty())
+            m_hash = in.hash();
         while (auto block = in.next())
         {
             m_store.emplace_back(block);
-            for(uint64_t i{0}; i < BLOCK_SIZE; ++i)
+            if (block == empty_block())
+                continue;
+            for(uint64_t i{0}; i < block_size(); ++i)
                 m_scale = std::fmax(std::abs(block[i]), m_scale);
         }
         m_scale = 1.0 / m_scale;
@@ -294,7 +596,13 @@ namespace sonic_field
         if (m_position < m_store.size())
         {
             auto ret = m_store.at(m_position);
-            for(uint64_t i{0}; i < BLOCK_SIZE; ++i)
+            if (ret == empty_block())
+            {
+                ++m_position;
+                return ret;
+            }
+            ret = writable_block(ret);
+            for(uint64_t i{0}; i < block_size(); ++i)
                 ret[i] *= m_scale;
             ++m_position;
             return ret;
@@ -303,66 +611,187 @@ namespace sonic_field
             return nullptr;
     }
 
+    void leveler::sources(std::vector<signal_base*>&)
+    {
+        // Everything was pulled at inject.
+    }
+
     signal_base* leveler::copy()
     {
         SF_MARK_STACK;
         if (m_position != 0)
             SF_THROW(std::logic_error{"Trying to copy a used leveler"});
         leveler* ret = new leveler();
+        ret->m_store.reserve(m_store.size());
         for(auto b: m_store)
         {
-            if (b == empty_block())
-            {
-                ret->m_store.push_back(b);
-            }
-            else
-            {
-                auto nb = new_block();
-                memcpy(nb, b, BLOCK_SIZE*sizeof(double));
-                ret->m_store.emplace_back(nb);
-            }
+            ret->m_store.push_back(share_block(b));
         }
         ret->m_scale = m_scale;
+        ret->m_hash = m_hash;
         return ret;
     }
 
-    signal_writer::signal_writer(const std::string& name, bool is_runner) :
-        m_name{ work_space() + name + ".sig" },
+    signal_writer::signal_writer(const std::string& name, bool is_runner, signal_codec codec) :
+        signal_writer{ work_space() + name + ".sig", is_runner, codec, true }
+        {}
+
+    signal_writer::signal_writer(const std::string& path, bool is_runner, signal_codec codec, bool use_cache) :
+        m_name{ path },
         m_header{ 0,0,0 },
-        m_runner{is_runner}
+        m_runner{is_runner},
+        m_codec{ codec },
+        m_samples{ 0 },
+        m_chunk{},
+        m_index{},
+        m_packed{},
+        m_use_cache{ use_cache },
+        m_caching{ false },
+        m_cached{},
+        m_reserved{ 0 },
+        m_render_hash{ 0 }
         {}
 
+    signal_writer::~signal_writer()
+    {
+        // Only left over if the signal was never finished.
+        for (auto block : m_cached)
+        {
+            if (block != empty_block()) free_block(block);
+        }
+        if (m_reserved)
+            release_cache_bytes(m_reserved);
+    }
+
+    void signal_writer::write_file(const std::string& path, const std::vector<double*>& blocks, signal_codec codec)
+    {
+        SF_MARK_STACK;
+        signal_writer out{ path, false, codec, false };
+        out.open();
+        for (auto block : blocks)
+        {
+            auto done = out.write_block(share_block(block));
+            if (done != empty_block()) free_block(done);
+        }
+        out.write_block(nullptr);
+    }
+
+    void signal_writer::open()
+    {
+        // A new file rather than truncating the old one, which may be linked from the render cache.
+        std::remove(m_name.c_str());
+        m_out.reset(new async_file_writer{ m_name });
+        // Filled in by finish() once the length and index are known.
+        signal_file_header_v2 header{};
+        m_out->write(&header, sizeof(header));
+        m_chunk.reserve(SF_CHUNK_BLOCKS * wire_block_size());
+    }
+
+    // The cache has no room for the signal after all so write what is held so far to the file.
+    void signal_writer::spill()
+    {
+        SF_MARK_STACK;
+        m_caching = false;
+        open();
+        for (auto block : m_cached)
+        {
+            auto done = write_block(block);
+            if (done != empty_block()) free_block(done);
+        }
+        m_cached.clear();
+        release_cache_bytes(m_reserved);
+        m_reserved = 0;
+    }
+
     void signal_writer::inject(signal& in)
     {
         SF_MESG_STACK("signal_writer::inject");
         signal_mono_base::inject(in);
+        // Whatever was written under this name before is replaced.
+        forget_cached_signal(m_name);
+        if (m_runner && !render_cache().empty())
         {
-            SF_NO_TRACK; // Leaks bytes the first time it is called.
-            m_out = std::ofstream{ m_name,std::ios_base::binary };
-            if (!m_out)
-                SF_THROW(std::logic_error{
-                        std::string{ "In " } +name() + ": output stream is invalid: " +
-                        strerror(errno)});
+            m_render_hash = (signal_hash{ name() } << uint64_t(m_codec)).input(input().hash()).value();
+            if (fetch_rendered(m_render_hash, m_name))
+            {
+                m_render_hash = 0;
+                return;
+            }
+        }
+        // The render cache needs a file.
+        if (m_use_cache && !m_render_hash && signal_cache_bytes())
+        {
+            m_caching = true;
+            std::remove(m_name.c_str());
+        }
+        else
+        {
+            open();
         }
-        m_out.write(reinterpret_cast<char*>(&m_header), sizeof(m_header));
         if (m_runner)
         {
-            while(auto block = next())
+            double* batch[SF_BATCH_BLOCKS];
+            uint64_t count{ 0 };
+            do
             {
-                free_block(block);
-            };
+                count = input().next_n(batch);
+                for (uint64_t idx{ 0 }; idx < count; ++idx)
+                {
+                    auto block = write_block(batch[idx]);
+                    if (block != empty_block()) free_block(block);
+                }
+            } while (count == SF_BATCH_BLOCKS);
+            // Let the writer see the end of the signal so it finishes the file.
+            write_block(nullptr);
         }
     }
 
     double* signal_writer::next()
     {
         SF_MESG_STACK("signal_writer::next");
+        return write_block(input().next());
+    }
+
+    double* signal_writer::write_block(double* data)
+    {
+        if (m_caching)
+        {
+            if (!data)
+            {
+                m_caching = false;
+                m_reserved = 0;
+                std::cerr << "Caching Signal:  name: " << m_name << " blocks: " << m_cached.size() << std::endl;
+                cache_signal(m_name, std::make_shared<const cached_signal>(std::move(m_cached), m_codec));
+                m_cached.clear();
+                return data;
+            }
+            if (data == empty_block() || reserve_cache_bytes(BLOCK_SIZE * sizeof(double)))
+            {
+                if (data != empty_block())
+                    m_reserved += BLOCK_SIZE * sizeof(double);
+                m_cached.push_back(share_block(data));
+                return data;
+            }
+            spill();
+        }
+        if (data == empty_block() && m_decimate.settled())
+        {
+            // Silence leaves the header statistics alone so all there is to do is write zeros.
+            static const float zeros[WIRE_BLOCK_SIZE]{};
+            if (!m_out)
+                SF_THROW(std::logic_error{ std::string{ "In " } +name() + ": output stream is invalid" });
+            write_wire_block(zeros);
+            return data;
+        }
         return process_no_skip([&](double* block) {
+            // Asking again after the end finds the file already finished.
+            if (!m_out && !block)
+                return block;
             if (!m_out)
-                SF_THROW(std::logic_error{
-                        std::string{ "In " } +name() + ": output stream is invalid: " +
-                        strerror(errno)});
-            if (m_out.tellp() == sizeof(m_header))
+                SF_THROW(std::logic_error{ std::string{ "In " } +name() + ": output stream is invalid" });
+            // Stored at the sample rate itself there is nothing to decimate.
+            auto decimating = sample_rate() != wire_rate();
+            if (m_samples == 0 && decimating)
             {
                 // Prefeed the decimator with the first value.
                 for(uint64_t idx{ 0 }; idx < 8; ++idx)
@@ -371,30 +800,169 @@ namespace sonic_field
             if (block)
             {
                 float buff[WIRE_BLOCK_SIZE];
-                for(uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                auto size = wire_block_size();
+                for(uint64_t idx{ 0 }; idx < size; ++idx)
                 {
-                    auto v = m_decimate.decimate(block[idx], block[idx + 1]);
-                    ++idx;
+                    auto v = decimating ? m_decimate.decimate(block[2 * idx], block[2 * idx + 1]) : block[idx];
                     m_header.dc_offset += v;
                     if (v < m_header.peak_negative)
                         m_header.peak_negative = v;
                     else if (v > m_header.peak_positive)
                         m_header.peak_positive = v;
-                    buff[idx>>1] = v;
+                    buff[idx] = v;
                 }
-                m_out.write(reinterpret_cast<char*>(buff), sizeof(buff));
+                write_wire_block(buff);
             }
             else
             {
-                m_header.dc_offset /= (uint64_t(m_out.tellp()) - sizeof(m_header)) / sizeof(float);
-                m_out.seekp(0);
-                m_out.write(reinterpret_cast<char*>(&m_header), sizeof(m_header));
-                std::cerr << "Writing Signal:  name: " << m_name << " dc: " << m_header.dc_offset << " peak neg: "
-                    << m_header.peak_negative << " peak pos: " << m_header.peak_positive << std::endl;
-                m_out.close();
+                finish();
             }
             return block;
-            }, input().next());
+            }, data);
+    }
+
+    void signal_writer::write_wire_block(const float* data)
+    {
+        auto size = wire_block_size();
+        m_chunk.insert(m_chunk.end(), data, data + size);
+        m_samples += size;
+        if (m_chunk.size() == SF_CHUNK_BLOCKS * size)
+            flush_chunk();
+    }
+
+    // Write out the chunk being filled and note where it went, with its levels, in the index.
+    void signal_writer::flush_chunk()
+    {
+        if (m_chunk.empty())
+            return;
+        signal_chunk entry{ m_out->position(), 0, 0, 0, 0, 0, 0 };
+        double sum{ 0 };
+        double squares{ 0 };
+        bool silent{ true };
+        for (auto v : m_chunk)
+        {
+            // Bitwise so a negative zero is kept.
+            uint32_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            silent &= !bits;
+            entry.peak_negative = std::min(entry.peak_negative, v);
+            entry.peak_positive = std::max(entry.peak_positive, v);
+            sum += v;
+            squares += double(v) * v;
+        }
+        entry.dc_offset = float(sum / m_chunk.size());
+        entry.rms = float(std::sqrt(squares / m_chunk.size()));
+        if (silent)
+        {
+            // All zeros, so nothing needs storing.
+            entry.flags |= SF_CHUNK_SILENT;
+        }
+        else
+        {
+            if (m_codec == signal_codec::PACKED)
+                pack_chunk(m_chunk, m_packed);
+            if (m_codec == signal_codec::PACKED && m_packed.size() < m_chunk.size() * sizeof(float))
+            {
+                entry.flags |= SF_CHUNK_PACKED;
+                entry.bytes = uint32_t(m_packed.size());
+                m_out->write(m_packed.data(), entry.bytes);
+                // Packed chunks are any length, so pad to keep the raw chunks after them aligned.
+                static const char padding[sizeof(float)]{};
+                auto misaligned = entry.bytes % sizeof(padding);
+                if (misaligned)
+                    m_out->write(padding, sizeof(padding) - misaligned);
+            }
+            else
+            {
+                entry.bytes = uint32_t(m_chunk.size() * sizeof(float));
+                m_out->write(m_chunk.data(), entry.bytes);
+            }
+        }
+        m_index.push_back(entry);
+        m_chunk.clear();
+    }
+
+    void signal_writer::finish()
+    {
+        SF_MARK_STACK;
+        flush_chunk();
+        // Keep the index aligned for readers using it straight from a mapping.
+        static const char padding[sizeof(uint64_t)]{};
+        auto misaligned = m_out->position() % sizeof(padding);
+        if (misaligned)
+            m_out->write(padding, sizeof(padding) - misaligned);
+        if (m_samples)
+            m_header.dc_offset /= m_samples;
+
+        signal_file_header_v2 header{};
+        memcpy(header.magic, SF_SIGNAL_MAGIC, sizeof(header.magic));
+        header.version = SF_SIGNAL_VERSION;
+        header.sample_rate = uint32_t(wire_rate());
+        header.chunk_samples = uint32_t(SF_CHUNK_BLOCKS * wire_block_size());
+        header.samples = m_samples;
+        header.index_offset = m_out->position();
+        header.chunks = m_index.size();
+        header.levels = m_header;
+        m_out->write(m_index.data(), m_index.size() * sizeof(signal_chunk));
+        m_out->write_at(0, &header, sizeof(header));
+        std::cerr << "Writing Signal:  name: " << m_name << " dc: " << m_header.dc_offset << " peak neg: "
+            << m_header.peak_negative << " peak pos: " << m_header.peak_positive << std::endl;
+        m_out->close();
+        m_out.reset();
+        m_index.clear();
+        store_rendered(m_render_hash, m_name);
+    }
+
+    cache_reader::cache_reader(std::shared_ptr<const cached_signal> signal) :
+        m_signal{ signal },
+        m_scale{ signal->m_peak > 0.0 ? 1.0 / signal->m_peak : 1.0 },
+        m_position{ 0 }
+    {}
+
+    double* cache_reader::next()
+    {
+        SF_MESG_STACK("cache_reader::next");
+        if (m_position == m_signal->m_blocks.size())
+            return nullptr;
+        auto block = m_signal->m_blocks[m_position++];
+        if (block == empty_block())
+            return block;
+        double value;
+        if (is_constant_block(block, value))
+            return new_constant_block(value * m_scale);
+        auto ret = new_block(false);
+        for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+            ret[idx] = block[idx] * m_scale;
+        return ret;
+    }
+
+    uint64_t cache_reader::skip(uint64_t blocks)
+    {
+        auto count = std::min(blocks, uint64_t(m_signal->m_blocks.size() - m_position));
+        m_position += count;
+        return count;
+    }
+
+    const char* cache_reader::name()
+    {
+        return "cache_reader";
+    }
+
+    uint64_t cache_reader::hash()
+    {
+        signal_hash ret{ name() };
+        ret << m_position;
+        for (auto block : m_signal->m_blocks)
+        {
+            if (block == empty_block())
+            {
+                ret << uint64_t(0);
+                continue;
+            }
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+                ret << block[idx];
+        }
+        return ret.value();
     }
 
     const char* signal_writer::name()
@@ -405,10 +973,16 @@ namespace sonic_field
     void runner::inject(signal& in)
     {
         signal_mono_base::inject(in);
-        while (auto block = in.next())
+        double* batch[SF_BATCH_BLOCKS];
+        uint64_t count{ 0 };
+        do
         {
-            process([](double* data) {free_block(data); return nullptr; }, block);
-        }
+            count = in.next_n(batch);
+            for (uint64_t idx{ 0 }; idx < count; ++idx)
+            {
+                if (batch[idx] != empty_block()) free_block(batch[idx]);
+            }
+        } while (count == SF_BATCH_BLOCKS);
     }
 
     const char* runner::name()
@@ -424,10 +998,12 @@ namespace sonic_field
 
     noise_generator::noise_generator(uint64_t len)
     {
+        static std::atomic<uint64_t> made{ 0 };
         timespec ts;
         timespec_get(&ts, TIME_UTC);
         m_state = ts.tv_nsec ^ uint32_t(ts.tv_sec);
         m_len = len;
+        m_ordinal = made.fetch_add(1);
     }
 
     signal_base* noise_generator::copy()
@@ -458,7 +1034,7 @@ namespace sonic_field
         }
         --m_len;
         auto ret = new_block(false);
-        for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+        for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
         {
             ret[idx] = next_rand();
         }
@@ -470,6 +1046,11 @@ namespace sonic_field
         return "noise_generator";
     }
 
+    uint64_t noise_generator::hash()
+    {
+        return (signal_hash{ name() } << m_len << m_ordinal).value();
+    }
+
     random_doubles::random_doubles()
     {
         timespec ts;
@@ -511,6 +1092,11 @@ namespace sonic_field
         return "silence_generator";
     }
 
+    uint64_t silence_generator::hash()
+    {
+        return (signal_hash{ name() } << m_len).value();
+    }
+
     linear_generator::linear_generator(const envelope& in):
         m_points{ in },
         m_position{ 0 },
@@ -541,15 +1127,24 @@ namespace sonic_field
         double* data = new_block(false);
         auto frst_pos = m_points[m_point];
         auto scnd_pos = m_points[m_point + 1];
-        auto frst_at = frst_pos.position() * BLOCK_SIZE;
-        auto scnd_at = scnd_pos.position() * BLOCK_SIZE;
+        auto frst_at = frst_pos.position() * block_size();
+        auto scnd_at = scnd_pos.position() * block_size();
         auto len = scnd_at - frst_at;
-        for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+        if (frst_pos.amplitude() == scnd_pos.amplitude())
         {
-            auto offset = m_position - frst_at;
-            double rto = double(offset) / double(len);
-            data[idx] = frst_pos.amplitude() * (1.0 - rto) + scnd_pos.amplitude() * rto;
-            ++m_position;
+            // Flat segments are constant blocks (not empty ones as these often drive controls).
+            fill_constant_block(data, frst_pos.amplitude());
+            m_position += block_size();
+        }
+        else
+        {
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+            {
+                auto offset = m_position - frst_at;
+                double rto = double(offset) / double(len);
+                data[idx] = frst_pos.amplitude() * (1.0 - rto) + scnd_pos.amplitude() * rto;
+                ++m_position;
+            }
         }
         // This can only happen at the end of a block because the minimum envelope point spacing is 1ms
         // which is the size of a block.
@@ -563,18 +1158,27 @@ namespace sonic_field
         return "linear_generator";
     }
 
+    uint64_t linear_generator::hash()
+    {
+        signal_hash ret{ name() };
+        ret << m_position << m_point;
+        for (const auto& point : m_points)
+            ret << point.position() << point.amplitude();
+        return ret.value();
+    }
+
     gain_controller::gain_controller(double attack, double release) :
         m_scale{ 1 },
-        m_attack{ 1.0 + attack / BLOCK_SIZE },
-        m_release{ 1.0 + release / BLOCK_SIZE },
+        m_attack{ 1.0 + attack / block_size() },
+        m_release{ 1.0 + release / block_size() },
         m_arg_attack{ attack },
         m_arg_release{ release }
     {}
 
     gain_controller::gain_controller(double scale, double attack, double release) :
         m_scale{ scale },
-        m_attack{ 1.0 + attack / BLOCK_SIZE },
-        m_release{ 1.0 + release / BLOCK_SIZE },
+        m_attack{ 1.0 + attack / block_size() },
+        m_release{ 1.0 + release / block_size() },
         m_arg_attack{ attack },
         m_arg_release{ release }
     {}
@@ -588,10 +1192,20 @@ namespace sonic_field
     double* gain_controller::next()
     {
         SF_MARK_STACK;
+        auto data = input().next();
+        if (data == empty_block())
+        {
+            // Silence only ever releases.
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+            {
+                m_scale /= m_release;
+            }
+            return data;
+        }
         return process_no_skip([&](double* block) {
             if (block)
             {
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     auto v = block[idx] / m_scale;
                     auto m = std::abs(v);
@@ -615,7 +1229,7 @@ namespace sonic_field
                 }
             }
             return block;
-            }, input().next());
+            }, data);
     }
 
     const char* gain_controller::name()
@@ -623,10 +1237,16 @@ namespace sonic_field
         return "gain_controller";
     }
 
+    uint64_t gain_controller::hash()
+    {
+        return (signal_hash{ name() } << m_scale << m_attack << m_release).inputs(m_inputs).value();
+    }
+
     repeater::repeater(uint64_t count, std::vector<signal>& chain) : m_chain{}
     {
         m_chain = chain;
-        while (count > 1)
+        // A preview makes one pass; each pass is a copy of the same chain so the rest add only depth.
+        while (count > 1 && !preview())
         {
             --count;
             for (auto& sig : chain)
@@ -659,11 +1279,28 @@ namespace sonic_field
         return m_chain.back().next();
     }
 
+    uint64_t repeater::next_n(std::span<double*> into)
+    {
+        SF_MESG_STACK("repeater::next_n");
+        return m_chain.back().next_n(into);
+    }
+
+    void repeater::sources(std::vector<signal_base*>& into)
+    {
+        into.push_back(m_chain.back().get());
+    }
+
     const char* repeater::name()
     {
         return "repeater";
     }
 
+    uint64_t repeater::hash()
+    {
+        // The chain is fed from the input so its end covers everything.
+        return m_chain.empty() ? 0 : (signal_hash{ name() }.input(m_chain.back().hash())).value();
+    }
+
     signal_base* repeater::copy()
     {
         SF_MARK_STACK;
@@ -671,7 +1308,94 @@ namespace sonic_field
         return new repeater{ 1, new_chain };
     }
 
-    mixer::mixer(mixer_type mode) : m_mode{ mode } {}
+    mixer::mixer(mixer_type mode) :
+        m_mode{ mode },
+        m_ahead{},
+        m_analysed{ false },
+        m_parallel{ false }
+    {}
+
+    mixer::~mixer()
+    {
+        for (auto& ahead : m_ahead)
+        {
+            for (auto block : ahead)
+            {
+                if (block && block != empty_block()) free_block(block);
+            }
+        }
+    }
+
+    // True when nothing upstream of the mixer can be reached from more than one of its inputs, so
+    // each input can be pulled on its own thread without changing what any node computes.
+    static bool independent_branches(signal_base* from)
+    {
+        SF_MARK_STACK;
+        std::unordered_map<signal_base*, uint64_t> owner{};
+        for (uint64_t idx{ 0 }; idx < from->input_count(); ++idx)
+        {
+            std::vector<signal_base*> todo{ from->input(idx).get() };
+            while (!todo.empty())
+            {
+                auto node = todo.back();
+                todo.pop_back();
+                if (!node) continue;
+                if (node == from) return false;
+                auto found = owner.find(node);
+                if (found != owner.end())
+                {
+                    if (found->second != idx) return false;
+                    continue;
+                }
+                owner[node] = idx;
+                node->sources(todo);
+            }
+        }
+        return true;
+    }
+
+    double* mixer::pull(uint64_t idx)
+    {
+        if (!m_analysed)
+        {
+            m_analysed = true;
+            m_parallel = render_threads() > 1 && input_count() > 1 && independent_branches(this);
+            m_ahead.resize(input_count());
+        }
+        if (!m_parallel)
+            return input(idx).next();
+        auto& ahead = m_ahead[idx];
+        if (ahead.empty())
+            pull_ahead();
+        auto block = ahead.front();
+        // An ended input keeps its nullptr so it is never pulled again.
+        if (block)
+            ahead.pop_front();
+        return block;
+    }
+
+    // Refill every drained input at once, each on its own task, so the branches render in parallel
+    // a batch of blocks at a time. Each branch still sees exactly the serial sequence of pulls.
+    void mixer::pull_ahead()
+    {
+        SF_MARK_STACK;
+        std::vector<std::function<void()>> tasks{};
+        for (uint64_t idx{ 0 }; idx < input_count(); ++idx)
+        {
+            if (!m_ahead[idx].empty()) continue;
+            tasks.emplace_back(in_current_scope([this, idx]
+            {
+                SF_MESG_STACK("mixer::pull_ahead");
+                double* batch[SF_PULL_AHEAD_BLOCKS];
+                auto count = input(idx).next_n(batch);
+                auto& ahead = m_ahead[idx];
+                ahead.insert(ahead.end(), batch, batch + count);
+                if (count < SF_PULL_AHEAD_BLOCKS)
+                    ahead.push_back(nullptr);
+            }));
+        }
+        run_parallel(tasks);
+    }
 
     double* mixer::mix_with()
     {
@@ -679,45 +1403,84 @@ namespace sonic_field
         auto cnt = input_count();
         if (cnt == 0)
             SF_THROW(std::logic_error{ "Cannot use a mixer with no inputs" });
-        auto into = input().next();
+        auto into = pull(0);
         if (!into)
         {
             for (decltype(cnt)idx{ 1 }; idx < cnt; ++idx)
             {
-                if (input(idx).next()) SF_THROW(std::logic_error{ "Not all mixing inputs same length" });
+                if (pull(idx)) SF_THROW(std::logic_error{ "Not all mixing inputs same length" });
             }
             return nullptr;
         }
-        if (into == empty_block())into = new_block();
+        // Silence is carried through as the empty block, and constant inputs as constant blocks,
+        // so padding and flat envelopes cost next to nothing.
+        double into_value{ 0 };
+        bool into_constant = is_constant_block(into, into_value);
         for (decltype(cnt)idx{ 1 }; idx < cnt; ++idx)
         {
-            auto from = input(idx).next();
+            auto from = pull(idx);
             if (from == empty_block()) continue;
             if (!from)
             {
                 switch (m_mode)
                 {
                 case mixer_type::OVERLAY:
-                    from = new_block();
-                    break;
+                    continue;
                 default:
                     SF_THROW(std::logic_error{ "Not all mixing inputs same length" });
                 }
             }
+            if (into == empty_block())
+            {
+                if (m_mode == mixer_type::MULTIPLY)
+                {
+                    free_block(from);
+                }
+                else
+                {
+                    into = from;
+                    into_constant = is_constant_block(into, into_value);
+                }
+                continue;
+            }
+            double from_value{ 0 };
+            bool constant = into_constant && is_constant_block(from, from_value);
+            into = writable_block(into);
             switch (m_mode)
             {
             case mixer_type::ADD:
             case mixer_type::OVERLAY:
-                for (uint64_t jdx{ 0 }; jdx < BLOCK_SIZE; ++jdx)
-                    into[jdx] += from[jdx];
+                if (constant)
+                {
+                    into_value += from_value;
+                    fill_constant_block(into, into_value);
+                }
+                else
+                {
+                    with_block_size([&](auto size) {
+                        for (uint64_t jdx{ 0 }; jdx < size; ++jdx)
+                            into[jdx] += from[jdx];
+                        });
+                }
                 break;
             case mixer_type::MULTIPLY:
-                for (uint64_t jdx{ 0 }; jdx < BLOCK_SIZE; ++jdx)
-                    into[jdx] *= from[jdx];
+                if (constant)
+                {
+                    into_value *= from_value;
+                    fill_constant_block(into, into_value);
+                }
+                else
+                {
+                    with_block_size([&](auto size) {
+                        for (uint64_t jdx{ 0 }; jdx < size; ++jdx)
+                            into[jdx] *= from[jdx];
+                        });
+                }
                 break;
             default:
                 SF_THROW(std::invalid_argument{ "Invalid mixer type: " + std::to_string(uint64_t(m_mode)) });
             }
+            into_constant = constant;
             free_block(from);
         }
         return into;
@@ -757,27 +1520,46 @@ namespace sonic_field
         return "mixer";
     }
 
+    uint64_t mixer::hash()
+    {
+        return (signal_hash{ name() } << uint64_t(m_mode)).inputs(m_inputs).value();
+    }
+
     seeder::seeder(double pitch, double amplitude, double phase) :
         m_pitch{ pitch },
         m_amplitude{ amplitude },
         m_phase{ phase },
-        m_position{ uint64_t(SAMPLES_PER_SECOND * phase) }
+        m_position{ uint64_t(sample_rate() * phase) }
     {}
 
-    double* seeder::next()
+    double* seeder::seed_block(double* data)
     {
-        SF_MARK_STACK;
         return process_no_skip([&](double* block) {
             if (block)
             {
-                double rate = 2 * PI * m_pitch / SAMPLES_PER_SECOND;
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                double rate = 2 * PI * m_pitch / sample_rate();
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     block[idx] += fast_cos(m_position++ * rate) * m_amplitude;
                 }
             }
             return block;
-            }, input().next());
+            }, data);
+    }
+
+    double* seeder::next()
+    {
+        SF_MARK_STACK;
+        return seed_block(input().next());
+    }
+
+    uint64_t seeder::next_n(std::span<double*> into)
+    {
+        SF_MARK_STACK;
+        auto count = input().next_n(into);
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+            into[idx] = seed_block(into[idx]);
+        return count;
     }
 
     const char* seeder::name()
@@ -785,6 +1567,11 @@ namespace sonic_field
         return "seeder";
     }
 
+    uint64_t seeder::hash()
+    {
+        return (signal_hash{ name() } << m_pitch << m_amplitude << m_phase << m_position).inputs(m_inputs).value();
+    }
+
     signal_base* seeder::copy()
     {
         SF_MARK_STACK;
@@ -798,10 +1585,14 @@ namespace sonic_field
     double* power::next()
     {
         SF_MARK_STACK;
+        auto data = input().next();
+        double v;
+        if (data && data != empty_block() && is_constant_block(data, v))
+            return fill_constant_block(writable_block(data), v < 0.0 ? -std::pow(-v, m_factor) : std::pow(v, m_factor));
         return process([&](double* block) {
             if (block)
             {
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     auto v = block[idx];
                     if (v < 0.0)
@@ -811,7 +1602,7 @@ namespace sonic_field
                 }
             }
             return block;
-            }, input().next());
+            }, data);
     }
 
     const char* power::name()
@@ -819,6 +1610,11 @@ namespace sonic_field
         return "power";
     }
 
+    uint64_t power::hash()
+    {
+        return (signal_hash{ name() } << m_factor).inputs(m_inputs).value();
+    }
+
     signal_base* power::copy()
     {
         SF_MARK_STACK;
@@ -832,10 +1628,14 @@ namespace sonic_field
     double* saturater::next()
     {
         SF_MARK_STACK;
+        auto data = input().next();
+        double v;
+        if (data && data != empty_block() && is_constant_block(data, v))
+            return fill_constant_block(writable_block(data), v < 0.0 ? v / (m_factor - v) : v / (v + m_factor));
         return process([&](double* block) {
             if (block)
             {
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     auto v = block[idx];
                     if (v < 0.0)
@@ -845,7 +1645,7 @@ namespace sonic_field
                 }
             }
             return block;
-            }, input().next());
+            }, data);
     }
 
     const char* saturater::name()
@@ -853,6 +1653,11 @@ namespace sonic_field
         return "saturate";
     }
 
+    uint64_t saturater::hash()
+    {
+        return (signal_hash{ name() } << m_factor).inputs(m_inputs).value();
+    }
+
     signal_base* saturater::copy()
     {
         SF_MARK_STACK;
@@ -863,19 +1668,36 @@ namespace sonic_field
         m_factor{ factor }
     {}
 
-    double* amplifier::next()
+    double* amplifier::amplify_block(double* data)
     {
-        SF_MARK_STACK;
+        double v;
+        if (data && data != empty_block() && is_constant_block(data, v))
+            return fill_constant_block(writable_block(data), v * m_factor);
         return process([&](double* block) {
             if (block)
             {
-                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
                 {
                     block[idx] *= m_factor;
                 }
             }
             return block;
-            }, input().next());
+            }, data);
+    }
+
+    double* amplifier::next()
+    {
+        SF_MARK_STACK;
+        return amplify_block(input().next());
+    }
+
+    uint64_t amplifier::next_n(std::span<double*> into)
+    {
+        SF_MARK_STACK;
+        auto count = input().next_n(into);
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+            into[idx] = amplify_block(into[idx]);
+        return count;
     }
 
     const char* amplifier::name()
@@ -883,6 +1705,11 @@ namespace sonic_field
         return "amplifier";
     }
 
+    uint64_t amplifier::hash()
+    {
+        return (signal_hash{ name() } << m_factor).inputs(m_inputs).value();
+    }
+
     signal_base* amplifier::copy()
     {
         SF_MARK_STACK;
@@ -902,11 +1729,27 @@ namespace sonic_field
         return m_back.next();
     }
 
+    uint64_t wrapper::next_n(std::span<double*> into)
+    {
+        SF_MARK_STACK;
+        return m_back.next_n(into);
+    }
+
+    void wrapper::sources(std::vector<signal_base*>& into)
+    {
+        into.push_back(m_back.get());
+    }
+
     const char* wrapper::name()
     {
         return "wrapper";
     }
 
+    uint64_t wrapper::hash()
+    {
+        return signal_hash{ name() }.input(m_back.hash()).value();
+    }
+
     signal_base* wrapper::copy()
     {
         SF_MARK_STACK;
@@ -930,18 +1773,14 @@ namespace sonic_field
             --m_pad_before;
             return empty_block();
         }
-        while (m_position < m_from)
+        if (m_position < m_from)
         {
-            auto block = input().next();
-            if (block != empty_block()) free_block(block);
-            ++m_position;
+            input().skip(m_from - m_position);
+            m_position = m_from;
         }
         if (!m_done && m_position >= m_to)
         {
-            while (auto block = input().next())
-            {
-                if (block != empty_block()) free_block(block);
-            }
+            input().skip(std::numeric_limits<uint64_t>::max());
             m_done = true;
         }
         if (m_done && m_pad_after)
@@ -966,6 +1805,12 @@ namespace sonic_field
         return "cutter";
     }
 
+    uint64_t cutter::hash()
+    {
+        return (signal_hash{ name() } << m_pad_before << m_from << m_to << m_pad_after << m_position
+            << uint64_t(m_done)).inputs(m_inputs).value();
+    }
+
     signal_base* cutter::copy()
     {
         SF_MARK_STACK;
@@ -981,15 +1826,15 @@ namespace sonic_field
 
     double* sweeper::next()
     {
-        uint64_t length = m_length * BLOCK_SIZE;
+        uint64_t length = m_length * block_size();
         if (m_position > length) return nullptr;
         double* data = new_block();
         double corrected_end = m_start_frequency + (m_end_frequency - m_start_frequency) / 2.0;
-        for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+        for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
         {
             double ratio = double(length - m_position) / double(length);
             double f = m_start_frequency * ratio + corrected_end * (1.0-ratio);
-            data[idx] = sin(f * m_position * ANGLE_RATE);
+            data[idx] = sin(f * m_position * angle_rate());
             ++m_position;
         }
         return data;
@@ -1000,6 +1845,11 @@ namespace sonic_field
         return "sweeper";
     }
 
+    uint64_t sweeper::hash()
+    {
+        return (signal_hash{ name() } << m_start_frequency << m_end_frequency << m_length << m_position).value();
+    }
+
     signal_base* sweeper::copy()
     {
         return new sweeper{ m_start_frequency, m_end_frequency, m_length };
@@ -1015,7 +1865,7 @@ namespace sonic_field
         {
             m_pitches.push_back(p);
         }
-        double nsamples = m_cycle_length * SAMPLES_PER_SECOND * 1000;
+        double nsamples = m_cycle_length * sample_rate() * 1000;
         m_step = pow(2, 1.0/nsamples);
         if (m_start_frequency > m_end_frequency)
             m_step = 1.0 / m_step;
@@ -1026,15 +1876,15 @@ namespace sonic_field
         if (m_length == 0)
             return nullptr;
         auto data = new_block();
-        auto start = m_length * BLOCK_SIZE;
-        for(uint64_t i{0}; i<BLOCK_SIZE; ++i)
+        auto start = m_length * block_size();
+        for(uint64_t i{0}; i<block_size(); ++i)
         {
             double datum{0};
             double harmonic_multiplier{1};
             for(uint64_t j{0}; j<m_pitches.size(); ++j)
             {
                 auto p = m_pitches[j];
-                auto val = p * (start - j) * ANGLE_RATE;
+                auto val = p * (start - j) * angle_rate();
                 auto p_start = m_start_frequency * harmonic_multiplier;
                 auto p_end = m_end_frequency * harmonic_multiplier;
                 auto p_diff = std::abs(p_start * p_end);
@@ -1070,6 +1920,15 @@ namespace sonic_field
         return "shepard";
     }
 
+    uint64_t shepard::hash()
+    {
+        signal_hash ret{ name() };
+        ret << m_start_frequency << m_end_frequency << m_length << m_cycle_length << m_step;
+        for (auto pitch : m_pitches)
+            ret << pitch;
+        return ret.value();
+    }
+
     signal_base* shepard::copy()
     {
         return new shepard{ m_start_frequency, m_end_frequency, m_cycle_length, m_length };
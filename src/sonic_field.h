@@ -18,6 +18,7 @@
 
 #include <cstdint>
 #include <cmath>
+#include <cstring>
 #include <string>
 #include <functional>
 #include <utility>
@@ -28,14 +29,28 @@
 #include <time.h>
 #include <limits>
 #include <tuple>
+#include <deque>
+#include <span>
 
 #include "memory_manager.h"
+#include "executor.h"
+#include "io_support.h"
+#include "signal_cache.h"
 
 namespace sonic_field
 {
     constexpr double PI = 3.1415926535897932384626433832795;
-    constexpr double MAX_FREQUENCY = double(SAMPLES_PER_SECOND >> 2);
-    constexpr double ANGLE_RATE = 2.0 * PI / SAMPLES_PER_SECOND;
+
+    // Radians per sample per Hz at the current sample rate.
+    inline double angle_rate()
+    {
+        return 2.0 * PI / sample_rate();
+    }
+    // Filter state below this (about -300db) is treated as silence so silent input can be
+    // propagated as the empty block rather than computed.
+    constexpr double SF_SILENCE_THRESHOLD = 1.0e-15;
+    // Blocks asked for at a time by consumers which drain a whole signal.
+    constexpr uint64_t SF_BATCH_BLOCKS = 32;
 
 
     void set_work_space(const std::string&);
@@ -47,6 +62,69 @@ namespace sonic_field
     std::string temp_file_name();
     void delete_sig_file(const std::string& name);
 
+    // Identifies what a processor will produce, for the render cache: its type, its parameters and
+    // state, and the hashes of its inputs. Zero means it cannot be cached, and a hash built from
+    // any input which cannot be cached is zero too.
+    class signal_hash
+    {
+        uint64_t m_value;
+
+        void add(uint64_t v)
+        {
+            if (!m_value) return;
+            // splitmix64 finaliser.
+            auto x = m_value ^ (v + 0x9e3779b97f4a7c15ull + (m_value << 6));
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            x ^= x >> 31;
+            m_value = x ? x : 1;
+        }
+
+    public:
+        explicit signal_hash(const char* type) : m_value{ 0xcbf29ce484222325ull }
+        {
+            for (; *type; ++type)
+                m_value = (m_value ^ uint8_t(*type)) * 0x100000001b3ull;
+        }
+
+        signal_hash& operator<<(uint64_t v)
+        {
+            add(v);
+            return *this;
+        }
+
+        signal_hash& operator<<(double v)
+        {
+            uint64_t bits;
+            memcpy(&bits, &v, sizeof(bits));
+            add(bits);
+            return *this;
+        }
+
+        // The hash of something feeding in.
+        signal_hash& input(uint64_t hash)
+        {
+            if (!hash)
+                m_value = 0;
+            add(hash);
+            return *this;
+        }
+
+        template<class C>
+        signal_hash& inputs(std::vector<C>& from)
+        {
+            add(from.size());
+            for (auto& in : from)
+                input(in.hash());
+            return *this;
+        }
+
+        uint64_t value() const
+        {
+            return m_value;
+        }
+    };
+
     template<class C>
     class signal_impl
     {
@@ -59,10 +137,26 @@ namespace sonic_field
             return nullptr;
         }
 
+        // Fill as much of the span as possible with the next blocks, returning how many were
+        // filled; fewer than asked for means the signal has ended. Overriding this lets a
+        // processor work through a run of blocks per virtual call rather than one.
+        virtual uint64_t next_n(std::span<double*> into)
+        {
+            uint64_t count{ 0 };
+            while (count < into.size())
+            {
+                auto block = next();
+                if (!block) break;
+                into[count++] = block;
+            }
+            return count;
+        }
+
+        // The lambdas may write into the block so they are given a writable (unshared) one.
         template<typename L>
         double* process(const L& lambda, double* data)
         {
-            return data == empty_block()? data: lambda(data);
+            return data == empty_block()? data: lambda(writable_block(data));
         }
 
         template<typename L>
@@ -75,7 +169,7 @@ namespace sonic_field
             }
             else
             {
-                return lambda(data);;
+                return lambda(writable_block(data));
             }
         }
 
@@ -110,6 +204,35 @@ namespace sonic_field
             return m_inputs.size();
         }
 
+        // Throw away the next blocks, returning how many there were. Sources which can seek
+        // override this to move on without computing what is skipped.
+        virtual uint64_t skip(uint64_t blocks)
+        {
+            uint64_t count{ 0 };
+            while (count < blocks)
+            {
+                auto block = next();
+                if (!block) break;
+                if (block != empty_block()) free_block(block);
+                ++count;
+            }
+            return count;
+        }
+
+        // See signal_hash. Processors which do not override this cannot be cached.
+        virtual uint64_t hash()
+        {
+            return 0;
+        }
+
+        // Everything pulled from when next() is called; the executor uses this to find branches of
+        // the graph which share nothing and so can be rendered on different threads.
+        virtual void sources(std::vector<signal_impl*>& into)
+        {
+            for (auto& in : m_inputs)
+                into.push_back(in.get());
+        }
+
         virtual signal_impl* copy()
         {
             SF_MARK_STACK;
@@ -161,6 +284,26 @@ namespace sonic_field
             return m_signal->next();
         }
 
+        uint64_t next_n(std::span<double*> into)
+        {
+            return m_signal->next_n(into);
+        }
+
+        uint64_t skip(uint64_t blocks)
+        {
+            return m_signal->skip(blocks);
+        }
+
+        uint64_t hash()
+        {
+            return m_signal->hash();
+        }
+
+        wrapped_type* get()
+        {
+            return m_signal;
+        }
+
         void clear()
         {
             if (!m_signal) return;
@@ -244,6 +387,10 @@ namespace sonic_field
 
     signal& add_to_scope(signal sig);
 
+    // Wraps a task for run_parallel so the signals it makes, on whichever thread, go into the
+    // scope current here. The scope must outlast the task.
+    std::function<void()> in_current_scope(std::function<void()> task);
+
     // Utilities
     // =========
     template<class L>
@@ -262,6 +409,8 @@ namespace sonic_field
     }
 
     void signal_to_wav(const std::string&);
+    // The wav file signal_to_wav and write_wav make for a name; previews have their own.
+    std::string output_wav_path(const std::string& name);
 
     class wav_file_reader;
     class wav_reader : public signal_generator_base
@@ -303,8 +452,161 @@ namespace sonic_field
         float peak_negative;
         float peak_positive;
     };
+
+    // Version 1 .sig files are a signal_file_header and then the samples. Version 2 files start with
+    // this instead; the samples follow in chunks of whole blocks and an index of the chunks, with
+    // statistics for each, comes last so readers can seek to any block and skip silence.
+    struct signal_file_header_v2
+    {
+        char magic[4];
+        uint32_t version;
+        // Of the samples in the file (the wire rate).
+        uint32_t sample_rate;
+        uint32_t chunk_samples;
+        uint64_t samples;
+        uint64_t index_offset;
+        uint64_t chunks;
+        // Over the whole signal, as in version 1.
+        signal_file_header levels;
+        uint32_t reserved;
+    };
+
+    struct signal_chunk
+    {
+        uint64_t offset;
+        uint32_t bytes;
+        uint32_t flags;
+        float peak_negative;
+        float peak_positive;
+        float rms;
+        float dc_offset;
+    };
     #pragma pack(pop)
 
+    constexpr char SF_SIGNAL_MAGIC[4]{ 'S', 'F', 'S', '2' };
+    constexpr uint32_t SF_SIGNAL_VERSION = 2;
+    // A quarter of a second per chunk.
+    constexpr uint64_t SF_CHUNK_BLOCKS = 256;
+    // The chunk is all exact zeros and nothing of it is stored.
+    constexpr uint32_t SF_CHUNK_SILENT = 1;
+    // The chunk is stored with the signal_codec::PACKED coding.
+    constexpr uint32_t SF_CHUNK_PACKED = 2;
+
+    // How a signal_writer stores its chunks.
+    enum class signal_codec
+    {
+        // Plain floats.
+        RAW,
+        // Lossless: each sample is predicted from the two before it and only the bytes of the
+        // difference which are needed are stored. Chunks which would not get smaller stay raw.
+        PACKED
+    };
+
+    // Reads .sig files of either version, giving the samples at the wire rate a block at a time.
+    class signal_file
+    {
+        std::shared_ptr<const mapped_file> m_map;
+        signal_file_header m_levels;
+        uint64_t m_rate;
+        uint64_t m_block_samples;
+        uint64_t m_samples;
+        uint64_t m_chunk_samples;
+        // Version 1 files: all the samples.
+        const float* m_data;
+        // Version 2 files.
+        const signal_chunk* m_chunks;
+        uint64_t m_chunk_count;
+        // The last packed chunk read, unpacked.
+        std::vector<float> m_unpacked;
+        uint64_t m_unpacked_chunk;
+        uint64_t m_content_hash;
+
+    public:
+        explicit signal_file(const std::string& path);
+
+        const signal_file_header& levels() const
+        {
+            return m_levels;
+        }
+
+        // Of the samples; version 1 files are all at 64 kHz.
+        uint64_t rate() const
+        {
+            return m_rate;
+        }
+
+        // Samples per block, a millisecond of them.
+        uint64_t block_samples() const
+        {
+            return m_block_samples;
+        }
+
+        // Samples in the file.
+        uint64_t samples() const
+        {
+            return m_samples;
+        }
+
+        // The block_samples() samples starting at position (a multiple of block_samples()) or
+        // nullptr if they are known to be silent.
+        const float* wire_block(uint64_t position);
+
+        // Drop the file; nothing may be read after this.
+        void close();
+
+        // A hash of everything in the file, for signal_hash.
+        uint64_t content_hash();
+    };
+
+    // How many input samples either side resampling interpolates each output from: 8, 16 or 32.
+    // More keeps more of the top of the band and lets less alias through, for more work.
+    enum class resample_quality
+    {
+        FAST,
+        GOOD,
+        BEST
+    };
+    constexpr uint64_t SF_MAX_RESAMPLE_TAPS = 32;
+
+    // Doubles the rate of a run of samples with a zero phase half band FIR (a Kaiser windowed
+    // sinc). Even outputs are the inputs themselves and odd ones are interpolated from taps()
+    // inputs either side, so there is no state: the caller provides the context around the run.
+    class half_band_upsampler
+    {
+        // For the inputs 1/2, 3/2, 5/2 ... samples away from the odd output.
+        std::vector<double> m_coefficients;
+
+    public:
+        explicit half_band_upsampler(resample_quality);
+
+        uint64_t taps() const
+        {
+            return m_coefficients.size();
+        }
+
+        // Writes 2 * count samples to out, reading in[1 - taps()] to in[count + taps() - 1].
+        void upsample(const double* in, double* out, uint64_t count) const;
+    };
+
+    // The same filter the other way: halves the rate of a run, each output centred on an even
+    // input and taking the odd inputs taps() either side. Stateless in the same way.
+    class half_band_downsampler
+    {
+        // Half the upsampler's, as the centre tap is a half.
+        std::vector<double> m_coefficients;
+
+    public:
+        explicit half_band_downsampler(resample_quality);
+
+        uint64_t taps() const
+        {
+            return m_coefficients.size();
+        }
+
+        // Writes count samples to out, reading in[1 - 2 * taps()] to in[2 * count + 2 * taps() - 2].
+        void downsample(const double* in, double* out, uint64_t count) const;
+    };
+
     class decimator
     {
         double R1, R2, R3, R4, R5, R6, R7, R8, R9;
@@ -313,19 +615,45 @@ namespace sonic_field
     public:
         decimator();
         double decimate(double, double);
+        // True if the filter holds no energy so zero input gives exactly zero output.
+        bool settled() const;
     };
 
     class signal_writer : public signal_mono_base
     {
         const std::string m_name;
-        std::ofstream m_out;
+        // Null once the file is finished.
+        std::unique_ptr<async_file_writer> m_out;
         decimator m_decimate;
         signal_file_header m_header;
         bool m_runner;
+        signal_codec m_codec;
+        uint64_t m_samples;
+        // The chunk being filled and the index of those already written.
+        std::vector<float> m_chunk;
+        std::vector<signal_chunk> m_index;
+        std::vector<uint8_t> m_packed;
+        // Set while the blocks are going to the signal cache rather than the file.
+        bool m_use_cache;
+        bool m_caching;
+        std::vector<double*> m_cached;
+        uint64_t m_reserved;
+        // What the render will be kept as in the render cache, if anything.
+        uint64_t m_render_hash;
+        signal_writer(const std::string& path, bool is_runner, signal_codec codec, bool use_cache);
+        void open();
+        void spill();
+        double* write_block(double* data);
+        void write_wire_block(const float* data);
+        void flush_chunk();
+        void finish();
 
     public:
         signal_writer() = delete;
-        explicit signal_writer(const std::string& name, bool is_runner=false);
+        explicit signal_writer(const std::string& name, bool is_runner=false, signal_codec codec=signal_codec::RAW);
+        virtual ~signal_writer();
+        // Write full rate blocks straight to a .sig file at path.
+        static void write_file(const std::string& path, const std::vector<double*>& blocks, signal_codec codec);
         virtual void inject(signal& in) override;
         virtual double* next() override;
         virtual const char* name() override;
@@ -346,22 +674,54 @@ namespace sonic_field
         return add_to_scope({ new runner{} });
     }
 
-    inline signal write(const std::string& file_name)
+    inline signal write(const std::string& file_name, signal_codec codec = signal_codec::RAW)
     {
         SF_MARK_STACK;
-        return add_to_scope({ new signal_writer{file_name, true} });
+        return add_to_scope({ new signal_writer{file_name, true, codec} });
+    }
+
+    // Streams a signal straight to a 32 bit float WAV file in the output space, at the wire rate as
+    // signal_to_wav, rendering it at inject as write() does. Samples are written as they are, not
+    // normalised; the PEAK chunk records the largest so tools can scale on import.
+    class wav_writer : public signal_mono_base
+    {
+        const std::string m_name;
+        std::unique_ptr<async_file_writer> m_out;
+        decimator m_decimate;
+        uint64_t m_samples;
+        float m_peak;
+        uint64_t m_peak_position;
+        void write_block(double* data);
+        void finish();
+
+    public:
+        wav_writer() = delete;
+        explicit wav_writer(const std::string& name);
+        virtual void inject(signal& in) override;
+        virtual double* next() override;
+        virtual const char* name() override;
+    };
+
+    inline signal write_wav(const std::string& file_name)
+    {
+        SF_MARK_STACK;
+        return add_to_scope({ new wav_writer{file_name} });
     }
 
     class noise_generator : public signal_generator_base
     {
         uint32_t m_state;
         uint64_t m_len;
+        // Noise is seeded from the clock so for the render cache the n-th generator made in a run
+        // stands for the same noise each run.
+        uint64_t m_ordinal;
     public:
         noise_generator() = delete;
         explicit noise_generator(uint64_t len);
         double next_rand();
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -379,6 +739,7 @@ namespace sonic_field
         explicit silence_generator(uint64_t len);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -398,6 +759,7 @@ namespace sonic_field
         explicit linear_generator(const envelope&);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -421,6 +783,7 @@ namespace sonic_field
         explicit gain_controller(double scale, double attack, double release);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -453,6 +816,20 @@ namespace sonic_field
         * <rbj@audioimagination.com> This code is believed to be domain and license free after best efforts to establish its
         * licensing.
         */
+    // Samples per step of an rbj_filter in look ahead mode.
+    constexpr uint64_t SF_RBJ_AHEAD = 4;
+
+    // In look ahead mode rbj filters run their blocks SF_RBJ_AHEAD samples per step. The recursion
+    // is unrolled so each output of a step comes from the step's inputs and the last two outputs
+    // before it, which takes the serial dependency from one per sample to one per step; the
+    // inputs' part is a short FIR done ahead for the whole block. Results match the direct form
+    // to rounding (test_rbj_look_ahead checks how closely) but are not bit for bit the same, so
+    // the mode is off by default and renders stay identical to earlier ones. Filters take the
+    // setting when they are made. Single samples through filter(), as fused chains use, are always
+    // the direct form.
+    void set_rbj_look_ahead(bool on);
+    bool rbj_look_ahead();
+
     class rbj_filter : public signal_mono_base
     {
         // filter coeffs
@@ -461,14 +838,45 @@ namespace sonic_field
         // in/out history
         double ou1, ou2, in1, in2;
 
+        // For look ahead mode: output k of a step is the sum over j of m_from_in[j][k] times the
+        // step's filtered input j, plus m_from_ou1[k] and m_from_ou2[k] times the two outputs
+        // before it.
+        bool m_look_ahead;
+        double m_from_in[SF_RBJ_AHEAD][SF_RBJ_AHEAD];
+        double m_from_ou1[SF_RBJ_AHEAD];
+        double m_from_ou2[SF_RBJ_AHEAD];
+
+        void prepare_look_ahead();
+        double* filter_block(double* data);
+
     public:
 
         rbj_filter(filter_type type, double frequency, double q, double db_gain);
         rbj_filter(double b0a0, double  b1a0, double  b2a0, double  a1a0, double a2a0);
 
-        double filter(double in0);
+        // Inline so fused chains can keep a filter's sample loop in registers.
+        double filter(double in0)
+        {
+            // filter
+            double yn = b0a0 * in0 + b1a0 * in1 + b2a0 * in2 - a1a0 * ou1 - a2a0 * ou2;
+
+            // push in/out buffers
+            in2 = in1;
+            in1 = in0;
+            ou2 = ou1;
+            ou1 = yn;
+
+            // return output
+            return yn;
+        }
+
+        // True (and the history is cleared) once the filter has rung down below the silence
+        // threshold, after which zero input gives zero output.
+        bool settle();
         virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
 
         struct memory
@@ -487,6 +895,7 @@ namespace sonic_field
         memory store_memory() const;
         void restore_memory(const memory&);
 
+        friend class biquad_bank;
     };
 
     inline signal filter_rbj(filter_type type, double frequency, double q, double db_gain)
@@ -495,23 +904,201 @@ namespace sonic_field
         return add_to_scope({ new rbj_filter(type, frequency, q, db_gain) });
     }
 
+    // Biquads side by side in a biquad_bank. More lanes would not leave room in the registers for
+    // their history.
+    constexpr uint64_t SF_BIQUAD_LANES = 4;
+
+    // One channel of a biquad_bank: an rbj filter as filter_rbj makes it, then a gain.
+    struct biquad_channel
+    {
+        filter_type m_type;
+        double m_frequency;
+        double m_q;
+        double m_db_gain;
+        double m_gain;
+    };
+
+    // Many rbj filters on one input, each repeated in a cascade of stages (as repeat() would) and
+    // scaled by its gain, with the results added up in channel order. Every channel computes
+    // exactly what its own chain of rbj_filters, amplifier and ADD mixer would; but the history is
+    // kept structure of arrays in groups of SF_BIQUAD_LANES channels, so a stage of a whole group
+    // is one vector step per sample (SSE2 by default, AVX with -march to match) where the chains
+    // would each run a scalar recursion over a block of their own. As repeat(), a preview runs one
+    // stage. With more than one render thread, next_n spreads the groups of a batch over them and
+    // mixes serially afterwards, so the result is the same whatever the thread count.
+    class biquad_bank : public signal_mono_base
+    {
+        struct lane_coefficients
+        {
+            double b0a0[SF_BIQUAD_LANES];
+            double b1a0[SF_BIQUAD_LANES];
+            double b2a0[SF_BIQUAD_LANES];
+            double a1a0[SF_BIQUAD_LANES];
+            double a2a0[SF_BIQUAD_LANES];
+            double gain[SF_BIQUAD_LANES];
+        };
+
+        struct lane_history
+        {
+            double ou1[SF_BIQUAD_LANES];
+            double ou2[SF_BIQUAD_LANES];
+            double in1[SF_BIQUAD_LANES];
+            double in2[SF_BIQUAD_LANES];
+        };
+
+        std::vector<biquad_channel> m_channels;
+        uint64_t m_stages;
+        // One per group of lanes; spare lanes in the last group have no filter and no gain.
+        std::vector<lane_coefficients> m_coefficients;
+        // m_stages per group, group by group.
+        std::vector<lane_history> m_history;
+        // Every group's lanes for every block of a batch filtered in parallel, block by block
+        // within each group.
+        std::vector<double> m_batch_lanes;
+
+        bool settle();
+        void filter_group(uint64_t group, const double* block, double* lanes);
+        void mix_group(uint64_t group, const double* lanes, double* out);
+        double* filter_block(double* data);
+        void filter_batch(std::span<double*> blocks);
+
+    public:
+        biquad_bank() = delete;
+        explicit biquad_bank(uint64_t stages, const std::vector<biquad_channel>& channels);
+        virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
+        virtual const char* name() override;
+        virtual uint64_t hash() override;
+        virtual signal_base* copy() override;
+    };
+
+    inline signal filter_rbj_bank(uint64_t stages, const std::vector<biquad_channel>& channels)
+    {
+        SF_MARK_STACK;
+        return add_to_scope({ new biquad_bank(stages, channels) });
+    }
+
+    // Normalised by a0, as rbj_filter holds them.
+    struct rbj_coefficients
+    {
+        double b0a0, b1a0, b2a0, a1a0, a2a0;
+    };
+
+    // Samples between shaped_rbj's control points by default; eight a millisecond at 128 kHz.
+    constexpr uint64_t SF_SHAPED_RBJ_CONTROL = 16;
+
+    // An rbj filter with frequency, q and gain taken from three more inputs. Coefficients are
+    // designed at a control point every so many samples (which must divide the block size) with
+    // polynomial approximations in place of the library's trig and pow, and each coefficient ramps
+    // linearly from one point's design to the next, so changes are smooth rather than stepping
+    // every block. Blocks whose controls are constant at the values last designed for are filtered
+    // without any design at all.
     class shaped_rbj : public signal_base
     {
-        rbj_filter::memory m_memory;
         filter_type m_type;
+        uint64_t m_control;
+        // The last control point's inputs and design, once there has been one.
+        bool m_designed;
+        double m_frequency;
+        double m_q;
+        double m_db_gain;
+        rbj_coefficients m_coefficients;
+        rbj_filter::memory m_memory;
     public:
-        shaped_rbj(filter_type);
+        shaped_rbj(filter_type, uint64_t control);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
-    inline signal filter_shaped_rbj(filter_type type)
+    inline signal filter_shaped_rbj(filter_type type, uint64_t control = SF_SHAPED_RBJ_CONTROL)
     {
         SF_MARK_STACK;
-        return add_to_scope({ new shaped_rbj(type) });
+        return add_to_scope({ new shaped_rbj(type, control) });
     }
 
+    // The responses of a state variable filter. Band has a peak gain of q; notch is low plus high
+    // and peak low minus high.
+    enum class svf_response
+    {
+        LOW,
+        BAND,
+        HIGH,
+        NOTCH,
+        PEAK
+    };
+
+    // A state variable filter in the topology preserving (trapezoidal) form, with frequency and q
+    // taken from two more inputs as shaped_rbj does. Unlike the rbj direct form its state stays
+    // meaningful as the coefficients move, so they are worked out for every sample and may be
+    // swept at audio rate. Blocks whose controls are constant at the values last worked out for
+    // skip the working out. Frequencies are held below Nyquist and q just above zero. The filter
+    // is not pulled itself: svf_tap gives a signal for each response wanted, all of them coming
+    // out of the one update of the state per sample. Taps must all be made before any is pulled,
+    // and a block waits until every tap has taken it, so taps pulled far apart (as one appended
+    // after another) hold on to everything between.
+    class svf_filter : public signal_base
+    {
+        std::vector<svf_response> m_taps;
+        // Blocks made but not yet taken, one queue per tap.
+        std::vector<std::deque<double*>> m_pending;
+        bool m_started;
+        bool m_ended;
+        // The controls and coefficients last worked out, once there have been some.
+        bool m_designed;
+        double m_frequency;
+        double m_q;
+        double m_a1, m_a2, m_a3, m_k;
+        // The two integrators.
+        double m_ic1;
+        double m_ic2;
+        void step();
+    public:
+        svf_filter();
+        // Adds a tap, returning its index.
+        uint64_t tap(svf_response response);
+        double* take(uint64_t tap);
+        virtual double* next() override;
+        virtual const char* name() override;
+        virtual uint64_t hash() override;
+        virtual ~svf_filter();
+    };
+
+    // One response of an svf_filter.
+    class svf_output : public signal_generator_base
+    {
+        svf_filter* m_filter;
+        svf_response m_response;
+        uint64_t m_tap;
+    public:
+        svf_output() = delete;
+        explicit svf_output(svf_filter* filter, svf_response response);
+        virtual double* next() override;
+        virtual void sources(std::vector<signal_base*>& into) override;
+        virtual const char* name() override;
+        virtual uint64_t hash() override;
+    };
+
+    inline signal filter_svf()
+    {
+        SF_MARK_STACK;
+        return add_to_scope({ new svf_filter{} });
+    }
+
+    inline signal svf_tap(signal& svf, svf_response response)
+    {
+        SF_MARK_STACK;
+        auto filter = dynamic_cast<svf_filter*>(svf.get());
+        if (!filter)
+            SF_THROW(std::invalid_argument{ std::string{ "Cannot tap a " } + svf.name() + " as an svf filter" });
+        return add_to_scope({ new svf_output{ filter, response } });
+    }
+
+    // How signal_reader brings the wire rate back up when it is half the sample rate. NONE repeats
+    // each sample. MILD and NORMAL interpolate with a half_band_upsampler, FAST and GOOD quality
+    // respectively; MILD holds the first sample before the start where NORMAL fades in and out
+    // over ten blocks instead (at any rate).
     enum class clean_level
     {
         NORMAL,
@@ -522,26 +1109,88 @@ namespace sonic_field
     class signal_reader : public signal_generator_base
     {
         const std::string m_name;
-        std::ifstream m_in;
+        // Samples are converted straight out of the (shared) mapping of the file.
+        signal_file m_file;
         uint64_t m_len;
         double m_scale;
-        rbj_filter m_filter;
+        half_band_upsampler m_upsampler;
         clean_level m_clean_level;
         uint64_t m_position;
 
+        bool silent_around();
+        void read_context(double* into);
+
     public:
         signal_reader() = delete;
         explicit signal_reader(const std::string& name, clean_level);
         virtual double* next() override;
+        virtual uint64_t skip(uint64_t) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
+    };
+
+    // Reads a signal from the signal cache. The clean levels only exist to hide the resampling of
+    // files so do not apply; the scaling to a peak of one does.
+    class cache_reader : public signal_generator_base
+    {
+        std::shared_ptr<const cached_signal> m_signal;
+        double m_scale;
+        uint64_t m_position;
+
+    public:
+        cache_reader() = delete;
+        explicit cache_reader(std::shared_ptr<const cached_signal> signal);
+        virtual double* next() override;
+        virtual uint64_t skip(uint64_t) override;
+        virtual const char* name() override;
+        virtual uint64_t hash() override;
     };
 
     inline signal read(const std::string& file_name, clean_level clean = clean_level::NORMAL)
     {
         SF_MARK_STACK;
+        if (auto cached = find_cached_signal(work_space() + file_name + ".sig"))
+            return add_to_scope({ new cache_reader{cached} });
         return add_to_scope({ new signal_reader{file_name, clean} });
     }
 
+    // Changes the sample rate by ratio, the new rate over the old; for example
+    // read_wav(name) >> resample(sample_rate() / 44100.0) brings a 44.1 kHz WAV up to rate.
+    // Interpolates with a Kaiser windowed sinc from a table of phases. Going down, the kernel
+    // widens to take out what would alias. The output is the length of the input times ratio.
+    class resampler : public signal_mono_base
+    {
+        double m_ratio;
+        resample_quality m_quality;
+        // Inputs used either side of each output and the kernel for each of SF_RESAMPLE_PHASES + 1
+        // fractional positions, 2 * m_half values each.
+        int64_t m_half;
+        std::vector<double> m_table;
+        // Input from sample m_first on; before the start it is zeros.
+        std::vector<double> m_in;
+        int64_t m_first;
+        uint64_t m_read;
+        bool m_ended;
+        uint64_t m_produced;
+
+        void pull();
+        uint64_t output_length() const;
+
+    public:
+        resampler() = delete;
+        explicit resampler(double ratio, resample_quality quality);
+        virtual double* next() override;
+        virtual const char* name() override;
+        virtual uint64_t hash() override;
+        virtual signal_base* copy() override;
+    };
+
+    inline signal resample(double ratio, resample_quality quality = resample_quality::GOOD)
+    {
+        SF_MESG_STACK("resample - create resampler");
+        return add_to_scope({ new resampler{ratio, quality} });
+    }
+
     class repeater : public signal_mono_base
     {
         std::vector<signal> m_chain;
@@ -551,7 +1200,10 @@ namespace sonic_field
         explicit repeater(uint64_t count, std::vector<signal>& chain);
         virtual void inject(signal&) override;
         virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
+        virtual void sources(std::vector<signal_base*>&) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -573,12 +1225,21 @@ namespace sonic_field
     class mixer : public signal_base
     {
         mixer_type m_mode;
+        // Blocks pulled ahead from each input when the inputs are independent and rendered in parallel.
+        std::vector<std::deque<double*>> m_ahead;
+        std::vector<bool> m_ended;
+        bool m_analysed;
+        bool m_parallel;
+        double* pull(uint64_t idx);
+        void pull_ahead();
         double* mix_with();
         double* mix_append();
     public:
         explicit mixer(mixer_type);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
+        virtual ~mixer();
         friend signal mix(mixer_type);
     };
 
@@ -595,11 +1256,15 @@ namespace sonic_field
         double m_phase;
         uint64_t m_position;
 
+        double* seed_block(double* data);
+
     public:
         seeder() = delete;
         explicit seeder(double pitch, double amplitude, double phase);
         virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -618,6 +1283,7 @@ namespace sonic_field
         explicit power(double factor);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -636,6 +1302,7 @@ namespace sonic_field
         explicit saturater(double factor);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -649,11 +1316,15 @@ namespace sonic_field
     {
         double m_factor;
 
+        double* amplify_block(double* data);
+
     public:
         amplifier() = delete;
         explicit amplifier(double factor);
         virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -673,7 +1344,10 @@ namespace sonic_field
         explicit wrapper(signal, signal);
         virtual void inject(signal&) override;
         virtual double* next() override;
+        virtual uint64_t next_n(std::span<double*>) override;
+        virtual void sources(std::vector<signal_base*>&) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -707,11 +1381,13 @@ namespace sonic_field
     namespace mverb
     {
     template<typename T> class MVerb;
+    template<typename T> class preview_verb;
     }
 
     namespace sonic_field
     {
     using mreverb = mverb::MVerb<double>;
+    using preview_mreverb = mverb::preview_verb<double>;
 
     std::unique_ptr<mreverb> create_mreverb(
         double damping_freq,
@@ -726,7 +1402,9 @@ namespace sonic_field
 
     class mreverberator : public signal_base
     {
+        // Exactly one of these; previews get the cheaper one.
         std::unique_ptr<mreverb> m_reverb;
+        std::unique_ptr<preview_mreverb> m_preview_reverb;
         signal m_left;
         signal m_right;
 
@@ -768,23 +1446,56 @@ namespace sonic_field
             decay, predelay, size, gain, mix, early_mix} });
     }
 
+    // Ladder voices side by side in a ladder_filter_driver, as SF_BIQUAD_LANES for biquads.
+    constexpr uint64_t SF_LADDER_LANES = 4;
+    // Samples between a ladder's control points.
+    constexpr uint64_t SF_LADDER_CONTROL = 16;
+
     class shaped_ladder;
 
+    // Resonant ladder filters taking three inputs per voice (signal, resonance, cutoff), with the
+    // voices' outputs added up in order as an ADD mixer would. Coefficients are worked out at a
+    // control point every SF_LADDER_CONTROL samples and ramp from one to the next; while the
+    // controls hold still nothing is worked out at all. Oversampling by 2 or 4 runs the ladders
+    // between half band FIRs so their clippers alias less, with the output moved back to line up
+    // with the input. Voices run SF_LADDER_LANES at a time side by side, one vector step per sample
+    // for the group. A preview, which repeat() runs once, does not oversample either.
     class ladder_filter_driver : public signal_base
     {
-        shaped_ladder* m_ladder;
+        uint64_t m_voices;
+        uint64_t m_oversample;
+        std::vector<shaped_ladder*> m_ladders;
+        std::vector<double*> m_signals;
+        std::vector<double*> m_resonances;
+        std::vector<double*> m_cutoffs;
+        // Filtered but not yet handed on.
+        std::vector<double> m_pending;
+        // Latency still to drop from the front of the output.
+        uint64_t m_skip;
+        uint64_t m_read;
+        uint64_t m_written;
+        bool m_ended;
+        // Frees the blocks last pulled, leaving alone the silent ones and those which ended.
+        void release_inputs();
     public:
-        ladder_filter_driver();
+        ladder_filter_driver() = delete;
+        explicit ladder_filter_driver(uint64_t voices, uint64_t oversample);
         virtual double* next() override;
         virtual const char* name() override;
         virtual signal_base* copy() override;
         virtual ~ladder_filter_driver();
     };
 
-    inline signal ladder_filter()
+    inline signal ladder_filter(uint64_t oversample = 1)
     {
         SF_MESG_STACK("ladder_filter - create saturate ladder_filter_driver");
-        return add_to_scope({ new ladder_filter_driver{} });
+        return add_to_scope({ new ladder_filter_driver{1, oversample} });
+    }
+
+    inline signal ladder_bank(uint64_t voices, uint64_t oversample = 1)
+    {
+        SF_MESG_STACK("ladder_bank - create ladder_filter_driver");
+        return add_to_scope({ new ladder_filter_driver{voices, oversample} });
     }
 
     class echo_chamber : public signal_mono_base
@@ -872,6 +1583,7 @@ namespace sonic_field
         explicit cutter(uint64_t pad_before, uint64_t from, uint64_t to, uint64_t pad_after);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -893,6 +1605,7 @@ namespace sonic_field
         sweeper(double start_frequency, double end_frequency, uint64_t length);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -916,6 +1629,7 @@ namespace sonic_field
         shepard(double start_frequency, double end_frequency, uint64_t cycle_length, uint64_t length);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -929,12 +1643,16 @@ namespace sonic_field
     {
         std::vector<double*> m_store;
         uint64_t m_position;
+        // Of the input, taken before it was pulled.
+        uint64_t m_hash;
 
     public:
-        storer(): m_store{}, m_position{0}{}
+        storer(): m_store{}, m_position{0}, m_hash{0}{}
         virtual void inject(signal&) override;
         virtual double* next() override;
+        virtual void sources(std::vector<signal_base*>&) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -949,12 +1667,16 @@ namespace sonic_field
         std::vector<double*> m_store;
         uint64_t m_position;
         double m_scale;
+        // Of the input, taken before it was pulled.
+        uint64_t m_hash;
 
     public:
-        leveler(): m_store{}, m_position{0}, m_scale{0}{}
+        leveler(): m_store{}, m_position{0}, m_scale{0}, m_hash{0}{}
         virtual void inject(signal&) override;
         virtual double* next() override;
+        virtual void sources(std::vector<signal_base*>&) override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
     };
 
@@ -980,6 +1702,7 @@ namespace sonic_field
         situator(situator_input_t&);
         virtual double* next() override;
         virtual const char* name() override;
+        virtual uint64_t hash() override;
         virtual signal_base* copy() override;
         virtual ~situator();
     };
@@ -2,6 +2,13 @@
 #include "../midi_support.h"
 #include "../comms.h"
 #include "../notes.h"
+#include "../fused.h"
+#include "../music/library.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
 
 namespace sonic_field
 {
@@ -9,6 +16,30 @@ namespace sonic_field
     void test_tests();
     void test_midi_smoke(const std::string&);
     void test_comms();
+    void test_block_pool();
+    void test_block_pool_threads();
+    void test_block_sharing();
+    void test_constant_blocks();
+    void test_parallel_mixer();
+    void test_batch_pull();
+    void test_fused_chain();
+    void test_mapped_files();
+    void test_buffered_writer();
+    void test_signal_files();
+    void test_packed_signal_files();
+    void test_signal_cache();
+    void test_render_cache();
+    void test_wav_writer();
+    void test_wav_reader();
+    void test_resampling();
+    void test_sample_rates();
+    void test_preview();
+    void test_biquad_bank();
+    void test_rbj_look_ahead();
+    void test_shaped_rbj();
+    void test_ladder_filter();
+    void test_svf_filter();
+    void test_memory_tracking();
     namespace notes
     {
         void test_notes();
@@ -38,6 +69,30 @@ namespace sonic_field
         //try_run("Midi note tests 2", [&] { notes::test_midi_notes_2(m_data_dir); });
         //try_run("Midi note tests 3", [&] { notes::test_midi_notes_3(m_data_dir); });
         try_run("Midi note tests 4", [&] { notes::test_midi_notes_4(m_data_dir); });
+        try_run("Block pool tests", [&] { test_block_pool(); });
+        try_run("Block pool thread tests", [&] { test_block_pool_threads(); });
+        try_run("Block sharing tests", [&] { test_block_sharing(); });
+        try_run("Constant block tests", [&] { test_constant_blocks(); });
+        try_run("Parallel mixer tests", [&] { test_parallel_mixer(); });
+        try_run("Batch pull tests", [&] { test_batch_pull(); });
+        try_run("Fused chain tests", [&] { test_fused_chain(); });
+        try_run("Mapped file tests", [&] { test_mapped_files(); });
+        try_run("Buffered writer tests", [&] { test_buffered_writer(); });
+        try_run("Signal file tests", [&] { test_signal_files(); });
+        try_run("Packed signal file tests", [&] { test_packed_signal_files(); });
+        try_run("Signal cache tests", [&] { test_signal_cache(); });
+        try_run("Render cache tests", [&] { test_render_cache(); });
+        try_run("Wav writer tests", [&] { test_wav_writer(); });
+        try_run("Wav reader tests", [&] { test_wav_reader(); });
+        try_run("Resampling tests", [&] { test_resampling(); });
+        try_run("Sample rate tests", [&] { test_sample_rates(); });
+        try_run("Preview tests", [&] { test_preview(); });
+        try_run("Biquad bank tests", [&] { test_biquad_bank(); });
+        try_run("RBJ look ahead tests", [&] { test_rbj_look_ahead(); });
+        try_run("Shaped rbj tests", [&] { test_shaped_rbj(); });
+        try_run("Ladder filter tests", [&] { test_ladder_filter(); });
+        try_run("SVF filter tests", [&] { test_svf_filter(); });
+        try_run("Memory tracking tests", [&] { test_memory_tracking(); });
         std::cerr << "\n";
         std::cerr << "****************************************\n";
         std::cerr << "* Failed tests: " << m_failed << "\n";
@@ -129,6 +184,1361 @@ namespace sonic_field
         comms::run_tests();
     }
 
+    void test_block_pool()
+    {
+        SF_MARK_STACK;
+        auto before = block_pool_statistics();
+        std::vector<double*> blocks{};
+        // More than a slab beyond every block already carved, so whatever earlier tests left free
+        // another slab is needed.
+        auto carved = before.slabs_mapped * SF_BLOCKS_PER_SLAB;
+        auto spare = carved - before.blocks_live;
+        for (uint64_t idx{ 0 }; idx < spare + SF_BLOCKS_PER_SLAB + 1; ++idx)
+        {
+            blocks.push_back(new_block());
+        }
+        auto during = block_pool_statistics();
+        assert_equal(during.blocks_live, before.blocks_live + blocks.size(), "Blocks live counted");
+        assert_less(before.slabs_mapped, during.slabs_mapped, "Slab mapped on demand");
+        bool aligned{ true };
+        for (auto block : blocks)
+        {
+            aligned = aligned && (uintptr_t(block) % SF_BLOCK_ALIGN == 0);
+        }
+        assert_true(aligned, "Blocks cache line aligned");
+        assert_equal(blocks.front()[BLOCK_SIZE - 1], 0.0, "New block initialised");
+        for (auto block : blocks)
+        {
+            free_block(block);
+        }
+        assert_equal(block_pool_statistics().blocks_live, before.blocks_live, "Blocks live after free");
+    }
+
+    void test_block_pool_threads()
+    {
+        SF_MARK_STACK;
+        auto before = block_pool_statistics();
+        std::vector<double*> blocks{};
+        // Allocate on one thread and free on another; the blocks must flow back via the depot.
+        std::thread producer{[&]
+        {
+            for (uint64_t idx{ 0 }; idx < 1000; ++idx)
+            {
+                blocks.push_back(new_block());
+            }
+        }};
+        producer.join();
+        assert_equal(block_pool_statistics().blocks_live, before.blocks_live + 1000, "Producer blocks live");
+        std::thread consumer{[&]
+        {
+            for (auto block : blocks)
+            {
+                free_block(block);
+            }
+        }};
+        consumer.join();
+        assert_equal(block_pool_statistics().blocks_live, before.blocks_live, "Blocks freed across threads");
+        auto mapped = block_pool_statistics().slabs_mapped;
+        for (uint64_t idx{ 0 }; idx < 1000; ++idx)
+        {
+            free_block(new_block());
+        }
+        assert_equal(block_pool_statistics().slabs_mapped, mapped, "Freed blocks reused");
+    }
+
+    void test_block_sharing()
+    {
+        SF_MARK_STACK;
+        auto before = block_pool_statistics();
+        auto block = new_block();
+        block[0] = 1.0;
+        auto shared = share_block(block);
+        assert_true(shared == block, "Sharing does not copy");
+        assert_equal(block_pool_statistics().blocks_live, before.blocks_live + 1, "Shared block is one block");
+        auto written = writable_block(shared);
+        assert_false(written == block, "Writing a shared block copies it");
+        written[0] = 2.0;
+        assert_equal(block[0], 1.0, "Original unchanged by write to copy");
+        assert_true(writable_block(block) == block, "Sole reference written in place");
+        assert_true(share_block(empty_block()) == empty_block(), "Empty block shares as itself");
+        free_block(block);
+        free_block(written);
+        assert_equal(block_pool_statistics().blocks_live, before.blocks_live, "All references released");
+    }
+
+    void test_constant_blocks()
+    {
+        SF_SCOPE("test_constant_blocks");
+        double value{ 0 };
+        auto flat = generate_linear({ {0, 2.0}, {10, 2.0} }) >> amplify(0.5) >> distort_power(2.0);
+        auto block = flat.next();
+        assert_true(is_constant_block(block, value), "Flat envelope stays constant");
+        assert_equal(value, 1.0, "Constant value propagated");
+        assert_equal(block[BLOCK_SIZE - 1], 1.0, "Constant block samples filled in");
+        free_block(block);
+
+        auto silent = mix(mixer_type::ADD);
+        generate_silence(2) >> filter_rbj(filter_type::LOWPASS, 1000, 1, 0) >> silent;
+        generate_silence(2) >> control_gain(0.1, 0.005) >> silent;
+        assert_true(silent.next() == empty_block(), "Silence propagated through filter and mixer");
+
+        // Whatever takes a mixer's output copes with it being silent, as a signal or a control.
+        auto quiet = [](uint64_t length) {
+            auto mixer = mix(mixer_type::ADD);
+            generate_silence(length) >> mixer;
+            generate_silence(length) >> mixer;
+            return mixer;
+        };
+        std::vector<signal> consumers{
+            quiet(10) >> filter_rbj(filter_type::LOWPASS, 1000, 1, 0),
+            quiet(10) >> filter_rbj_bank(2, { { filter_type::PEAK, 440, 1, 6, 1 } }),
+            quiet(10) >> control_gain(0.1, 0.005),
+            quiet(10) >> distort_power(1.25) >> distort_saturate(0.5) >> amplify(0.5),
+            quiet(10) >> seed(440, 0.1, 0.25),
+            quiet(10) >> fuse(fused::gain(0.1, 0.005) >> fused::saturate(0.5))
+        };
+        auto shaped = filter_shaped_rbj(filter_type::PEAK);
+        for (uint64_t input{ 0 }; input < 4; ++input)
+            quiet(10) >> shaped;
+        consumers.push_back(shaped);
+        auto ladder = ladder_filter();
+        for (uint64_t input{ 0 }; input < 3; ++input)
+            quiet(10) >> ladder;
+        consumers.push_back(ladder);
+        auto svf = filter_svf();
+        for (uint64_t input{ 0 }; input < 3; ++input)
+            quiet(10) >> svf;
+        consumers.push_back(svf_tap(svf, svf_response::LOW));
+        for (auto& consumer : consumers)
+        {
+            auto out = drain(consumer);
+            assert_equal(out.size(), uint64_t(10 * block_size()), std::string{ "Silence through " } + consumer.name());
+        }
+    }
+
+    // Passes its input through, making a signal each block as processors which build graphs as
+    // they go do, and noting whether the frames of the test which made it are on the stack.
+    class scope_probe : public signal_mono_base
+    {
+        std::atomic<bool>& m_saw_frames;
+    public:
+        explicit scope_probe(std::atomic<bool>& saw_frames) : m_saw_frames{ saw_frames } {}
+
+        double* next() override
+        {
+            SF_MARK_STACK;
+            generate_silence(1);
+            auto frames = SF_STACK_FRAMES();
+            for (auto frame : frames)
+                if (std::string_view{ frame }.starts_with("written:")) m_saw_frames = true;
+            return input().next();
+        }
+
+        const char* name() override
+        {
+            return "scope_probe";
+        }
+    };
+
+    void test_parallel_mixer()
+    {
+        SF_SCOPE("test_parallel_mixer");
+        auto render = [](uint64_t threads)
+        {
+            SF_SCOPE("render");
+            set_render_threads(threads);
+            auto bank = mix(mixer_type::ADD);
+            for (auto pitch : { 200.0, 400.0, 800.0 })
+            {
+                generate_sweep(100, 2000, 100)
+                    >> repeat(2, { filter_rbj(filter_type::PEAK, pitch, 0.5, 10) })
+                    >> amplify(0.5)
+                    >> bank;
+            }
+            std::vector<double> out{};
+            while (auto block = bank.next())
+            {
+                if (block == empty_block()) continue;
+                out.insert(out.end(), block, block + BLOCK_SIZE);
+                free_block(block);
+            }
+            set_render_threads(1);
+            return out;
+        };
+        auto serial = render(1);
+        auto parallel = render(4);
+        assert_equal(serial.size(), parallel.size(), "Same length in parallel");
+        assert_true(serial == parallel, "Bit identical in parallel");
+
+        auto broken = mix(mixer_type::ADD);
+        generate_silence(100) >> broken;
+        generate_silence(10) >> broken;
+        set_render_threads(2);
+        assert_throws<std::logic_error>(
+                [&]{ while (auto block = broken.next()) if (block != empty_block()) free_block(block); },
+                "same length",
+                "Parallel errors reach the caller");
+        set_render_threads(1);
+
+        // Writers and anything else which makes signals as it goes must work on whichever thread
+        // pulls them, leaving what they make in the caller's scope and the caller's frames on the
+        // stack they see.
+        auto written = [](uint64_t threads, std::atomic<bool>& saw_frames)
+        {
+            SF_SCOPE("written");
+            set_render_threads(threads);
+            auto bank = mix(mixer_type::ADD);
+            for (auto name : { "test_parallel_writer_a", "test_parallel_writer_b" })
+            {
+                generate_sweep(100, 2000, 100)
+                    >> filter_rbj(filter_type::PEAK, 400, 0.5, 10)
+                    >> add_to_scope({ new scope_probe{ saw_frames } })
+                    >> add_to_scope({ new signal_writer{ name } })
+                    >> bank;
+            }
+            auto out = drain(bank);
+            set_render_threads(1);
+            for (auto name : { "test_parallel_writer_a", "test_parallel_writer_b" })
+            {
+                auto back = drain(read(name, clean_level::NONE));
+                out.insert(out.end(), back.begin(), back.end());
+                delete_sig_file(name);
+            }
+            return out;
+        };
+        std::atomic<bool> serial_frames{ false };
+        std::atomic<bool> parallel_frames{ false };
+        auto serial_written = written(1, serial_frames);
+        auto parallel_written = written(4, parallel_frames);
+        assert_true(serial_written.size() > 0, "Writers wrote");
+        assert_true(serial_written == parallel_written, "Writers bit identical in parallel");
+        assert_true(parallel_frames, "Parallel tasks see the caller's frames");
+    }
+
+    void test_batch_pull()
+    {
+        SF_SCOPE("test_batch_pull");
+        auto chain = []
+        {
+            return generate_sweep(100, 2000, 20)
+                >> seed(440, 0.1, 0.0)
+                >> filter_rbj(filter_type::LOWPASS, 1000, 1, 0)
+                >> amplify(0.5);
+        };
+        auto one = chain();
+        std::vector<double> expected{};
+        while (auto block = one.next())
+        {
+            expected.insert(expected.end(), block, block + BLOCK_SIZE);
+            free_block(block);
+        }
+
+        auto many = chain();
+        std::vector<double> got{};
+        double* batch[7];
+        uint64_t count{ 0 };
+        do
+        {
+            count = many.next_n(batch);
+            for (uint64_t idx{ 0 }; idx < count; ++idx)
+            {
+                got.insert(got.end(), batch[idx], batch[idx] + BLOCK_SIZE);
+                free_block(batch[idx]);
+            }
+        } while (count == 7);
+        assert_equal(expected.size(), got.size(), "Batches cover the whole signal");
+        assert_true(expected == got, "Batches give the same samples as single blocks");
+        assert_equal(many.next_n(batch), uint64_t(0), "Nothing more after the end");
+    }
+
+    void test_fused_chain()
+    {
+        SF_SCOPE("test_fused_chain");
+        auto expected = drain(generate_sweep(100, 2000, 20)
+            >> seed(440, 0.1, 0.25)
+            >> repeat(2, { filter_rbj(filter_type::PEAK, 440, 0.2, 20) })
+            >> control_gain(0.1, 0.005)
+            >> distort_power(1.25)
+            >> distort_saturate(0.5)
+            >> amplify(0.5));
+        auto got = drain(generate_sweep(100, 2000, 20)
+            >> fuse(fused::seed(440, 0.1, 0.25)
+                >> fused::repeat<2>(fused::rbj(filter_type::PEAK, 440, 0.2, 20))
+                >> fused::gain(0.1, 0.005)
+                >> fused::power(1.25)
+                >> fused::saturate(0.5)
+                >> fused::amplify(0.5)));
+        assert_equal(expected.size(), got.size(), "Fused chain length");
+        assert_true(expected == got, "Fused chain matches the runtime chain");
+    }
+
+    void test_mapped_files()
+    {
+        SF_SCOPE("test_mapped_files");
+        generate_sweep(100, 2000, 20) >> write("test_mapped_files");
+        auto name = work_space() + "test_mapped_files.sig";
+        auto first = map_file(name);
+        auto second = map_file(name);
+        assert_true(first->data() == second->data(), "Readers of one file share a mapping");
+        assert_equal(first->size(),
+                uint64_t(sizeof(signal_file_header_v2) + 21 * WIRE_BLOCK_SIZE * sizeof(float) + sizeof(signal_chunk)),
+                "Mapping covers the file");
+
+        auto a = read("test_mapped_files");
+        auto b = read("test_mapped_files");
+        uint64_t blocks{ 0 };
+        while (auto x = a.next())
+        {
+            auto y = b.next();
+            assert_true(y != nullptr, "Both readers the same length");
+            assert_true(std::equal(x, x + BLOCK_SIZE, y), "Both readers see the same samples");
+            free_block(x);
+            free_block(y);
+            ++blocks;
+        }
+        assert_equal(blocks, uint64_t(21), "Whole file read");
+        first.reset();
+        second.reset();
+        delete_sig_file("test_mapped_files");
+    }
+
+    void test_buffered_writer()
+    {
+        SF_SCOPE("test_buffered_writer");
+        auto name = work_space() + "test_buffered_writer.bin";
+        std::vector<uint32_t> expected(1500000);
+        for (uint32_t idx{ 0 }; idx < expected.size(); ++idx)
+            expected[idx] = idx * 2654435761u;
+        {
+            async_file_writer out{ name };
+            // Odd sized pieces so writes straddle the buffers.
+            uint64_t at{ 0 };
+            while (at < expected.size())
+            {
+                auto take = std::min(uint64_t(expected.size() - at), uint64_t(777));
+                out.write(&expected[at], take * sizeof(uint32_t));
+                at += take;
+            }
+            assert_equal(out.position(), uint64_t(expected.size() * sizeof(uint32_t)), "Position counts bytes");
+            expected[0] = 42;
+            out.write_at(0, &expected[0], sizeof(uint32_t));
+            out.close();
+        }
+        auto map = map_file(name);
+        assert_equal(map->size(), uint64_t(expected.size() * sizeof(uint32_t)), "All written");
+        assert_true(memcmp(map->data(), expected.data(), map->size()) == 0, "Written in order with patch");
+        map.reset();
+        std::remove(name.c_str());
+    }
+
+    void test_signal_files()
+    {
+        SF_SCOPE("test_signal_files");
+        auto all = mix(mixer_type::APPEND);
+        generate_sweep(100, 2000, 300) >> all;
+        generate_silence(600) >> all;
+        generate_sweep(2000, 100, 300) >> all;
+        all >> write("test_signal_files");
+        auto name = work_space() + "test_signal_files.sig";
+
+        // A version 1 file of the same samples.
+        std::vector<float> samples{};
+        signal_file_header levels{};
+        {
+            signal_file file{ name };
+            // Each sweep renders one block beyond its length.
+            assert_equal(file.samples(), uint64_t(1202 * WIRE_BLOCK_SIZE), "Length recorded");
+            assert_true(file.wire_block(2 * SF_CHUNK_BLOCKS * WIRE_BLOCK_SIZE) == nullptr, "Silent chunk not stored");
+            assert_true(file.wire_block(0) != nullptr, "Sound stored");
+            levels = file.levels();
+            for (uint64_t pos{ 0 }; pos < file.samples(); pos += WIRE_BLOCK_SIZE)
+            {
+                auto block = file.wire_block(pos);
+                for (uint64_t idx{ 0 }; idx < WIRE_BLOCK_SIZE; ++idx)
+                    samples.push_back(block ? block[idx] : 0.0f);
+            }
+        }
+        {
+            std::ofstream out{ work_space() + "test_signal_files_v1.sig", std::ios::binary };
+            out.write(reinterpret_cast<const char*>(&levels), sizeof(levels));
+            out.write(reinterpret_cast<const char*>(samples.data()), samples.size() * sizeof(float));
+        }
+
+        auto collect = [](signal sig)
+        {
+            std::vector<double> out{};
+            while (auto block = sig.next())
+            {
+                if (block == empty_block())
+                {
+                    out.insert(out.end(), BLOCK_SIZE, 0.0);
+                    continue;
+                }
+                out.insert(out.end(), block, block + BLOCK_SIZE);
+                free_block(block);
+            }
+            return out;
+        };
+        for (auto clean : { clean_level::NONE, clean_level::NORMAL })
+        {
+            auto whole = collect(read("test_signal_files", clean));
+            assert_equal(whole.size(), uint64_t(1202 * BLOCK_SIZE), "Whole file read");
+            assert_true(whole == collect(read("test_signal_files_v1", clean)), "Version 1 files read the same");
+            auto part = collect(read("test_signal_files", clean) >> cut(0, 700, 1000, 0));
+            assert_true(std::equal(part.begin(), part.end(), whole.begin() + 700 * BLOCK_SIZE), "Cut skips to the same samples");
+        }
+        delete_sig_file("test_signal_files");
+        delete_sig_file("test_signal_files_v1");
+    }
+
+    void test_packed_signal_files()
+    {
+        SF_SCOPE("test_packed_signal_files");
+        auto all = mix(mixer_type::APPEND);
+        generate_sweep(100, 8000, 300) >> filter_rbj(filter_type::LOWPASS, 2000, 1, 0) >> all;
+        generate_silence(300) >> all;
+        generate_noise(300) >> all;
+        // Stored so both files get the same noise.
+        auto stored = all >> store();
+        copy(stored) >> write("test_packed_signal_files_raw");
+        stored >> write("test_packed_signal_files", signal_codec::PACKED);
+        auto name = work_space() + "test_packed_signal_files";
+
+        signal_file raw{ name + "_raw.sig" };
+        signal_file packed{ name + ".sig" };
+        assert_equal(raw.samples(), packed.samples(), "Same length packed");
+        for (uint64_t pos{ 0 }; pos < raw.samples(); pos += WIRE_BLOCK_SIZE)
+        {
+            auto x = raw.wire_block(pos);
+            auto y = packed.wire_block(pos);
+            assert_true((x == nullptr) == (y == nullptr), "Same silence packed");
+            assert_true(reinterpret_cast<uintptr_t>(y) % alignof(float) == 0, "Packed file blocks aligned");
+            if (x)
+                assert_true(memcmp(x, y, WIRE_BLOCK_SIZE * sizeof(float)) == 0, "Packing is lossless");
+        }
+        assert_true(map_file(name + ".sig")->size() < map_file(name + "_raw.sig")->size(), "Packing saves space");
+        raw.close();
+        packed.close();
+        delete_sig_file("test_packed_signal_files_raw");
+        delete_sig_file("test_packed_signal_files");
+    }
+
+    void test_signal_cache()
+    {
+        SF_SCOPE("test_signal_cache");
+        auto path = [](const std::string& name) { return work_space() + name + ".sig"; };
+        auto on_disk = [&](const std::string& name) { return bool(std::ifstream{ path(name) }); };
+        set_signal_cache_bytes(1024 * BLOCK_SIZE * sizeof(double));
+
+        generate_sweep(100, 2000, 100) >> write("test_signal_cache_a");
+        assert_true(find_cached_signal(path("test_signal_cache_a")) != nullptr, "Written to the cache");
+        assert_true(!on_disk("test_signal_cache_a"), "Not written to disk");
+        std::vector<double> expected{};
+        double peak{ 0 };
+        auto sweep = generate_sweep(100, 2000, 100);
+        while (auto block = sweep.next())
+        {
+            for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx)
+            {
+                expected.push_back(block[idx]);
+                peak = std::max(peak, std::abs(block[idx]));
+            }
+            free_block(block);
+        }
+        std::vector<double> got{};
+        auto cached = read("test_signal_cache_a");
+        while (auto block = cached.next())
+        {
+            got.insert(got.end(), block, block + BLOCK_SIZE);
+            free_block(block);
+        }
+        assert_equal(got.size(), expected.size(), "Same length from the cache");
+        for (uint64_t idx{ 0 }; idx < got.size(); ++idx)
+            assert_true(got[idx] == expected[idx] * (1.0 / peak), "Cache reads are exact");
+
+        // Room for b means spilling a.
+        generate_sweep(100, 2000, 999) >> write("test_signal_cache_b");
+        assert_true(on_disk("test_signal_cache_a") && !find_cached_signal(path("test_signal_cache_a")), "Spilled");
+        assert_true(find_cached_signal(path("test_signal_cache_b")) != nullptr, "Newest kept");
+        // Too big for the cache at all so it goes to disk, taking b with it.
+        generate_sweep(100, 2000, 2000) >> write("test_signal_cache_c");
+        assert_true(on_disk("test_signal_cache_b") && on_disk("test_signal_cache_c"), "Spilled writing");
+        assert_true(!find_cached_signal(path("test_signal_cache_c")), "Too big to cache");
+        assert_equal(signal_file{ path("test_signal_cache_c") }.samples(), uint64_t(2001 * WIRE_BLOCK_SIZE),
+                "Spilled while writing in full");
+
+        generate_sweep(100, 2000, 10) >> write("test_signal_cache_d");
+        persist_signal(path("test_signal_cache_d"));
+        assert_true(on_disk("test_signal_cache_d") && find_cached_signal(path("test_signal_cache_d")), "Persisted");
+
+        for (auto name : { "a", "b", "c", "d" })
+            delete_sig_file(std::string{ "test_signal_cache_" } + name);
+        assert_true(!find_cached_signal(path("test_signal_cache_d")), "Deleting drops from the cache");
+        set_signal_cache_bytes(0);
+    }
+
+    void test_render_cache()
+    {
+        SF_SCOPE("test_render_cache");
+        auto chain = [](double gain)
+        {
+            return generate_sweep(100, 2000, 50)
+                >> filter_rbj(filter_type::LOWPASS, 1000, 1, 0)
+                >> amplify(gain);
+        };
+        assert_true(chain(0.5).hash() != 0, "Hashable chain");
+        assert_equal(chain(0.5).hash(), chain(0.5).hash(), "Same graph same hash");
+        assert_true(chain(0.5).hash() != chain(0.6).hash(), "Parameters change the hash");
+        assert_true(generate_noise(10).hash() != generate_noise(10).hash(), "Each noise generator differs");
+        assert_equal((chain(0.5) >> ladder_filter()).hash(), uint64_t(0), "Unknown processors cannot be cached");
+
+        auto directory = work_space() + "test_render_cache";
+        auto entries = [&]
+        {
+            auto it = std::filesystem::directory_iterator{ directory };
+            return std::distance(begin(it), end(it));
+        };
+        set_render_cache(directory);
+        chain(0.5) >> write("test_render_cache_a");
+        assert_equal(entries(), 1L, "Render kept");
+        chain(0.5) >> write("test_render_cache_b");
+        assert_equal(entries(), 1L, "Render reused");
+        assert_true(std::filesystem::equivalent(work_space() + "test_render_cache_a.sig",
+            work_space() + "test_render_cache_b.sig"), "Reused render linked");
+        assert_equal(read("test_render_cache_a").hash(), read("test_render_cache_b").hash(), "Files hash by content");
+        chain(0.6) >> write("test_render_cache_a");
+        assert_equal(entries(), 2L, "Changed graph rendered");
+        assert_true(!std::filesystem::equivalent(work_space() + "test_render_cache_a.sig",
+            work_space() + "test_render_cache_b.sig"), "Rewriting does not touch the cache");
+
+        set_render_cache("");
+        delete_sig_file("test_render_cache_a");
+        delete_sig_file("test_render_cache_b");
+        std::filesystem::remove_all(directory);
+    }
+
+    void test_wav_writer()
+    {
+        SF_SCOPE("test_wav_writer");
+        auto all = mix(mixer_type::APPEND);
+        generate_sweep(100, 2000, 20) >> amplify(3.0) >> all;
+        generate_silence(10) >> all;
+        auto stored = all >> store();
+        copy(stored) >> write("test_wav_writer");
+        stored >> write_wav("test_wav_writer");
+
+        std::vector<float> expected{};
+        {
+            signal_file file{ work_space() + "test_wav_writer.sig" };
+            for (uint64_t pos{ 0 }; pos < file.samples(); pos += WIRE_BLOCK_SIZE)
+            {
+                auto block = file.wire_block(pos);
+                for (uint64_t idx{ 0 }; idx < WIRE_BLOCK_SIZE; ++idx)
+                    expected.push_back(block ? block[idx] : 0.0f);
+            }
+        }
+        auto name = output_space() + "test_wav_writer.wav";
+        auto map = map_file(name);
+        auto data = map->data();
+        auto u32 = [&](uint64_t at) { uint32_t v; memcpy(&v, data + at, sizeof(v)); return v; };
+        auto f32 = [&](uint64_t at) { float v; memcpy(&v, data + at, sizeof(v)); return v; };
+        assert_true(memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WAVE", 4) == 0, "RIFF WAVE file");
+        assert_equal(uint64_t(u32(4)), map->size() - 8, "RIFF size");
+        assert_equal(uint64_t(data[20]), uint64_t(3), "IEEE float format");
+        assert_equal(uint64_t(u32(24)), wire_rate(), "Wire rate");
+        assert_true(memcmp(data + 50, "PEAK", 4) == 0, "PEAK chunk");
+        auto peak = *std::max_element(expected.begin(), expected.end(), [](float a, float b) { return std::abs(a) < std::abs(b); });
+        assert_equal(f32(66), std::abs(peak), "Peak recorded");
+        assert_true(std::abs(peak) > 1.0f, "Not normalised");
+        assert_true(memcmp(data + 74, "data", 4) == 0, "Data chunk");
+        assert_equal(uint64_t(u32(78)), uint64_t(expected.size() * sizeof(float)), "Data size");
+        assert_true(memcmp(data + 82, expected.data(), expected.size() * sizeof(float)) == 0, "Same samples as a signal file");
+        map.reset();
+        std::remove(name.c_str());
+        delete_sig_file("test_wav_writer");
+    }
+
+    void test_wav_reader()
+    {
+        SF_SCOPE("test_wav_reader");
+        // 300 samples so the last block is part padding.
+        std::vector<int32_t> values{};
+        for (int32_t idx{ 0 }; idx < 300; ++idx)
+            values.push_back((idx * 7919) % 65536 - 32768);
+        auto write_file = [&](uint16_t format, uint16_t bits)
+        {
+            auto bytes = bits / 8;
+            std::string data{};
+            for (auto v : values)
+            {
+                if (format == 3)
+                {
+                    float f = v / 32768.0f;
+                    data.append(reinterpret_cast<const char*>(&f), sizeof(f));
+                }
+                else
+                {
+                    // The 16 bit value at the top of each sample.
+                    int32_t scaled = v * (1 << (bits - 16));
+                    data.append(reinterpret_cast<const char*>(&scaled), bytes);
+                }
+            }
+            auto u32 = [](uint32_t v) { return std::string(reinterpret_cast<const char*>(&v), 4); };
+            auto u16 = [](uint16_t v) { return std::string(reinterpret_cast<const char*>(&v), 2); };
+            auto file = std::string{ "WAVE" } + "fmt " + u32(16) + u16(format) + u16(1) + u32(44100) +
+                u32(44100 * bytes) + u16(bytes) + u16(bits) + "LIST" + u32(4) + "INFO" + "data" +
+                u32(uint32_t(data.size())) + data;
+            std::ofstream out{ output_space() + "test_wav_reader.wav", std::ios::binary };
+            out << "RIFF" << u32(uint32_t(file.size())) << file;
+        };
+        for (auto [format, bits] : { std::pair{ 1, 16 }, std::pair{ 1, 24 }, std::pair{ 1, 32 }, std::pair{ 3, 32 } })
+        {
+            write_file(uint16_t(format), uint16_t(bits));
+            // Integer PCM has always come out negated, except at 32 bits.
+            double sign = format == 1 && bits < 32 ? -1.0 : 1.0;
+            auto wav = read_wav("test_wav_reader");
+            uint64_t at{ 0 };
+            while (auto block = wav.next())
+            {
+                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx, ++at)
+                {
+                    auto expected = at < values.size() ? sign * values[at] / 32768.0 : 0.0;
+                    assert_equal(block[idx], expected, "Wav sample " + std::to_string(bits) + " bits");
+                }
+                free_block(block);
+            }
+            assert_equal(at, uint64_t(3 * BLOCK_SIZE), "Every sample read and the end padded");
+        }
+        std::remove((output_space() + "test_wav_reader.wav").c_str());
+    }
+
+    void test_resampling()
+    {
+        SF_SCOPE("test_resampling");
+        // Amplitude of a frequency in the samples, by correlation.
+        auto level = [](const std::vector<double>& samples, double frequency)
+        {
+            double re{ 0.0 }, im{ 0.0 };
+            for (uint64_t idx{ 0 }; idx < samples.size(); ++idx)
+            {
+                re += samples[idx] * std::cos(idx * frequency * angle_rate());
+                im += samples[idx] * std::sin(idx * frequency * angle_rate());
+            }
+            return 2.0 * std::sqrt(re * re + im * im) / samples.size();
+        };
+        auto collect = [](signal in, uint64_t from, uint64_t to)
+        {
+            std::vector<double> ret{};
+            uint64_t at{ 0 };
+            while (auto block = in.next())
+            {
+                for (uint64_t idx{ 0 }; idx < BLOCK_SIZE; ++idx, ++at)
+                {
+                    if (at >= from && at < to)
+                        ret.push_back(block == empty_block() ? 0.0 : block[idx]);
+                }
+                if (block != empty_block()) free_block(block);
+            }
+            return ret;
+        };
+
+        // Reading back at twice the wire rate must not make an image of the tone mirrored about
+        // the wire Nyquist, 64 kHz - 20 kHz, and must keep the file's samples as they were.
+        generate_sweep(20000, 20000, 200) >> write("test_resampling");
+        auto samples = collect(read("test_resampling"), 20 * BLOCK_SIZE, 180 * BLOCK_SIZE);
+        auto tone = level(samples, 20000);
+        auto image = level(samples, 44000);
+        assert_true(tone > 0.95 && tone < 1.05, "Tone kept through reading: " + std::to_string(tone));
+        assert_true(image < tone * 1.0e-3, "No image of the tone: " + std::to_string(image));
+        {
+            signal_file file{ work_space() + "test_resampling.sig" };
+            auto header = file.levels();
+            auto scale = 1.0 / std::max(-header.peak_negative, header.peak_positive);
+            auto wire = file.wire_block(20 * WIRE_BLOCK_SIZE);
+            for (uint64_t idx{ 0 }; idx < WIRE_BLOCK_SIZE; ++idx)
+                assert_equal(samples[2 * idx], double(wire[idx]) * scale, "Even samples are the file's");
+        }
+        delete_sig_file("test_resampling");
+
+        // Down to 44.1 kHz and back up leaves a tone well inside both bands as it was.
+        auto original = collect(generate_sweep(1000, 1000, 100), 0, 100 * BLOCK_SIZE);
+        auto there = resample(44100.0 / sample_rate());
+        generate_sweep(1000, 1000, 100) >> there;
+        auto back = resample(sample_rate() / 44100.0, resample_quality::BEST);
+        there >> back;
+        auto round_trip = collect(back, 0, 200 * BLOCK_SIZE);
+        assert_true(round_trip.size() >= 101 * BLOCK_SIZE, "Length kept: " + std::to_string(round_trip.size()));
+        double error{ 0.0 };
+        for (uint64_t idx{ 10 * BLOCK_SIZE }; idx < 90 * BLOCK_SIZE; ++idx)
+            error = std::max(error, std::abs(round_trip[idx] - original[idx]));
+        assert_true(error < 1.0e-3, "Round trip error: " + std::to_string(error));
+
+        // A ratio of one changes nothing.
+        auto same = resample(1.0);
+        generate_sweep(1000, 1000, 10) >> same;
+        auto unchanged = collect(same, 0, 20 * BLOCK_SIZE);
+        assert_equal(unchanged.size(), uint64_t(11 * BLOCK_SIZE), "Same length");
+        // The sweep's extra block is not the same as the longer one's.
+        for (uint64_t idx{ 0 }; idx < 10 * BLOCK_SIZE; ++idx)
+            assert_true(std::abs(unchanged[idx] - original[idx]) < 1.0e-12, "Unchanged at ratio one");
+    }
+
+    void test_sample_rates()
+    {
+        SF_SCOPE("test_sample_rates");
+        assert_throws<std::invalid_argument>([] { set_sample_rate(44100); }, "Unsupported sample rate",
+            "Blocks must hold whole milliseconds");
+        generate_sweep(1000, 1000, 50) >> write("test_sample_rates_full");
+        // Back to the default however the test ends.
+        struct restore
+        {
+            ~restore()
+            {
+                set_sample_rate(SAMPLES_PER_SECOND);
+            }
+        } restore_rate{};
+
+        set_sample_rate(32000);
+        assert_equal(block_size(), uint64_t(32), "A millisecond per block");
+        assert_equal(wire_rate(), uint64_t(32000), "Low rates are stored as they are");
+        generate_sweep(1000, 1000, 50) >> write("test_sample_rates");
+        {
+            signal_file file{ work_space() + "test_sample_rates.sig" };
+            assert_equal(file.rate(), uint64_t(32000), "Rate recorded");
+            assert_equal(file.samples(), uint64_t(51 * 32), "Length in milliseconds kept");
+        }
+        // A 1 kHz tone is the same tone at any rate: a full cycle every 32 samples here.
+        uint64_t at{ 0 };
+        auto in = read("test_sample_rates", clean_level::NONE);
+        while (auto block = in.next())
+        {
+            for (uint64_t idx{ 0 }; idx < block_size() && at < 50 * 32; ++idx, ++at)
+            {
+                auto expected = std::sin(2.0 * PI * 1000.0 * at / 32000.0);
+                assert_true(std::abs(block[idx] - expected) < 1.0e-5, "Tone at 32 kHz");
+            }
+            if (block != empty_block()) free_block(block);
+        }
+        assert_equal(at, uint64_t(50 * 32), "Every sample read");
+        assert_throws<std::invalid_argument>([] { read("test_sample_rates_full"); }, "Hz but renders",
+            "Files from other rates are refused");
+        delete_sig_file("test_sample_rates");
+        delete_sig_file("test_sample_rates_full");
+    }
+
+    void test_preview()
+    {
+        SF_SCOPE("test_preview");
+        struct restore
+        {
+            ~restore()
+            {
+                set_preview(false);
+            }
+        } restore_preview{};
+
+        set_preview(true);
+        assert_true(preview(), "Preview on");
+        assert_equal(sample_rate(), SF_SAMPLE_RATES[0], "Previews at the lowest rate");
+        auto wav = output_wav_path("test_preview");
+        assert_equal(wav.substr(wav.size() - 12), std::string{ "_preview.wav" }, "Preview wav named");
+
+        // One pass of a repeated chain.
+        auto repeated = generate_sweep(100, 8000, 200)
+            >> repeat(4, { filter_rbj(filter_type::PEAK, 1000, 0.2, 20) });
+        auto once = generate_sweep(100, 8000, 200)
+            >> filter_rbj(filter_type::PEAK, 1000, 0.2, 20);
+        uint64_t blocks{ 0 };
+        while (auto a = repeated.next())
+        {
+            auto b = once.next();
+            assert_true(b != nullptr, "Same length");
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+                assert_equal(a[idx], b[idx], "Repeat makes one pass");
+            free_block(a);
+            free_block(b);
+            ++blocks;
+        }
+        assert_equal(blocks, uint64_t(201), "Whole signal");
+
+        // A fused repeat likewise.
+        auto fused_repeated = drain(generate_sweep(100, 8000, 200)
+            >> fuse(fused::repeat<3>(fused::rbj(filter_type::PEAK, 1000, 0.2, 20))));
+        auto fused_once = drain(generate_sweep(100, 8000, 200)
+            >> fuse(fused::rbj(filter_type::PEAK, 1000, 0.2, 20)));
+        assert_true(fused_repeated == fused_once, "Fused repeat makes one pass");
+
+        // The cheap reverb still rings on after the input stops.
+        {
+            auto left = mix(mixer_type::APPEND);
+            auto right = mix(mixer_type::APPEND);
+            generate_sweep(440, 440, 100) >> left;
+            generate_silence(1000) >> left;
+            generate_sweep(660, 660, 100) >> right;
+            generate_silence(1000) >> right;
+            auto reverb = mreverberate("test_preview_l", "test_preview_r",
+                5000.0, 0.5, 10000.0, 0.5, 100.0, 1.0, 1.0, 1.0, 1.0);
+            left >> reverb;
+            right >> reverb;
+        }
+        for (auto name : { "test_preview_l", "test_preview_r" })
+        {
+            signal_file file{ work_space() + name + ".sig" };
+            assert_equal(file.samples(), uint64_t(1101 * 32), "Reverb as long as its input");
+            double tail{ 0 };
+            for (uint64_t pos{ 300 * 32 }; pos < 1100 * 32; pos += 32)
+            {
+                auto buf = file.wire_block(pos);
+                for (uint64_t idx{ 0 }; buf && idx < 32; ++idx)
+                    tail = std::max(tail, double(std::abs(buf[idx])));
+            }
+            assert_true(tail > 1.0e-3, "Reverb tail");
+        }
+        delete_sig_file("test_preview_l");
+        delete_sig_file("test_preview_r");
+
+        set_preview(false);
+        assert_true(!preview(), "Preview off");
+        assert_equal(sample_rate(), SAMPLES_PER_SECOND, "Back to the default rate");
+    }
+
+    void test_biquad_bank()
+    {
+        SF_SCOPE("test_biquad_bank");
+        // Not a whole number of lane groups, so the last one has spare lanes.
+        std::vector<biquad_channel> channels{};
+        for (uint64_t idx{ 0 }; idx < 11; ++idx)
+            channels.push_back({ filter_type::PEAK, 100.0 * (idx + 1), 0.1, 20, 1.0 / (idx + 1) });
+        auto source = [] {
+            auto sig = mix(mixer_type::APPEND);
+            generate_sweep(100, 4000, 200) >> sig;
+            generate_silence(300) >> sig;
+            return sig;
+        };
+
+        auto bank = source() >> filter_rbj_bank(3, channels);
+        auto sig_store = source() >> store();
+        auto chains = mix(mixer_type::ADD);
+        for (const auto& channel : channels)
+        {
+            copy(sig_store)
+                >> repeat(3, { filter_rbj(channel.m_type, channel.m_frequency, channel.m_q, channel.m_db_gain) })
+                >> amplify(channel.m_gain)
+                >> chains;
+        }
+        sig_store >> run();
+
+        uint64_t blocks{ 0 };
+        double peak{ 0 };
+        while (auto a = bank.next())
+        {
+            auto b = chains.next();
+            assert_true(b != nullptr, "Same length");
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+            {
+                auto x = a == empty_block() ? 0.0 : a[idx];
+                auto y = b == empty_block() ? 0.0 : b[idx];
+                // The chains settle one filter at a time, the bank all at once, so allow for that.
+                assert_true(std::abs(x - y) < 1.0e-12, "Bank matches the chains");
+                peak = std::max(peak, std::abs(x));
+            }
+            if (a != empty_block()) free_block(a);
+            if (b != empty_block()) free_block(b);
+            ++blocks;
+        }
+        assert_true(chains.next() == nullptr, "Same length");
+        assert_equal(blocks, uint64_t(501), "Whole signal");
+        assert_true(peak > 1.0, "Filters ring");
+        assert_throws<std::invalid_argument>([] { filter_rbj_bank(1, {}); }, "No channels", "Bank needs channels");
+
+        // A filter_bank of many pitches pulled in batches, as a writer would, spreads its groups
+        // over the render threads; silence between sounds goes through one block at a time.
+        std::vector<std::pair<double, double>> pitches{};
+        for (uint64_t idx{ 0 }; idx < 64; ++idx)
+            pitches.push_back({ 50.0 * (idx + 1), 1.0 / (idx + 1) });
+        auto render = [&](uint64_t threads)
+        {
+            SF_SCOPE("render");
+            set_render_threads(threads);
+            auto sig = mix(mixer_type::APPEND);
+            generate_sweep(100, 4000, 1000) >> sig;
+            generate_silence(20) >> sig;
+            generate_sweep(4000, 100, 1000) >> sig;
+            auto banked = filter_bank(sig, 0.1, 20, 4, pitches);
+            std::vector<double> out{};
+            double* batch[SF_BATCH_BLOCKS];
+            auto start = std::chrono::steady_clock::now();
+            uint64_t count{ 0 };
+            do
+            {
+                count = banked.next_n(batch);
+                for (uint64_t idx{ 0 }; idx < count; ++idx)
+                {
+                    for (uint64_t at{ 0 }; at < block_size(); ++at)
+                        out.push_back(batch[idx] == empty_block() ? 0.0 : batch[idx][at]);
+                    if (batch[idx] != empty_block()) free_block(batch[idx]);
+                }
+            } while (count == SF_BATCH_BLOCKS);
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+            set_render_threads(1);
+            return std::make_pair(out, took.count());
+        };
+        auto [serial, serial_took] = render(1);
+        auto [parallel, parallel_took] = render(4);
+        assert_equal(serial.size(), parallel.size(), "Bank same length in parallel");
+        assert_true(serial == parallel, "Bank bit identical in parallel");
+        std::cerr << "Filter bank of " << pitches.size() << " pitches took " << serial_took << "s on one thread, "
+            << parallel_took << "s on four" << std::endl;
+        // Only where there are the cores for it; elsewhere the times are just reported.
+        if (std::thread::hardware_concurrency() >= 4)
+            assert_true(parallel_took < serial_took * 0.75, "Bank scales with threads");
+    }
+
+    void test_rbj_look_ahead()
+    {
+        SF_SCOPE("test_rbj_look_ahead");
+        struct restore
+        {
+            ~restore()
+            {
+                set_rbj_look_ahead(false);
+            }
+        } restore_look_ahead{};
+
+        struct setting
+        {
+            filter_type type;
+            double frequency;
+            double q;
+            double db_gain;
+            uint64_t repeats;
+        };
+        // Resonant and low settings are where the forms are most likely to part.
+        std::vector<setting> settings{
+            { filter_type::PEAK, 440, 0.05, 20, 8 },
+            { filter_type::PEAK, 50, 0.01, 30, 2 },
+            { filter_type::LOWPASS, 100, 8, 0, 1 },
+            { filter_type::HIGHPASS, 2000, 0.7, 0, 2 },
+            { filter_type::BANDPASS_PEAK, 1000, 0.1, 0, 1 },
+            { filter_type::NOTCH, 3000, 1, 0, 1 },
+            { filter_type::HIGHSHELF, 8000, 1, -12, 1 }
+        };
+        auto render = [](const setting& s, bool look_ahead) {
+            set_rbj_look_ahead(look_ahead);
+            auto sig = mix(mixer_type::APPEND);
+            generate_sweep(20, 20000, 500) >> sig;
+            generate_silence(500) >> sig;
+            auto filtered = sig >> repeat(s.repeats, { filter_rbj(s.type, s.frequency, s.q, s.db_gain) });
+            std::vector<double> out{};
+            while (auto block = filtered.next())
+            {
+                for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+                    out.push_back(block == empty_block() ? 0.0 : block[idx]);
+                if (block != empty_block()) free_block(block);
+            }
+            return out;
+        };
+        for (const auto& s : settings)
+        {
+            auto direct = render(s, false);
+            auto ahead = render(s, true);
+            assert_equal(direct.size(), ahead.size(), "Same length");
+            double peak{ 0 }, error{ 0 };
+            for (uint64_t idx{ 0 }; idx < direct.size(); ++idx)
+            {
+                peak = std::max(peak, std::abs(direct[idx]));
+                error = std::max(error, std::abs(direct[idx] - ahead[idx]));
+            }
+            assert_true(peak > 0.1, "Filter passes something");
+            assert_true(error <= peak * 1.0e-9, "Look ahead matches the direct form: type " +
+                std::to_string(uint64_t(s.type)) + " error " + std::to_string(error / peak));
+        }
+
+        // Look ahead renders are not mistaken for direct ones in the render cache.
+        set_rbj_look_ahead(false);
+        auto direct_hash = rbj_filter{ filter_type::PEAK, 440, 0.05, 20 }.hash();
+        set_rbj_look_ahead(true);
+        assert_true(rbj_filter{ filter_type::PEAK, 440, 0.05, 20 }.hash() != direct_hash, "Hashes differ");
+    }
+
+    void test_shaped_rbj()
+    {
+        SF_SCOPE("test_shaped_rbj");
+        // The sweep runs one block past its length, so the controls do too.
+        auto shaped = [&](filter_type type, uint64_t control, envelope frequency, envelope q, envelope db_gain) {
+            auto filter = filter_shaped_rbj(type, control);
+            generate_sweep(20, 20000, 500) >> filter;
+            generate_linear(frequency) >> filter;
+            generate_linear(q) >> filter;
+            generate_linear(db_gain) >> filter;
+            return drain(filter);
+        };
+        auto worst = [](const std::vector<double>& expected, const std::vector<double>& actual) {
+            assert_equal(expected.size(), actual.size(), "Same length");
+            double peak{ 0 }, error{ 0 };
+            for (uint64_t idx{ 0 }; idx < expected.size(); ++idx)
+            {
+                peak = std::max(peak, std::abs(expected[idx]));
+                error = std::max(error, std::abs(expected[idx] - actual[idx]));
+            }
+            assert_true(peak > 0.1, "Filter passes something");
+            return error / peak;
+        };
+
+        // Constant controls are designed once with the fast maths; the result is what rbj_filter makes.
+        struct setting
+        {
+            filter_type type;
+            double frequency;
+            double q;
+            double db_gain;
+        };
+        std::vector<setting> settings{
+            { filter_type::PEAK, 440, 0.5, 12 },
+            { filter_type::PEAK, 50, 0.1, -20 },
+            { filter_type::LOWPASS, 100, 4, 0 },
+            { filter_type::HIGHPASS, 2000, 0.7, 0 },
+            { filter_type::BANDPASS_PEAK, 1000, 0.5, 0 },
+            { filter_type::BANDPASS_SKIRT, 500, 1, 0 },
+            { filter_type::NOTCH, 3000, 1, 0 },
+            { filter_type::ALLPASS, 6000, 1, 0 },
+            { filter_type::LOWSHELF, 200, 1, 6 },
+            { filter_type::HIGHSHELF, 8000, 1, -12 }
+        };
+        for (const auto& s : settings)
+        {
+            auto direct = drain(generate_sweep(20, 20000, 500) >> filter_rbj(s.type, s.frequency, s.q, s.db_gain));
+            auto fast = shaped(s.type, SF_SHAPED_RBJ_CONTROL, { { 0, s.frequency }, { 501, s.frequency } },
+                { { 0, s.q }, { 501, s.q } }, { { 0, s.db_gain }, { 501, s.db_gain } });
+            auto error = worst(direct, fast);
+            assert_true(error <= 1.0e-9, "Fast design matches rbj_filter: type " +
+                std::to_string(uint64_t(s.type)) + " error " + std::to_string(error));
+        }
+
+        // A sweeping cutoff ramped between control points stays close to designing at every sample.
+        for (auto type : { filter_type::LOWPASS, filter_type::PEAK })
+        {
+            envelope frequency{ { 0, 200 }, { 250, 4000 }, { 501, 300 } };
+            envelope q{ { 0, 0.7 }, { 501, 2 } };
+            envelope db_gain{ { 0, 0 }, { 501, 12 } };
+            auto every = shaped(type, 1, frequency, q, db_gain);
+            auto ramped = shaped(type, SF_SHAPED_RBJ_CONTROL, frequency, q, db_gain);
+            auto error = worst(every, ramped);
+            assert_true(error <= 1.0e-3, "Ramped coefficients track the controls: error " + std::to_string(error));
+        }
+
+        // A silent control is a control held at zero.
+        {
+            auto filter = filter_shaped_rbj(filter_type::LOWPASS);
+            generate_sweep(20, 20000, 500) >> filter;
+            generate_linear({ { 0, 1000 }, { 501, 1000 } }) >> filter;
+            generate_linear({ { 0, 0.7 }, { 501, 0.7 } }) >> filter;
+            generate_silence(501) >> filter;
+            auto direct = drain(generate_sweep(20, 20000, 500) >> filter_rbj(filter_type::LOWPASS, 1000, 0.7, 0));
+            auto error = worst(direct, drain(filter));
+            assert_true(error <= 1.0e-9, "Silent gain is no gain: error " + std::to_string(error));
+        }
+
+        assert_throws<std::invalid_argument>(
+            [] { filter_shaped_rbj(filter_type::LOWPASS, 3); },
+            "must divide the block size",
+            "Control interval checked");
+    }
+
+    void test_ladder_filter()
+    {
+        SF_SCOPE("test_ladder_filter");
+        // Each voice differs, with its cutoff swept so the controls are worked out every point.
+        auto feed = [](signal ladder, uint64_t voice) {
+            generate_sweep(20 + 10.0 * voice, 5000, 300) >> ladder;
+            generate_linear({ { 0, 0.5 + 0.05 * voice }, { 301, 0.9 } }) >> ladder;
+            generate_linear({ { 0, 300.0 + 100 * voice }, { 150, 3000 }, { 301, 3000 } }) >> ladder;
+        };
+
+        // A bank is exactly the ladders it stands for added up, whether a voice shares a group or not.
+        constexpr uint64_t voices{ 5 };
+        auto bank = ladder_bank(voices);
+        auto mixer = mix(mixer_type::ADD);
+        for (uint64_t voice{ 0 }; voice < voices; ++voice)
+        {
+            feed(bank, voice);
+            auto ladder = ladder_filter();
+            feed(ladder, voice);
+            ladder >> mixer;
+        }
+        auto banked = drain(bank);
+        auto mixed = drain(mixer);
+        assert_equal(banked.size(), mixed.size(), "Same length");
+        assert_equal(banked.size(), uint64_t(301 * block_size()), "Whole signal");
+        for (uint64_t idx{ 0 }; idx < banked.size(); ++idx)
+            assert_equal(banked[idx], mixed[idx], "Bank matches ladders at " + std::to_string(idx));
+
+        // Oversampling keeps the length and lines the output up with the input. The ladder's own
+        // tuning moves with the rate, but quietly (so the clipper does nothing) and with no
+        // resonance 2x and 4x are close enough that a sample out either way would show.
+        auto tone = [&](uint64_t oversample) {
+            auto ladder = ladder_filter(oversample);
+            generate_sweep(100, 300, 300) >> amplify(0.01) >> ladder;
+            generate_linear({ { 0, 0 }, { 301, 0 } }) >> ladder;
+            generate_linear({ { 0, 4000 }, { 301, 4000 } }) >> ladder;
+            return drain(ladder);
+        };
+        auto direct = tone(1);
+        auto twice = tone(2);
+        auto four = tone(4);
+        assert_equal(twice.size(), direct.size(), "Oversampled length 2");
+        assert_equal(four.size(), direct.size(), "Oversampled length 4");
+        double peak{ 0 };
+        for (auto v : twice)
+            peak = std::max(peak, std::abs(v));
+        assert_true(peak > 0.001, "Ladder passes something");
+        double error{ 0 };
+        // The first samples ring as the FIRs fill.
+        for (uint64_t idx{ block_size() }; idx < twice.size(); ++idx)
+            error = std::max(error, std::abs(twice[idx] - four[idx]));
+        assert_true(error <= peak * 0.02, "Oversampled output lines up: error " + std::to_string(error / peak));
+
+        // A silent control is a control held at zero, and a silent signal filters to silence.
+        auto held = [&](bool silent) {
+            auto ladder = ladder_filter();
+            generate_sweep(100, 3000, 300) >> ladder;
+            if (silent)
+                generate_silence(301) >> ladder;
+            else
+                generate_linear({ { 0, 0 }, { 301, 0 } }) >> ladder;
+            generate_linear({ { 0, 2000 }, { 301, 2000 } }) >> ladder;
+            return drain(ladder);
+        };
+        auto zero = held(false);
+        auto silent = held(true);
+        assert_equal(silent.size(), zero.size(), "Silent control length");
+        for (uint64_t idx{ 0 }; idx < zero.size(); ++idx)
+            assert_equal(silent[idx], zero[idx], "Silent resonance is none at " + std::to_string(idx));
+        {
+            auto ladder = ladder_filter();
+            generate_silence(10) >> ladder;
+            generate_silence(10) >> ladder;
+            generate_linear({ { 0, 2000 }, { 10, 2000 } }) >> ladder;
+            auto quiet = drain(ladder);
+            assert_true(std::all_of(quiet.begin(), quiet.end(), [](double v) { return v == 0.0; }), "Silence in, silence out");
+        }
+
+        assert_throws<std::invalid_argument>(
+            [&] {
+                auto ladder = ladder_filter();
+                generate_sweep(100, 3000, 20) >> ladder;
+                generate_linear({ { 0, 0.5 }, { 11, 0.5 } }) >> ladder;
+                generate_linear({ { 0, 2000 }, { 21, 2000 } }) >> ladder;
+                drain(ladder);
+            },
+            "same length",
+            "Lengths checked");
+        assert_throws<std::invalid_argument>(
+            [] { ladder_filter(3); },
+            "must be 1, 2 or 4",
+            "Oversampling checked");
+        assert_throws<std::invalid_argument>(
+            [&] {
+                auto ladder = ladder_bank(2);
+                feed(ladder, 0);
+                ladder.next();
+            },
+            "three inputs",
+            "Inputs checked");
+    }
+
+    void test_svf_filter()
+    {
+        SF_SCOPE("test_svf_filter");
+        // The sweep runs one block past its length, so the controls do too. Each tap is drained in
+        // turn, so all but the first are waiting on the filter for the whole signal.
+        auto svf = [&](const std::vector<svf_response>& responses, envelope frequency, envelope q) {
+            auto filter = filter_svf();
+            generate_sweep(20, 20000, 300) >> filter;
+            generate_linear(frequency) >> filter;
+            generate_linear(q) >> filter;
+            std::vector<signal> taps{};
+            for (auto response : responses)
+                taps.push_back(svf_tap(filter, response));
+            std::vector<std::vector<double>> outs{};
+            for (auto& tap : taps)
+                outs.push_back(drain(tap));
+            return outs;
+        };
+        auto rbj = [&](filter_type type, double frequency, double q) {
+            return drain(generate_sweep(20, 20000, 300) >> filter_rbj(type, frequency, q, 0));
+        };
+        auto worst = [](const std::vector<double>& expected, const std::vector<double>& actual) {
+            assert_equal(expected.size(), actual.size(), "Same length");
+            double peak{ 0 }, error{ 0 };
+            for (uint64_t idx{ 0 }; idx < expected.size(); ++idx)
+            {
+                peak = std::max(peak, std::abs(expected[idx]));
+                error = std::max(error, std::abs(expected[idx] - actual[idx]));
+            }
+            assert_true(peak > 0.1, "Filter passes something");
+            return error / peak;
+        };
+
+        // Held still, low and high are the same bilinear transforms rbj_filter makes, and peak is
+        // the one less the other.
+        for (double frequency : { 100.0, 1000.0, 12000.0 })
+        {
+            for (double q : { 0.5, 0.7071, 4.0 })
+            {
+                envelope f{ { 0, frequency }, { 301, frequency } };
+                envelope qs{ { 0, q }, { 301, q } };
+                auto low = rbj(filter_type::LOWPASS, frequency, q);
+                auto high = rbj(filter_type::HIGHPASS, frequency, q);
+                auto taps = svf({ svf_response::LOW, svf_response::HIGH, svf_response::PEAK }, f, qs);
+                const auto& svf_low = taps[0];
+                const auto& svf_high = taps[1];
+                const auto& svf_peak = taps[2];
+                std::vector<double> peak(low.size());
+                for (uint64_t idx{ 0 }; idx < low.size(); ++idx)
+                    peak[idx] = low[idx] - high[idx];
+                auto what = std::to_string(frequency) + " q " + std::to_string(q);
+                assert_true(worst(low, svf_low) <= 1.0e-9, "Low matches rbj at " + what);
+                assert_true(worst(high, svf_high) <= 1.0e-9, "High matches rbj at " + what);
+                assert_true(worst(peak, svf_peak) <= 1.0e-9, "Peak is low less high at " + what);
+            }
+        }
+
+        // Low, high and band over q add back up to the input, however fast the controls move; and
+        // notch is low and high together. All five come from one filter.
+        envelope sweep{ { 0, 100 }, { 50, 8000 }, { 100, 200 }, { 150, 15000 }, { 200, 50 }, { 301, 3000 } };
+        envelope qs{ { 0, 0.5 }, { 100, 10 }, { 200, 0.7 }, { 301, 2 } };
+        auto input = drain(generate_sweep(20, 20000, 300));
+        std::vector<svf_response> responses{
+            svf_response::LOW, svf_response::BAND, svf_response::HIGH, svf_response::NOTCH, svf_response::PEAK };
+        auto all = svf(responses, sweep, qs);
+        const auto& low = all[0];
+        const auto& band = all[1];
+        const auto& high = all[2];
+        const auto& notch = all[3];
+        auto q_at = drain(generate_linear(qs));
+        std::vector<double> sum(input.size()), low_high(input.size());
+        for (uint64_t idx{ 0 }; idx < input.size(); ++idx)
+        {
+            sum[idx] = low[idx] + band[idx] / q_at[idx] + high[idx];
+            low_high[idx] = low[idx] + high[idx];
+        }
+        assert_true(worst(input, sum) <= 1.0e-9, "Responses add up to the input");
+        assert_true(worst(low_high, notch) <= 1.0e-9, "Notch is low and high");
+        for (uint64_t idx{ 0 }; idx < responses.size(); ++idx)
+            assert_true(svf({ responses[idx] }, sweep, qs)[0] == all[idx], "Tap matches a filter of its own");
+
+        // Taps pulled together, as by a mixer, share each block's update as well.
+        {
+            auto filter = filter_svf();
+            generate_sweep(20, 20000, 300) >> filter;
+            generate_linear(sweep) >> filter;
+            generate_linear(qs) >> filter;
+            auto mixed = mix(mixer_type::ADD);
+            svf_tap(filter, svf_response::LOW) >> mixed;
+            svf_tap(filter, svf_response::HIGH) >> mixed;
+            assert_true(worst(notch, drain(mixed)) <= 1.0e-9, "Mixed taps are notch");
+        }
+
+        // A silent frequency holds the filter at zero, where high passes everything; a silent or
+        // zero q is held just above zero rather than making the output infinite.
+        auto silent = [&](svf_response response, bool frequency, bool q) {
+            auto filter = filter_svf();
+            generate_sweep(20, 20000, 300) >> filter;
+            if (frequency)
+                generate_silence(301) >> filter;
+            else
+                generate_linear({ { 0, 1000 }, { 301, 1000 } }) >> filter;
+            if (q)
+                generate_silence(301) >> filter;
+            else
+                generate_linear({ { 0, 0 }, { 301, 0 } }) >> filter;
+            return drain(svf_tap(filter, response));
+        };
+        assert_true(worst(input, silent(svf_response::HIGH, true, false)) <= 1.0e-9, "Silent frequency passes high");
+        auto silent_q = silent(svf_response::LOW, false, true);
+        auto zero_q = silent(svf_response::LOW, false, false);
+        assert_true(std::all_of(silent_q.begin(), silent_q.end(), [](double v) { return std::isfinite(v); }),
+            "Silent q stays finite");
+        assert_true(silent_q == zero_q, "Silent q is q held at zero");
+
+        assert_throws<std::invalid_argument>(
+            [] {
+                auto filter = filter_svf();
+                generate_silence(10) >> filter;
+                generate_silence(10) >> filter;
+                svf_tap(filter, svf_response::LOW).next();
+            },
+            "three inputs",
+            "Inputs checked");
+        assert_throws<std::logic_error>(
+            [] {
+                auto filter = filter_svf();
+                for (uint64_t input{ 0 }; input < 3; ++input)
+                    generate_silence(10) >> filter;
+                auto low = svf_tap(filter, svf_response::LOW);
+                free_block(low.next());
+                svf_tap(filter, svf_response::HIGH);
+            },
+            "once it has been pulled",
+            "Taps made before pulling");
+        assert_throws<std::logic_error>(
+            [] { filter_svf().next(); },
+            "pulled through its taps",
+            "Filter pulled through taps");
+    }
+
+    void test_memory_tracking()
+    {
+        SF_SCOPE("test_memory_tracking");
+        // Each allocation is a whole sampling interval so every one of them is sampled.
+        constexpr uint64_t allocations{ 32 };
+        constexpr uint64_t bytes{ 64 * 1024 };
+        std::vector<std::unique_ptr<char[]>> kept{};
+        kept.reserve(allocations);
+        std::stringstream report{};
+        {
+            // The report comes as the tracking scope ends, into report.
+            struct restore
+            {
+                std::streambuf* m_cerr;
+                ~restore()
+                {
+                    std::cerr.rdbuf(m_cerr);
+                }
+            } restore_cerr{ std::cerr.rdbuf(report.rdbuf()) };
+            SF_TRACK_MEMORY_SCOPE tracking{};
+            SF_MESG_STACK("test_memory_tracking site");
+            for (uint64_t idx{ 0 }; idx < allocations; ++idx)
+                kept.emplace_back(new char[bytes]);
+        }
+
+        // Each site's total is followed by its frames, innermost first.
+        uint64_t site_bytes{ 0 }, site_samples{ 0 }, attributed{ 0 }, sampled{ 0 };
+        bool first_frame{ false };
+        std::string line{};
+        while (std::getline(report, line))
+        {
+            if (line.starts_with("LEAK: about "))
+            {
+                // "LEAK: about <bytes> bytes from <samples> sampled allocations"
+                std::istringstream fields{ line.substr(12) };
+                std::string word{};
+                fields >> site_bytes >> word >> word >> site_samples;
+                first_frame = true;
+                continue;
+            }
+            if (first_frame && line.starts_with("...test_memory_tracking site:"))
+            {
+                attributed += site_bytes;
+                sampled += site_samples;
+            }
+            first_frame = false;
+        }
+        assert_equal(attributed, allocations * bytes, "Bytes put down to the site which allocated them");
+        assert_equal(sampled, allocations, "Every allocation sampled");
+    }
+
     void test_tests()
     {
         assert_throws<std::logic_error>(
@@ -131,6 +131,19 @@ namespace sonic_field
         std::cerr << "Sub-test: " << name << std::endl;
     }
 
+    // Pulls a signal to its end, silent blocks coming out as zeros, and frees what it pulled.
+    inline std::vector<double> drain(signal sig)
+    {
+        std::vector<double> out{};
+        while (auto block = sig.next())
+        {
+            for (uint64_t idx{ 0 }; idx < block_size(); ++idx)
+                out.push_back(block == empty_block() ? 0.0 : block[idx]);
+            if (block != empty_block()) free_block(block);
+        }
+        return out;
+    }
+
     class test_runner
     {
         uint64_t m_failed;
@@ -12,6 +12,9 @@ constexpr int32_t FMT_CHUNK_ID   = 0x20746D66;
 constexpr int32_t DATA_CHUNK_ID  = 0x61746164;
 constexpr int32_t RIFF_CHUNK_ID  = 0x46464952;
 constexpr int32_t RIFF_TYPE_ID   = 0x45564157;
+constexpr int32_t FACT_CHUNK_ID  = 0x74636166;
+constexpr int32_t PEAK_CHUNK_ID  = 0x4B414550;
+constexpr uint16_t WAVE_FORMAT_IEEE_FLOAT = 3;
 
 class wav_file
 {
@@ -185,86 +188,146 @@ public:
     }
 };
 
+// Sample decoders, one per format so the loop over a block is specialised for it. PCM of 8 to 24
+// bits comes out negated, as it always has from this reader; 32 bit PCM and float come out as
+// stored.
+struct pcm8_decoder
+{
+    static constexpr uint16_t BYTES = 1;
+    static double decode(const char* in)
+    {
+        return -double(uint8_t(*in)) / 128.0;
+    }
+};
+
+struct pcm16_decoder
+{
+    static constexpr uint16_t BYTES = 2;
+    static double decode(const char* in)
+    {
+        int16_t v;
+        memcpy(&v, in, sizeof(v));
+        return -double(v) / 32768.0;
+    }
+};
+
+struct pcm24_decoder
+{
+    static constexpr uint16_t BYTES = 3;
+    static double decode(const char* in)
+    {
+        int32_t v = uint8_t(in[0]) | (uint8_t(in[1]) << 8) | (int32_t(int8_t(in[2])) * 65536);
+        return -double(v) / 8388608.0;
+    }
+};
+
+struct pcm32_decoder
+{
+    static constexpr uint16_t BYTES = 4;
+    static double decode(const char* in)
+    {
+        int32_t v;
+        memcpy(&v, in, sizeof(v));
+        return double(v) / 2147483648.0;
+    }
+};
+
+struct float32_decoder
+{
+    static constexpr uint16_t BYTES = 4;
+    static double decode(const char* in)
+    {
+        float v;
+        memcpy(&v, in, sizeof(v));
+        return double(v);
+    }
+};
+
+template<typename D>
+void decode_samples(const char* in, double* out, uint64_t count)
+{
+    for (uint64_t idx{ 0 }; idx < count; ++idx)
+        out[idx] = D::decode(in + idx * D::BYTES);
+}
+
+// Reads straight out of a mapping of the file a block at a time.
 class wav_file_reader : public wav_file
 {
-    std::ifstream m_istream;
-    std::streampos m_len;
-    std::streampos m_read;
+    std::shared_ptr<const mapped_file> m_map;
+    const char* m_samples;
+    uint16_t m_format;
+    void (*m_decode)(const char*, double*, uint64_t);
 
-    void check_istream()
+    const char* at(uint64_t position, uint64_t bytes)
     {
-        if (!m_istream)
+        if (position + bytes > m_map->size())
             SF_THROW(std::out_of_range("End of file or could not open: " + m_file));
+        return m_map->data() + position;
     }
 
 public:
-    explicit wav_file_reader(const std::string& file_name)
+    explicit wav_file_reader(const std::string& file_name) :
+        m_map{},
+        m_samples{ nullptr },
+        m_format{ 0 },
+        m_decode{ nullptr }
     {
         std::cerr << "Opening wav file: " << file_name << std::endl;
-        m_istream.open(file_name, std::ifstream::ate | std::ifstream::binary);
-        m_len = m_istream.tellg();
-        m_istream.seekg(0);
-
-        // Read the first 12 bytes of the file
-        m_istream.read(m_buffer, 12);
-        check_istream();
+        m_file = file_name;
+        m_map = map_file(file_name);
+        uint64_t len = m_map->size();
 
         // Extract parts from the header
-        auto riffChunkID = getLE(m_buffer, 0, 4);
-        auto chunkSize = getLE(m_buffer, 4, 4);
-        auto riffTypeID = getLE(m_buffer, 8, 4);
+        auto header = at(0, 12);
+        auto riffChunkID = getLE(header, 0, 4);
+        auto chunkSize = getLE(header, 4, 4);
+        auto riffTypeID = getLE(header, 8, 4);
 
         // Check the header bytes contains the correct signature
         if (riffChunkID != RIFF_CHUNK_ID) SF_THROW(std::logic_error("Invalid Wav Header data, incorrect riff chunk ID"));
         if (riffTypeID != RIFF_TYPE_ID) SF_THROW(std::logic_error("Invalid Wav Header data, incorrect riff type ID"));
 
         // Check that the file size matches the number of bytes listed in header
-        if (m_len != chunkSize + 8)
+        if (len != uint64_t(chunkSize) + 8)
         {
             SF_THROW(std::logic_error{"Header chunk size (" + std::to_string(chunkSize)
-                + ") does not match file size (" + std::to_string(m_len) + ")"});
+                + ") does not match file size (" + std::to_string(len) + ")"});
         }
 
         auto foundFormat{false};
-        auto foundData{false};
+        uint64_t position{ 12 };
 
         // Search for the Format and Data Chunks
         while (true)
         {
-            // Read the first 8 bytes of the chunk (ID and chunk size)
-            m_istream.read(m_buffer, 8);
-            check_istream();
-
             // Extract the chunk ID and Size
-            long chunkID = getLE(m_buffer, 0, 4);
-            chunkSize = getLE(m_buffer, 4, 4);
+            auto chunk = at(position, 8);
+            long chunkID = getLE(chunk, 0, 4);
+            chunkSize = getLE(chunk, 4, 4);
+            position += 8;
 
             // Word align the chunk size
-            // chunkSize specifies the number of bytes holding data. However,
-            // the data should be word aligned (2 bytes) so we need to calculate
-            // the actual number of bytes in the chunk
-            auto numChunkBytes = (chunkSize % 2 == 1) ? chunkSize + 1 : chunkSize;
+            uint64_t numChunkBytes = (chunkSize % 2 == 1) ? uint64_t(chunkSize) + 1 : chunkSize;
 
             if (chunkID == FMT_CHUNK_ID)
             {
                 // Flag that the format chunk has been found
                 foundFormat = true;
 
-                // Read in the header info
-                m_istream.read(m_buffer, 16);
-                check_istream();
-
-                // Check this is uncompressed data
-                auto compressionCode = getLE(m_buffer, 0, 2);
-                if (compressionCode != 1)
-                    SF_THROW(std::logic_error("Compression Code " + std::to_string(compressionCode) + " not supported"));
+                auto format = at(position, 16);
+                m_format = getLE(format, 0, 2);
+                // Extensible headers give the real format at the start of the sub format GUID.
+                if (m_format == 0xFFFE && chunkSize >= 40)
+                    m_format = getLE(at(position + 24, 2), 0, 2);
+                if (m_format != 1 && m_format != WAVE_FORMAT_IEEE_FLOAT)
+                    SF_THROW(std::logic_error("Compression Code " + std::to_string(m_format) + " not supported"));
 
                 // Extract the format information
-                auto num_chans = (uint64_t)getLE(m_buffer, 2, 2);
-                m_sample_rate = getLE(m_buffer, 4, 4);
+                auto num_chans = (uint64_t)getLE(format, 2, 2);
+                m_sample_rate = getLE(format, 4, 4);
                 std::cerr << "Sample Rate: " << m_sample_rate << std::endl;
-                m_block_align = (uint64_t)getLE(m_buffer, 12, 2);
-                m_valid_bits = (uint64_t)getLE(m_buffer, 14, 2);
+                m_block_align = (uint64_t)getLE(format, 12, 2);
+                m_valid_bits = (uint64_t)getLE(format, 14, 2);
 
                 if (num_chans == 0) SF_THROW(std::logic_error(
                                 "Number of channels specified in header is equal to zero"));
@@ -272,112 +335,66 @@ public:
                     SF_THROW(std::logic_error("Only single channel wav supported"));
                 if (m_block_align == 0)
                     SF_THROW(std::logic_error("Block Align specified in header is equal to zero"));
-                if (m_valid_bits < 2)
-                    SF_THROW(std::logic_error("Valid Bits specified in header is less than 2"));
-                if (m_valid_bits > 64)
-                    SF_THROW(std::logic_error(
-                                "Valid Bits specified in header is greater than 64, this is greater than a long can hold"));
                 std::cerr << "Bit Depth: " << m_valid_bits << std::endl;
 
-
                 // Calculate the number of bytes required to hold 1 sample
                 m_bytes_per_sample = (m_valid_bits + 7) / 8;
                 std::cerr << "Bytes Per Sample: " << m_bytes_per_sample << std::endl;
                 if (m_bytes_per_sample != m_block_align) SF_THROW(std::logic_error(
                                 "Block Align does not agree with bytes required for validBits and number of channels"));
 
-                // Account for number of format bytes and then skip over
-                // any extra format bytes
-                numChunkBytes -= 16;
-                if (numChunkBytes > 0)
-                    m_istream.seekg(numChunkBytes, m_istream.cur);
-                std::cerr << "Chunk Bites Left: " << numChunkBytes << std::endl;
+                if (m_format == WAVE_FORMAT_IEEE_FLOAT && m_valid_bits == 32)
+                    m_decode = decode_samples<float32_decoder>;
+                else if (m_format == 1 && m_valid_bits == 8)
+                    m_decode = decode_samples<pcm8_decoder>;
+                else if (m_format == 1 && m_valid_bits == 16)
+                    m_decode = decode_samples<pcm16_decoder>;
+                else if (m_format == 1 && m_valid_bits == 24)
+                    m_decode = decode_samples<pcm24_decoder>;
+                else if (m_format == 1 && m_valid_bits == 32)
+                    m_decode = decode_samples<pcm32_decoder>;
+                else
+                    SF_THROW(std::logic_error("Bit depth " + std::to_string(m_valid_bits) + " not supported"));
             }
             else if (chunkID == DATA_CHUNK_ID)
             {
-                // Check if we've found the format chunk,
-                // If not, SF_THROW(an exception as we need the format information
-                // before we can read the data chunk
+                // We need the format information before we can read the data chunk
                 if (foundFormat == false)
                     SF_THROW(std::logic_error("Data chunk found before Format chunk"));
 
-                // Check that the chunkSize (wav data length) is a multiple of
-                // the
-                // block align (bytes per frame)
+                // Check that the chunkSize (wav data length) is a multiple of the block align
+                // (bytes per frame)
                 if (chunkSize % m_block_align != 0)
                     SF_THROW(std::logic_error("Data Chunk size is not multiple of Block Align"));
 
                 // Calculate the number of frames
                 m_num_frames = chunkSize / m_block_align;
                 std::cerr << "Number Of Frames: " << m_num_frames << std::endl;
-                m_len = m_istream.tellg() + std::streampos{chunkSize};
-
-                // Flag that we've found the wave data chunk
-                foundData = true;
-
+                m_samples = at(position, chunkSize);
                 break;
             }
             else
             {
-                // If an unknown chunk ID is found, just skip over the chunk
-                // data
+                // If an unknown chunk ID is found, just skip over the chunk data
                 std::cerr << "Skipping Chunk: " << numChunkBytes << std::endl;
-                m_istream.seekg(numChunkBytes, m_istream.cur);
             }
+            position += numChunkBytes;
         }
-
-        // SF_THROW(an exception if no data chunk has been found
-        if (foundData == false)
-            SF_THROW(std::logic_error{ "Did not find a data chunk" });
-    
-        m_buffer_pointer = 0;
-        m_bytes_read = 0;
         m_frame_counter = 0;
-        m_read = m_istream.tellg();
     };
- 
-    double read_sample()
-    {
-        long val = 0;
 
-        for (uint16_t b = 0; b < m_bytes_per_sample; b++)
-        {
-            if (m_buffer_pointer == m_bytes_read)
-            {
-                auto start = m_read;
-                auto read = m_len - start;
-                if (read > BUFFER_SIZE)
-                    read = BUFFER_SIZE;
-                check_istream();
-                m_istream.read(m_buffer, read);
-                m_read += read;
-                m_bytes_read = uint32_t(read);
-                m_buffer_pointer = 0;
-                if (m_bytes_read == 0)
-                    continue;
-            }
-
-            int32_t v = m_buffer[m_buffer_pointer];
-            if (b < m_bytes_per_sample - 1 || m_bytes_per_sample == 1)
-                v &= 0xFF;
-            val += v << (b * 8);
-
-            m_buffer_pointer++;
-        }
-
-        // Not sure if the correction of sign should be here or some place else.
-        return -double(val) / double(1 << ((m_bytes_per_sample * 8) - 1)) ;
-    }
-
-    void close()
+    // Decode the next block into out, padding the end of the last with zeros.
+    void read_block(double* out)
     {
-        if (m_istream.is_open())
-            m_istream.close();
+        auto count = std::min(block_size(), m_num_frames - m_frame_counter);
+        m_decode(m_samples + m_frame_counter * m_block_align, out, count);
+        std::fill(out + count, out + block_size(), 0.0);
+        m_frame_counter += count;
     }
 
     bool has_more()
     {
-        return m_read < m_len;
+        return m_frame_counter < m_num_frames;
     }
 };
 
@@ -389,14 +406,8 @@ double* wav_reader::next()
 {
     if (!m_reader->has_more())
         return nullptr;
-    auto out = new_block();
-    for(uint64_t i{0}; i < BLOCK_SIZE; ++i)
-    {
-        if (m_reader->has_more())
-            out[i] = m_reader->read_sample();
-        else
-            out[i] = 0.0;
-    }
+    auto out = new_block(false);
+    m_reader->read_block(out);
     return out;
 }
 
@@ -410,37 +421,186 @@ wav_reader::~wav_reader()
     delete m_reader;
 }
 
+#pragma pack(push, 1)
+// Everything ahead of the samples in a wav_writer file: RIFF header, fmt with the extension size
+// non-PCM formats need, fact and PEAK (from Broadcast Wave) chunks, and the data chunk header.
+struct float_wav_header
+{
+    uint32_t riff_id;
+    uint32_t riff_size;
+    uint32_t wave_id;
+    uint32_t fmt_id;
+    uint32_t fmt_size;
+    uint16_t format;
+    uint16_t channels;
+    uint32_t sample_rate;
+    uint32_t bytes_per_second;
+    uint16_t block_align;
+    uint16_t bits;
+    uint16_t extension_size;
+    uint32_t fact_id;
+    uint32_t fact_size;
+    uint32_t frames;
+    uint32_t peak_id;
+    uint32_t peak_size;
+    uint32_t peak_version;
+    uint32_t peak_time;
+    float peak_value;
+    uint32_t peak_position;
+    uint32_t data_id;
+    uint32_t data_size;
+};
+#pragma pack(pop)
+
+// Previews get their own name so they never stand in for, or overwrite, a full render.
+std::string output_wav_path(const std::string& name)
+{
+    return output_space() + name + (preview() ? "_preview" : "") + ".wav";
+}
+
+wav_writer::wav_writer(const std::string& name) :
+    m_name{ output_wav_path(name) },
+    m_out{},
+    m_decimate{},
+    m_samples{ 0 },
+    m_peak{ 0 },
+    m_peak_position{ 0 }
+    {}
+
+void wav_writer::inject(signal& in)
+{
+    SF_MESG_STACK("wav_writer::inject");
+    signal_mono_base::inject(in);
+    std::cerr << "Writing wav file: " << m_name << std::endl;
+    std::remove(m_name.c_str());
+    m_out.reset(new async_file_writer{ m_name });
+    // Filled in by finish() once the length and peak are known.
+    float_wav_header header{};
+    m_out->write(&header, sizeof(header));
+    double* batch[SF_BATCH_BLOCKS];
+    uint64_t count{ 0 };
+    do
+    {
+        count = input().next_n(batch);
+        for (uint64_t idx{ 0 }; idx < count; ++idx)
+            write_block(batch[idx]);
+    } while (count == SF_BATCH_BLOCKS);
+    finish();
+}
+
+void wav_writer::write_block(double* data)
+{
+    float buff[WIRE_BLOCK_SIZE];
+    auto size = wire_block_size();
+    auto decimating = sample_rate() != wire_rate();
+    if (data == empty_block() && m_decimate.settled())
+    {
+        memset(buff, 0, sizeof(buff));
+    }
+    else
+    {
+        auto block = data == empty_block() ? new_block() : data;
+        if (m_samples == 0 && decimating)
+        {
+            // Prefeed the decimator with the first value, as signal_writer does.
+            for (uint64_t idx{ 0 }; idx < 8; ++idx)
+                m_decimate.decimate(block[0], block[0]);
+        }
+        for (uint64_t idx{ 0 }; idx < size; ++idx)
+        {
+            auto v = float(decimating ? m_decimate.decimate(block[idx * 2], block[idx * 2 + 1]) : block[idx]);
+            if (std::abs(v) > m_peak)
+            {
+                m_peak = std::abs(v);
+                m_peak_position = m_samples + idx;
+            }
+            buff[idx] = v;
+        }
+        free_block(block);
+    }
+    m_samples += size;
+    m_out->write(buff, size * sizeof(float));
+}
+
+void wav_writer::finish()
+{
+    SF_MARK_STACK;
+    float_wav_header header{};
+    auto data_size = m_samples * sizeof(float);
+    if (data_size > std::numeric_limits<uint32_t>::max() - sizeof(header))
+        SF_THROW(std::invalid_argument{ "Signal too long for wav" });
+    header.riff_id = RIFF_CHUNK_ID;
+    header.riff_size = uint32_t(sizeof(header) - 8 + data_size);
+    header.wave_id = RIFF_TYPE_ID;
+    header.fmt_id = FMT_CHUNK_ID;
+    header.fmt_size = 18;
+    header.format = WAVE_FORMAT_IEEE_FLOAT;
+    header.channels = 1;
+    header.sample_rate = uint32_t(wire_rate());
+    header.bytes_per_second = header.sample_rate * sizeof(float);
+    header.block_align = sizeof(float);
+    header.bits = 32;
+    header.extension_size = 0;
+    header.fact_id = FACT_CHUNK_ID;
+    header.fact_size = 4;
+    header.frames = uint32_t(m_samples);
+    header.peak_id = PEAK_CHUNK_ID;
+    header.peak_size = 16;
+    header.peak_version = 1;
+    header.peak_time = uint32_t(time(nullptr));
+    header.peak_value = m_peak;
+    header.peak_position = uint32_t(m_peak_position);
+    header.data_id = DATA_CHUNK_ID;
+    header.data_size = uint32_t(data_size);
+    m_out->write_at(0, &header, sizeof(header));
+    m_out->close();
+    m_out.reset();
+    std::cerr << "Wrote wav file:  name: " << m_name << " peak: " << m_peak << " samples: " << m_samples << std::endl;
+}
+
+double* wav_writer::next()
+{
+    // Everything went to the file at inject.
+    return nullptr;
+}
+
+const char* wav_writer::name()
+{
+    return "wav_writer";
+}
+
 void signal_to_wav(const std::string& filename_in)
 {
     SF_MARK_STACK;
-    signal_file_header header;
     auto filename = work_space() + filename_in + ".sig";
-    std::ifstream in(filename, std::ifstream::ate | std::ifstream::binary);
-    if (!in)
+    persist_signal(filename);
+    if (!std::ifstream{ filename })
         SF_THROW(std::invalid_argument{ "File not found: " + filename});
-    auto len = (size_t(in.tellg()) - sizeof(header)) / sizeof(float);
-    in.seekg(0);
-    auto wavname = output_space() + filename_in + ".wav";
+    signal_file in{ filename };
+    auto len = in.samples();
+    auto wavname = output_wav_path(filename_in);
     std::cerr << "Writing wav file: " << wavname << std::endl;
     if (len > std::numeric_limits<uint32_t>::max())
         SF_THROW(std::invalid_argument{ "Signal too long for wav"});
-    wavsignal_writer wav{ wavname, uint32_t(len), SAMPLES_PER_SECOND>>1 };
+    wavsignal_writer wav{ wavname, uint32_t(len), uint32_t(in.rate()) };
 
-    in.read(reinterpret_cast<char*>(&header), sizeof(header));
-    if (!in) SF_THROW(std::out_of_range{ "signal file corrupt" });
+    const auto& header = in.levels();
     auto scale = -header.peak_negative > header.peak_positive ?
         -1.0 / header.peak_negative : 1.0 / header.peak_positive;
     scale *= 0.99;
     std::cerr << "Wave scaling factor: " << scale << std::endl;
-    for (decltype(len) idx{ 0 }; idx < len; ++idx)
+    static const float zeros[WIRE_BLOCK_SIZE]{};
+    auto size = in.block_samples();
+    for (decltype(len) pos{ 0 }; pos < len; pos += size)
     {
-        char buf[sizeof(float)];
-        in.read(buf, sizeof(float));
-        if (!in)
-            SF_THROW(std::out_of_range{ "signal file corrupt" });
-        float fsamp = *(reinterpret_cast<float*>(buf)) * scale;
-        auto isamp = int32_t(fsamp * std::numeric_limits<int32_t>::max());
-        wav.writeSample(isamp);
+        auto buf = in.wire_block(pos);
+        if (!buf) buf = zeros;
+        for (uint64_t idx{ 0 }; idx < size; ++idx)
+        {
+            float fsamp = buf[idx] * scale;
+            auto isamp = int32_t(fsamp * std::numeric_limits<int32_t>::max());
+            wav.writeSample(isamp);
+        }
     }
     wav.flush();
     wav.close();